@@ -18,6 +18,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/stat.h>
 
 #include <confuse.h>
@@ -28,14 +29,31 @@
 
 
 #define DEFAULT_SERVER_PORT  0
+#define DEFAULT_LED_RATE     0
+#define DEFAULT_SYS_RATE     0
 #define DEFAULT_OSC_PREFIX   "/monome"
 #define DEFAULT_APP_PORT     8000
 #define DEFAULT_APP_HOST     "127.0.0.1"
 #define DEFAULT_ROTATION     MONOME_ROTATE_0
+#define DEFAULT_EVENT_BUDGET 32
+#define DEFAULT_LED_REFRESH  0
+#define MAX_LED_REFRESH      1000
+#define DEFAULT_LED_ANIM     60
+#define MAX_LED_ANIM         1000
+#define DEFAULT_ECHO         "off"
+#define DEFAULT_ECHO_LEVEL   15
+#define DEFAULT_LAYER_TIMEOUT 60
+
+/* how long after it was saved the LED snapshot is still worth putting
+   back up: enough to cover replugging the device, in seconds */
+#define LED_SNAPSHOT_MAX_AGE 30
 
 
 static cfg_opt_t server_opts[] = {
 	CFG_INT("port",       DEFAULT_SERVER_PORT, CFGF_NONE),
+	CFG_INT("led_rate",   DEFAULT_LED_RATE,    CFGF_NONE),
+	CFG_INT("sys_rate",   DEFAULT_SYS_RATE,    CFGF_NONE),
+	CFG_STR_LIST("allow", "{}", CFGF_NONE),
 	CFG_END()
 };
 
@@ -48,6 +66,13 @@ static cfg_opt_t app_opts[] = {
 
 static cfg_opt_t dev_opts[] = {
 	CFG_INT("rotation",   DEFAULT_ROTATION,    CFGF_NONE),
+	CFG_INT("event_budget", DEFAULT_EVENT_BUDGET, CFGF_NONE),
+	CFG_INT("led_refresh_rate", DEFAULT_LED_REFRESH, CFGF_NONE),
+	CFG_INT("led_anim_rate", DEFAULT_LED_ANIM, CFGF_NONE),
+	CFG_STR("echo", DEFAULT_ECHO, CFGF_NONE),
+	CFG_INT("echo_level", DEFAULT_ECHO_LEVEL, CFGF_NONE),
+	CFG_INT("layer_timeout", DEFAULT_LAYER_TIMEOUT, CFGF_NONE),
+	CFG_STR_LIST("rules", "{}", CFGF_NONE),
 	CFG_END()
 };
 
@@ -66,16 +91,95 @@ static void prepend_slash_if_necessary(char **dest, char *prefix) {
 		*dest = s_strdup(prefix);
 }
 
-static char *path_for_serial(const char *serial) {
+static char *path_for_serial(const char *serial, const char *ext) {
 	char *path, *cdir;
 
 	cdir = sosc_get_config_directory();
-	path = s_asprintf("%s/%s.conf", cdir, serial);
+	path = s_asprintf("%s/%s.%s", cdir, serial, ext);
 
 	s_free(cdir);
 	return path;
 }
 
+static const char *echo_mode_names[] = {
+	[SOSC_ECHO_OFF]       = "off",
+	[SOSC_ECHO_MOMENTARY] = "momentary",
+	[SOSC_ECHO_TOGGLE]    = "toggle"
+};
+
+const char *sosc_echo_mode_name(sosc_echo_mode_t mode) {
+	return echo_mode_names[mode];
+}
+
+int sosc_echo_mode_parse(const char *name, sosc_echo_mode_t *mode) {
+	int i;
+
+	for( i = 0; i < sizeof(echo_mode_names) / sizeof(*echo_mode_names); i++ )
+		if( !strcmp(name, echo_mode_names[i]) ) {
+			*mode = i;
+			return 0;
+		}
+
+	return -1;
+}
+
+static int read_rate(cfg_t *sec, const char *name) {
+	int rate = cfg_getint(sec, name);
+	return (rate < 0) ? 0 : rate;
+}
+
+static void read_allow(cfg_t *sec, sosc_config_t *config) {
+	unsigned int i;
+
+	config->server.nallow = 0;
+
+	for( i = 0; i < cfg_size(sec, "allow"); i++ ) {
+		if( config->server.nallow == SOSC_RX_MAX_ALLOW ) {
+			fprintf(stderr, "serialosc: too many allowed hosts, "
+			        "ignoring \"%s\"\n", cfg_getnstr(sec, "allow", i));
+			continue;
+		}
+
+		config->server.allow[config->server.nallow++] =
+			s_strdup(cfg_getnstr(sec, "allow", i));
+	}
+}
+
+static void write_allow(cfg_t *sec, const sosc_config_t *config) {
+	int i;
+
+	for( i = 0; i < config->server.nallow; i++ )
+		cfg_setnstr(sec, "allow", config->server.allow[i], i);
+}
+
+static void read_rules(cfg_t *sec, sosc_led_rules_t *rules) {
+	sosc_led_rule_t rule;
+	const char *text;
+	unsigned int i;
+
+	rules->count = 0;
+
+	for( i = 0; i < cfg_size(sec, "rules"); i++ ) {
+		text = cfg_getnstr(sec, "rules", i);
+
+		if( sosc_led_rule_parse(&rule, text) )
+			fprintf(stderr, "serialosc: ignoring bad LED rule \"%s\"\n", text);
+		else if( sosc_led_rules_add(rules, &rule) )
+			fprintf(stderr, "serialosc: too many LED rules, ignoring \"%s\"\n",
+			        text);
+	}
+}
+
+static void write_rules(cfg_t *sec, const sosc_led_rules_t *rules) {
+	char text[64];
+	int i;
+
+	for( i = 0; i < rules->count; i++ ) {
+		sosc_led_rule_format(&rules->rules[i], text, sizeof(text));
+		cfg_setnstr(sec, "rules", text, i);
+	}
+}
+
 int sosc_config_read(const char *serial, sosc_config_t *config) {
 	cfg_t *cfg, *sec;
 	char *path;
@@ -84,7 +188,7 @@ int sosc_config_read(const char *serial, sosc_config_t *config) {
 		return 1;
 
 	cfg = cfg_init(opts, CFGF_NOCASE);
-	path = path_for_serial(serial);
+	path = path_for_serial(serial, "conf");
 
 	switch( cfg_parse(cfg, path) ) {
 	case CFG_PARSE_ERROR:
@@ -97,6 +201,9 @@ int sosc_config_read(const char *serial, sosc_config_t *config) {
 
 	sec = cfg_getsec(cfg, "server");
 	sosc_port_itos(config->server.port, cfg_getint(sec, "port"));
+	config->server.led_rate = read_rate(sec, "led_rate");
+	config->server.sys_rate = read_rate(sec, "sys_rate");
+	read_allow(sec, config);
 
 	sec = cfg_getsec(cfg, "application");
 	prepend_slash_if_necessary(&config->app.osc_prefix, cfg_getstr(sec, "osc_prefix"));
@@ -106,6 +213,40 @@ int sosc_config_read(const char *serial, sosc_config_t *config) {
 	sec = cfg_getsec(cfg, "device");
 	config->dev.rotation = (cfg_getint(sec, "rotation") / 90) % 4;
 
+	/* a budget of 1 gets you the old one-message-per-wakeup behaviour */
+	config->dev.event_budget = cfg_getint(sec, "event_budget");
+	if( config->dev.event_budget < 1 )
+		config->dev.event_budget = 1;
+
+	/* 0 sends LED changes as soon as they come in */
+	config->dev.led_refresh_rate = cfg_getint(sec, "led_refresh_rate");
+	if( config->dev.led_refresh_rate < 0 )
+		config->dev.led_refresh_rate = 0;
+	else if( config->dev.led_refresh_rate > MAX_LED_REFRESH )
+		config->dev.led_refresh_rate = MAX_LED_REFRESH;
+
+	/* 0 turns animations off */
+	config->dev.led_anim_rate = cfg_getint(sec, "led_anim_rate");
+	if( config->dev.led_anim_rate < 0 )
+		config->dev.led_anim_rate = 0;
+	else if( config->dev.led_anim_rate > MAX_LED_ANIM )
+		config->dev.led_anim_rate = MAX_LED_ANIM;
+
+	if( sosc_echo_mode_parse(cfg_getstr(sec, "echo"), &config->dev.echo) )
+		config->dev.echo = SOSC_ECHO_OFF;
+
+	config->dev.echo_level = cfg_getint(sec, "echo_level");
+	if( config->dev.echo_level < 1
+	    || config->dev.echo_level > SOSC_LED_MAX_LEVEL )
+		config->dev.echo_level = DEFAULT_ECHO_LEVEL;
+
+	/* 0 lets layers stay until they're released */
+	config->dev.layer_timeout = cfg_getint(sec, "layer_timeout");
+	if( config->dev.layer_timeout < 0 )
+		config->dev.layer_timeout = 0;
+
+	read_rules(sec, &config->dev.rules);
+
 	cfg_free(cfg);
 
 	return 0;
@@ -122,7 +263,7 @@ int sosc_config_write(const char *serial, sosc_state_t *state) {
 
 	cfg = cfg_init(opts, CFGF_NOCASE);
 
-	path = path_for_serial(serial);
+	path = path_for_serial(serial, "conf");
 	if( !(f = fopen(path, "w")) ) {
 		s_free(path);
 		return 1;
@@ -132,6 +273,9 @@ int sosc_config_write(const char *serial, sosc_state_t *state) {
 
 	sec = cfg_getsec(cfg, "server");
 	cfg_setint(sec, "port", lo_server_get_port(state->server));
+	cfg_setint(sec, "led_rate", state->config.server.led_rate);
+	cfg_setint(sec, "sys_rate", state->config.server.sys_rate);
+	write_allow(sec, &state->config);
 
 	sec = cfg_getsec(cfg, "application");
 	cfg_setstr(sec, "osc_prefix", state->config.app.osc_prefix);
@@ -141,6 +285,13 @@ int sosc_config_write(const char *serial, sosc_state_t *state) {
 
 	sec = cfg_getsec(cfg, "device");
 	cfg_setint(sec, "rotation", monome_get_rotation(state->monome) * 90);
+	cfg_setint(sec, "event_budget", state->config.dev.event_budget);
+	cfg_setint(sec, "led_refresh_rate", state->config.dev.led_refresh_rate);
+	cfg_setint(sec, "led_anim_rate", state->config.dev.led_anim_rate);
+	cfg_setstr(sec, "echo", sosc_echo_mode_name(state->config.dev.echo));
+	cfg_setint(sec, "echo_level", state->config.dev.echo_level);
+	cfg_setint(sec, "layer_timeout", state->config.dev.layer_timeout);
+	write_rules(sec, &state->config.dev.rules);
 
 	cfg_print(cfg, f);
 	fclose(f);
@@ -149,3 +300,57 @@ int sosc_config_write(const char *serial, sosc_state_t *state) {
 
 	return 0;
 }
+
+/**
+ * the LEDs, saved beside the configuration when the device goes away and
+ * put back up when it returns
+ */
+
+int sosc_config_read_leds(const char *serial, sosc_led_t *led) {
+	static uint8_t buf[SOSC_LED_SNAPSHOT_MAX + 1];
+	char *path;
+	size_t len;
+	FILE *f;
+
+	if( !serial )
+		return 1;
+
+	path = path_for_serial(serial, "leds");
+
+	if( !(f = fopen(path, "rb")) ) {
+		s_free(path);
+		return 1;
+	}
+
+	len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+
+	/* it's only ever good for one reconnection */
+	remove(path);
+	s_free(path);
+
+	return sosc_led_restore(led, buf, len, time(NULL), LED_SNAPSHOT_MAX_AGE);
+}
+
+int sosc_config_write_leds(const char *serial, const sosc_led_t *led) {
+	static uint8_t buf[SOSC_LED_SNAPSHOT_MAX];
+	char *path;
+	size_t len;
+	FILE *f;
+	int ret;
+
+	if( !serial )
+		return 1;
+
+	path = path_for_serial(serial, "leds");
+	f = fopen(path, "wb");
+	s_free(path);
+
+	if( !f )
+		return 1;
+
+	len = sosc_led_snapshot(led, buf, time(NULL));
+	ret = fwrite(buf, 1, len, f) != len;
+
+	return fclose(f) || ret;
+}
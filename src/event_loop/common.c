@@ -0,0 +1,306 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* for clock_gettime() under -std=c99 */
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <time.h>
+#include <sys/time.h>
+#else
+#include <windows.h>
+#endif
+
+#include "serialosc.h"
+#include "event_loop.h"
+
+/* in order of preference. if a backend can't start (say, we were built
+   with io_uring but are running on a kernel that doesn't have it, or
+   has it switched off), we fall through to the next one. */
+static const sosc_event_backend_t *backends[] = {
+#ifdef HAVE_IO_URING
+	&sosc_event_backend_io_uring,
+#endif
+
+#ifdef HAVE_EPOLL
+	&sosc_event_backend_epoll,
+#endif
+
+#if defined(WIN32)
+	&sosc_event_backend_windows,
+#elif defined(HAVE_WORKING_POLL)
+	&sosc_event_backend_poll,
+#else
+	&sosc_event_backend_select,
+#endif
+
+	NULL
+};
+
+uint64_t sosc_event_loop_now(void) {
+#if defined(WIN32)
+	LARGE_INTEGER count, freq;
+
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+
+	return (count.QuadPart * 1000) / freq.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return ((uint64_t) tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+#endif
+}
+
+int sosc_event_loop_init_backend(sosc_event_loop_t *loop,
+                                 const sosc_event_backend_t *backend) {
+	memset(loop, 0, sizeof(*loop));
+
+	loop->backend = backend;
+	loop->backend_fd = -1;
+
+	if( !backend->init || !backend->init(loop) )
+		return 0;
+
+	loop->backend = NULL;
+	return 1;
+}
+
+int sosc_event_loop_init(sosc_event_loop_t *loop) {
+	int i;
+
+	for( i = 0; backends[i]; i++ ) {
+		if( !sosc_event_loop_init_backend(loop, backends[i]) )
+			return 0;
+
+		fprintf(stderr, "serialosc: couldn't start the %s event loop\n",
+		        backends[i]->name);
+	}
+
+	return 1;
+}
+
+void sosc_event_loop_fini(sosc_event_loop_t *loop) {
+	int i;
+
+	if( !loop->backend )
+		return;
+
+	for( i = 0; i < SOSC_EVENT_LOOP_MAX_WATCHES; i++ )
+		if( loop->watches[i].in_use )
+			sosc_event_loop_remove(loop, i);
+
+	if( loop->backend->fini )
+		loop->backend->fini(loop);
+
+	loop->backend = NULL;
+}
+
+static int alloc_watch(sosc_event_loop_t *loop) {
+	int i;
+
+	for( i = 0; i < SOSC_EVENT_LOOP_MAX_WATCHES; i++ )
+		if( !loop->watches[i].in_use ) {
+			memset(&loop->watches[i], 0, sizeof(loop->watches[i]));
+			return i;
+		}
+
+	return -1;
+}
+
+static int commit_watch(sosc_event_loop_t *loop, int id) {
+	loop->watches[id].in_use = 1;
+	loop->watches[id].added = loop->iterations;
+
+	if( loop->backend->add && loop->backend->add(loop, id) ) {
+		loop->watches[id].in_use = 0;
+		return -1;
+	}
+
+	return id;
+}
+
+int sosc_event_loop_add_fd(sosc_event_loop_t *loop, int fd, int events,
+                           sosc_fd_cb_t *cb, void *data) {
+	sosc_watch_t *w;
+	int id;
+
+	if( !loop->backend || (id = alloc_watch(loop)) < 0 )
+		return -1;
+
+	w = &loop->watches[id];
+	w->fd = fd;
+	w->events = events;
+	w->fd_cb = cb;
+	w->data = data;
+
+	return commit_watch(loop, id);
+}
+
+int sosc_event_loop_add_timer(sosc_event_loop_t *loop,
+                              unsigned int interval_ms,
+                              sosc_timer_cb_t *cb, void *data) {
+	sosc_watch_t *w;
+	int id;
+
+	if( !loop->backend || !interval_ms || (id = alloc_watch(loop)) < 0 )
+		return -1;
+
+	w = &loop->watches[id];
+	w->fd = -1;
+	w->timer_cb = cb;
+	w->interval_ms = interval_ms;
+	w->deadline = sosc_event_loop_now() + interval_ms;
+	w->data = data;
+
+	return commit_watch(loop, id);
+}
+
+int sosc_event_loop_modify_fd(sosc_event_loop_t *loop, int watch,
+                              int events) {
+	sosc_watch_t *w = &loop->watches[watch];
+
+	if( !w->in_use || !w->fd_cb )
+		return 1;
+
+	if( w->events == events )
+		return 0;
+
+	w->events = events;
+
+	if( loop->backend->modify )
+		return loop->backend->modify(loop, watch);
+	return 0;
+}
+
+void sosc_event_loop_remove(sosc_event_loop_t *loop, int watch) {
+	if( watch < 0 || !loop->watches[watch].in_use )
+		return;
+
+	if( loop->backend->remove )
+		loop->backend->remove(loop, watch);
+
+	loop->watches[watch].in_use = 0;
+}
+
+void sosc_event_loop_rearm(sosc_event_loop_t *loop, int watch) {
+	if( watch < 0 || !loop->watches[watch].in_use )
+		return;
+
+	if( loop->backend->rearm )
+		loop->backend->rearm(loop, watch);
+}
+
+void sosc_event_loop_on_iteration_end(sosc_event_loop_t *loop,
+                                      sosc_iteration_cb_t *cb, void *data) {
+	loop->iteration_end_cb = cb;
+	loop->iteration_end_data = data;
+}
+
+int sosc_event_loop_run(sosc_event_loop_t *loop) {
+	if( !loop->backend || !loop->backend->run )
+		return 1;
+
+	return loop->backend->run(loop);
+}
+
+/**
+ * backend helpers
+ */
+
+/* milliseconds until the next timer is due, for poll()-style backends
+   which don't have timerfds. -1 if there are no timers. */
+int sosc_event_loop_next_timeout(sosc_event_loop_t *loop) {
+	uint64_t now, next;
+	sosc_watch_t *w;
+	int i, have;
+
+	now = sosc_event_loop_now();
+	next = have = 0;
+
+	for( i = 0; i < SOSC_EVENT_LOOP_MAX_WATCHES; i++ ) {
+		w = &loop->watches[i];
+
+		if( !w->in_use || !w->timer_cb || w->fd >= 0 )
+			continue;
+
+		if( !have || w->deadline < next ) {
+			next = w->deadline;
+			have = 1;
+		}
+	}
+
+	if( !have )
+		return -1;
+
+	return (next > now) ? (int) (next - now) : 0;
+}
+
+int sosc_event_loop_run_timers(sosc_event_loop_t *loop) {
+	sosc_watch_t *w;
+	uint64_t now;
+	int i, ret;
+
+	now = sosc_event_loop_now();
+
+	for( i = 0; i < SOSC_EVENT_LOOP_MAX_WATCHES; i++ ) {
+		w = &loop->watches[i];
+
+		if( !w->in_use || !w->timer_cb || w->fd >= 0 || w->deadline > now )
+			continue;
+
+		/* if we've fallen more than a whole interval behind, don't
+		   try to catch up with a burst of callbacks. */
+		w->deadline += w->interval_ms;
+		if( w->deadline <= now )
+			w->deadline = now + w->interval_ms;
+
+		if( (ret = w->timer_cb(w->data)) )
+			return ret;
+	}
+
+	return 0;
+}
+
+int sosc_event_loop_dispatch(sosc_event_loop_t *loop, int watch, int events) {
+	sosc_watch_t *w = &loop->watches[watch];
+
+	/* an earlier callback in this iteration may have removed it, and
+	   maybe given the slot to something else */
+	if( !w->in_use || w->added == loop->iterations )
+		return 0;
+
+	if( w->timer_cb )
+		return w->timer_cb(w->data);
+
+	return w->fd_cb(w->fd, events, w->data);
+}
+
+int sosc_event_loop_end_iteration(sosc_event_loop_t *loop) {
+	if( !loop->iteration_end_cb )
+		return 0;
+
+	return loop->iteration_end_cb(loop->iteration_end_data);
+}
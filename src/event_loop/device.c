@@ -0,0 +1,324 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE /* for recvmmsg() */
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+
+#ifdef HAVE_WORKING_POLL
+#include <poll.h>
+#else
+#include <sys/select.h>
+#endif
+
+#include "serialosc.h"
+#include "event_loop.h"
+#include "osc.h"
+
+
+static int event_budget(const sosc_state_t *state) {
+	if( state->config.dev.event_budget < 1 )
+		return 1;
+	return state->config.dev.event_budget;
+}
+
+/* libmonome hands us one event per monome_event_handle_next() and might
+   block if there's nothing there, so check before going back for more. */
+static int fd_is_readable(int fd) {
+#ifdef HAVE_WORKING_POLL
+	struct pollfd pfd = {
+		.fd = fd,
+		.events = POLLIN
+	};
+
+	return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+#else
+	struct timeval tv = {0, 0};
+	fd_set rfds;
+
+	FD_ZERO(&rfds);
+	FD_SET(fd, &rfds);
+
+	return select(fd + 1, &rfds, NULL, NULL, &tv) > 0;
+#endif
+}
+
+/* these return nonzero if they ran out of budget with input left over */
+static int drain_device(sosc_state_t *state) {
+	int fd, budget, handled;
+
+	fd = monome_get_fd(state->monome);
+	budget = event_budget(state);
+	handled = 0;
+
+	do {
+		if( !monome_event_handle_next(state->monome) )
+			break;
+	} while( ++handled < budget && fd_is_readable(fd) );
+
+	/* only a hit if the budget actually left something behind */
+	state->loop_stats.device_events += handled;
+	if( handled == budget && fd_is_readable(fd) ) {
+		state->loop_stats.device_budget_hits++;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* datagrams we pull off the socket per syscall. liblo would accept up
+   to 32k per message, so we do too. */
+#define RX_BATCH   16
+#define RX_BUFSIZE 32768
+
+/* only datagrams the filter lets through count against the event budget.
+   dropping one is cheap, but a flood of them still mustn't keep us here
+   for ever, so we read at most this many budgets' worth in one go. */
+#define RX_READ_MAX 8
+
+static uint8_t rx_bufs[RX_BATCH][RX_BUFSIZE];
+
+/* and who sent them */
+static struct sockaddr_storage rx_addrs[RX_BATCH];
+static socklen_t rx_addr_lens[RX_BATCH];
+
+/* returns the number of datagrams received, 0 once the socket's empty.
+   oversized (truncated) datagrams come back with a length of 0. */
+static int receive_batch(int fd, int max, size_t *lens) {
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[RX_BATCH];
+	struct iovec iovs[RX_BATCH];
+	int i, n;
+
+	memset(msgs, 0, sizeof(*msgs) * max);
+
+	for( i = 0; i < max; i++ ) {
+		iovs[i].iov_base = rx_bufs[i];
+		iovs[i].iov_len  = RX_BUFSIZE;
+
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &rx_addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(rx_addrs[i]);
+	}
+
+	if( (n = recvmmsg(fd, msgs, max, MSG_DONTWAIT, NULL)) < 0 )
+		return 0;
+
+	for( i = 0; i < n; i++ ) {
+		lens[i] = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+			? 0 : msgs[i].msg_len;
+		rx_addr_lens[i] = msgs[i].msg_hdr.msg_namelen;
+	}
+
+	return n;
+#else
+	ssize_t len;
+	int n;
+
+	for( n = 0; n < max; n++ ) {
+		rx_addr_lens[n] = sizeof(rx_addrs[n]);
+
+		if( (len = recvfrom(fd, rx_bufs[n], RX_BUFSIZE, MSG_DONTWAIT,
+		                    (struct sockaddr *) &rx_addrs[n],
+		                    &rx_addr_lens[n])) < 0 )
+			break;
+
+		lens[n] = (len < RX_BUFSIZE) ? len : 0;
+	}
+
+	return n;
+#endif
+}
+
+static int drain_osc(sosc_state_t *state) {
+	int fd, budget, handled, received, want, n, i;
+	size_t lens[RX_BATCH];
+	uint64_t now;
+
+	fd = lo_server_get_socket_fd(state->server);
+	budget = event_budget(state);
+	handled = received = 0;
+
+	/* for the rate limits, and for noting when we last heard from each
+	   application with a layer. one of those can turn up partway through
+	   the batch, so this is taken either way. */
+	now = sosc_event_loop_now();
+
+	while( handled < budget && received < budget * RX_READ_MAX ) {
+		want = budget - handled;
+		if( want > RX_BATCH )
+			want = RX_BATCH;
+
+		if( !(n = receive_batch(fd, want, lens)) )
+			break;
+
+		received += n;
+
+		for( i = 0; i < n; i++ ) {
+			if( !lens[i] )
+				continue;
+
+			/* before anything looks inside it */
+			if( osc_rx_filter(state, (struct sockaddr *) &rx_addrs[i],
+			                  rx_bufs[i], lens[i], now) )
+				continue;
+
+			/* applications with a layer of their own draw into it */
+			state->rx_src = (struct sockaddr *) &rx_addrs[i];
+			state->rx_src_len = rx_addr_lens[i];
+
+			if( state->nclients )
+				state->led.target = osc_client_layer(state, now);
+
+			if( !osc_dispatch_raw(state, rx_bufs[i], lens[i]) )
+				state->loop_stats.osc_fast_path++;
+			else
+				lo_server_dispatch_data(state->server, rx_bufs[i], lens[i]);
+
+			state->led.target = 0;
+			handled++;
+		}
+
+		state->rx_src = NULL;
+
+		/* short read, the socket's empty */
+		if( n < want )
+			break;
+	}
+
+	state->loop_stats.osc_messages += handled;
+	if( (handled == budget || received >= budget * RX_READ_MAX)
+	    && fd_is_readable(fd) ) {
+		state->loop_stats.osc_budget_hits++;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* how far behind the serial port can get before we stop handing libmonome
+   LED commands. below this the tty driver reports the fd as writable
+   again (it's the kernel's WAKEUP_CHARS). */
+#define SERIAL_BACKLOG_MAX 256
+
+/* and the most one flush hands it. a whole frame of colour or level maps
+   is several kilobytes, and libmonome's write()s block once the tty's
+   buffer is full, taking the whole loop with them. the backlog we allow
+   plus one of these stays well under the few kilobytes tty drivers
+   buffer, so the write()s don't block. */
+#define SERIAL_FLUSH_MAX 1024
+
+/* bytes written to the device that it hasn't taken yet */
+static int serial_backlog(int fd) {
+#ifdef TIOCOUTQ
+	int queued;
+
+	if( !ioctl(fd, TIOCOUTQ, &queued) )
+		return queued;
+#endif
+
+	return 0;
+}
+
+static void wait_for_port(sosc_state_t *state, int wait) {
+	if( state->device_watch < 0 )
+		return;
+
+	/* already waiting. the port may have been writable all along (the
+	   flush was just as big as we allow), which not every backend
+	   reports twice. */
+	if( wait == state->led_blocked ) {
+		if( wait )
+			sosc_event_loop_rearm(&state->loop, state->device_watch);
+		return;
+	}
+
+	if( !sosc_event_loop_modify_fd(&state->loop, state->device_watch,
+	                               wait ? SOSC_EVENT_READ | SOSC_EVENT_WRITE
+	                                    : SOSC_EVENT_READ) )
+		state->led_blocked = wait;
+}
+
+/* while the port is backed up, LED changes stay in the framebuffer, where
+   newer ones just replace them. whatever doesn't go out now, because the
+   port's busy or the flush was as big as we allow, goes out when the fd
+   is next writable. */
+void sosc_led_output(sosc_state_t *state) {
+	if( sosc_led_pending(&state->led) ) {
+		if( serial_backlog(monome_get_fd(state->monome)) < SERIAL_BACKLOG_MAX )
+			sosc_led_flush_some(&state->led, state->monome, SERIAL_FLUSH_MAX);
+		else
+			state->led.stats.deferred++;
+	}
+
+	wait_for_port(state, sosc_led_pending(&state->led));
+}
+
+static int device_ready(int fd, int events, void *data) {
+	sosc_state_t *state = data;
+
+	/* is the monome still connected? */
+	if( events & SOSC_EVENT_ERROR )
+		return 1;
+
+	if( events & SOSC_EVENT_READ && drain_device(state) )
+		sosc_event_loop_rearm(&state->loop, state->device_watch);
+
+	if( events & SOSC_EVENT_WRITE )
+		sosc_led_output(state);
+
+	return 0;
+}
+
+static int osc_ready(int fd, int events, void *data) {
+	sosc_state_t *state = data;
+
+	if( drain_osc(state) )
+		sosc_event_loop_rearm(&state->loop, state->osc_watch);
+
+	return 0;
+}
+
+/* everything drawn during one loop iteration, whichever callback did the
+   drawing, is planned and sent together. */
+static int flush_leds(void *data) {
+	sosc_led_output(data);
+	return 0;
+}
+
+int sosc_event_loop(sosc_state_t *state) {
+	state->device_watch = sosc_event_loop_add_fd(
+		&state->loop, monome_get_fd(state->monome), SOSC_EVENT_READ,
+		device_ready, state);
+
+	state->osc_watch = sosc_event_loop_add_fd(
+		&state->loop, lo_server_get_socket_fd(state->server),
+		SOSC_EVENT_READ, osc_ready, state);
+
+	if( state->device_watch < 0 || state->osc_watch < 0 ) {
+		fprintf(stderr, "serialosc: couldn't register with event loop\n");
+		return 1;
+	}
+
+	if( !state->config.dev.led_refresh_rate )
+		sosc_event_loop_on_iteration_end(&state->loop, flush_leds, state);
+
+	return sosc_event_loop_run(&state->loop);
+}
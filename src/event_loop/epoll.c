@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE /* for timerfd */
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "serialosc.h"
+#include "event_loop.h"
+
+
+static int epoll_init(sosc_event_loop_t *loop) {
+	loop->backend_fd = epoll_create1(EPOLL_CLOEXEC);
+	return loop->backend_fd < 0;
+}
+
+static void epoll_fini(sosc_event_loop_t *loop) {
+	close(loop->backend_fd);
+	loop->backend_fd = -1;
+}
+
+static int epoll_ctl_watch(sosc_event_loop_t *loop, int op, int watch) {
+	sosc_watch_t *w = &loop->watches[watch];
+	struct epoll_event ev = {
+		.events =
+			((w->events & SOSC_EVENT_READ)  ? EPOLLIN  : 0) |
+			((w->events & SOSC_EVENT_WRITE) ? EPOLLOUT : 0),
+		.data.u32 = watch
+	};
+
+	return epoll_ctl(loop->backend_fd, op, w->fd, &ev) < 0;
+}
+
+static int epoll_add(sosc_event_loop_t *loop, int watch) {
+	sosc_watch_t *w = &loop->watches[watch];
+	struct itimerspec its;
+
+	if( w->timer_cb ) {
+		w->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if( w->fd < 0 )
+			return 1;
+
+		its.it_interval.tv_sec  = w->interval_ms / 1000;
+		its.it_interval.tv_nsec = (w->interval_ms % 1000) * 1000000;
+		its.it_value = its.it_interval;
+
+		w->events = SOSC_EVENT_READ;
+
+		if( timerfd_settime(w->fd, 0, &its, NULL) < 0 )
+			goto err;
+	}
+
+	if( epoll_ctl_watch(loop, EPOLL_CTL_ADD, watch) )
+		goto err;
+
+	return 0;
+
+err:
+	if( w->timer_cb ) {
+		close(w->fd);
+		w->fd = -1;
+	}
+
+	return 1;
+}
+
+static int epoll_modify(sosc_event_loop_t *loop, int watch) {
+	return epoll_ctl_watch(loop, EPOLL_CTL_MOD, watch);
+}
+
+static void epoll_remove(sosc_event_loop_t *loop, int watch) {
+	sosc_watch_t *w = &loop->watches[watch];
+
+	epoll_ctl(loop->backend_fd, EPOLL_CTL_DEL, w->fd, NULL);
+
+	if( w->timer_cb ) {
+		close(w->fd);
+		w->fd = -1;
+	}
+}
+
+static int epoll_run(sosc_event_loop_t *loop) {
+	struct epoll_event evs[SOSC_EVENT_LOOP_MAX_WATCHES];
+	int i, nevs, watch, events, ret;
+	uint64_t expirations;
+	sosc_watch_t *w;
+
+	do {
+		/* block until one of our fds (timers included) has data */
+		if( (nevs = epoll_wait(loop->backend_fd, evs,
+		                       SOSC_EVENT_LOOP_MAX_WATCHES, -1)) < 0 )
+			switch( errno ) {
+			case EINTR:
+				continue;
+
+			default:
+				perror("error in epoll_wait()");
+				return 1;
+			}
+
+		loop->iterations++;
+
+		for( i = 0; i < nevs; i++ ) {
+			watch = evs[i].data.u32;
+			w = &loop->watches[watch];
+
+			/* removed, or the slot's been reused, since epoll_wait() */
+			if( !w->in_use || w->added == loop->iterations )
+				continue;
+
+			/* the timerfd stays readable until we read the count */
+			if( w->timer_cb
+			    && read(w->fd, &expirations, sizeof(expirations)) < 0 )
+				continue;
+
+			events =
+				((evs[i].events & EPOLLIN)  ? SOSC_EVENT_READ  : 0) |
+				((evs[i].events & EPOLLOUT) ? SOSC_EVENT_WRITE : 0) |
+				((evs[i].events & (EPOLLHUP | EPOLLERR))
+				 ? SOSC_EVENT_ERROR : 0);
+
+			if( (ret = sosc_event_loop_dispatch(loop, watch, events)) )
+				return ret;
+		}
+
+		if( (ret = sosc_event_loop_end_iteration(loop)) )
+			return ret;
+	} while( 1 );
+}
+
+const sosc_event_backend_t sosc_event_backend_epoll = {
+	.name   = "epoll",
+
+	.init   = epoll_init,
+	.fini   = epoll_fini,
+
+	.add    = epoll_add,
+	.modify = epoll_modify,
+	.remove = epoll_remove,
+
+	.run    = epoll_run
+};
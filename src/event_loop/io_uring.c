@@ -0,0 +1,296 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE /* for timerfd */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <liburing.h>
+
+#include "serialosc.h"
+#include "event_loop.h"
+
+/**
+ * every watch gets a poll request on the ring. where the kernel supports
+ * it (5.13+) that request is multishot and stays armed across wakeups,
+ * otherwise we re-arm it after each completion. re-arming and waiting
+ * for the next completion then share a single io_uring_enter().
+ *
+ * a multishot poll only completes when the fd becomes ready again, not
+ * while it stays ready, so a callback that leaves input behind (out of
+ * budget) must call sosc_event_loop_rearm(). that cancels the poll and
+ * arms a fresh one, which completes straight away if the fd is still
+ * ready. on epoll and poll the same call does nothing.
+ *
+ * user_data carries the watch id and a generation count, so completions
+ * for a poll we've since cancelled (watch removed or its interest
+ * changed) can be told apart from live ones.
+ */
+
+#define RING_ENTRIES (SOSC_EVENT_LOOP_MAX_WATCHES * 2)
+#define CANCEL_TAG   UINT64_MAX
+
+typedef struct {
+	struct io_uring ring;
+	int multishot;
+
+	uint8_t gen[SOSC_EVENT_LOOP_MAX_WATCHES];
+	uint64_t armed[SOSC_EVENT_LOOP_MAX_WATCHES];
+} uring_data_t;
+
+static uring_data_t uring_data;
+
+static struct io_uring_sqe *get_sqe(uring_data_t *ud) {
+	struct io_uring_sqe *sqe;
+
+	/* submission queue full, flush it and try again */
+	if( !(sqe = io_uring_get_sqe(&ud->ring)) ) {
+		io_uring_submit(&ud->ring);
+		sqe = io_uring_get_sqe(&ud->ring);
+	}
+
+	return sqe;
+}
+
+static int arm(sosc_event_loop_t *loop, int watch) {
+	uring_data_t *ud = loop->backend_data;
+	sosc_watch_t *w = &loop->watches[watch];
+	struct io_uring_sqe *sqe;
+
+	if( !(sqe = get_sqe(ud)) )
+		return 1;
+
+	io_uring_prep_poll_add(sqe, w->fd,
+		((w->events & SOSC_EVENT_READ)  ? POLLIN  : 0) |
+		((w->events & SOSC_EVENT_WRITE) ? POLLOUT : 0));
+
+#ifdef IORING_POLL_ADD_MULTI
+	if( ud->multishot )
+		sqe->len |= IORING_POLL_ADD_MULTI;
+#endif
+
+	/* never zero, which means "not armed" */
+	ud->armed[watch] = (((uint64_t) ud->gen[watch] + 1) << 8) | watch;
+	sqe->user_data = ud->armed[watch];
+
+	return 0;
+}
+
+static void disarm(sosc_event_loop_t *loop, int watch) {
+	uring_data_t *ud = loop->backend_data;
+	struct io_uring_sqe *sqe;
+
+	if( !ud->armed[watch] )
+		return;
+
+	if( (sqe = get_sqe(ud)) ) {
+		io_uring_prep_rw(IORING_OP_POLL_REMOVE, sqe, -1, NULL, 0, 0);
+		sqe->addr = ud->armed[watch];
+		sqe->user_data = CANCEL_TAG;
+	}
+
+	ud->armed[watch] = 0;
+	ud->gen[watch]++;
+}
+
+static int cqe_has_more(const struct io_uring_cqe *cqe) {
+#ifdef IORING_CQE_F_MORE
+	return cqe->flags & IORING_CQE_F_MORE;
+#else
+	return 0;
+#endif
+}
+
+static int uring_init(sosc_event_loop_t *loop) {
+	uring_data_t *ud = &uring_data;
+
+	memset(ud, 0, sizeof(*ud));
+
+	if( io_uring_queue_init(RING_ENTRIES, &ud->ring, 0) < 0 )
+		return 1;
+
+#ifdef IORING_POLL_ADD_MULTI
+	ud->multishot = 1;
+#endif
+
+	loop->backend_data = ud;
+	return 0;
+}
+
+static void uring_fini(sosc_event_loop_t *loop) {
+	uring_data_t *ud = loop->backend_data;
+
+	io_uring_queue_exit(&ud->ring);
+	loop->backend_data = NULL;
+}
+
+static int uring_add(sosc_event_loop_t *loop, int watch) {
+	sosc_watch_t *w = &loop->watches[watch];
+	struct itimerspec its;
+
+	if( w->timer_cb ) {
+		w->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if( w->fd < 0 )
+			return 1;
+
+		its.it_interval.tv_sec  = w->interval_ms / 1000;
+		its.it_interval.tv_nsec = (w->interval_ms % 1000) * 1000000;
+		its.it_value = its.it_interval;
+
+		w->events = SOSC_EVENT_READ;
+
+		if( timerfd_settime(w->fd, 0, &its, NULL) < 0 )
+			goto err;
+	}
+
+	if( arm(loop, watch) )
+		goto err;
+
+	return 0;
+
+err:
+	if( w->timer_cb ) {
+		close(w->fd);
+		w->fd = -1;
+	}
+
+	return 1;
+}
+
+static int uring_modify(sosc_event_loop_t *loop, int watch) {
+	disarm(loop, watch);
+	return arm(loop, watch);
+}
+
+static void uring_rearm(sosc_event_loop_t *loop, int watch) {
+	disarm(loop, watch);
+	arm(loop, watch);
+}
+
+static void uring_remove(sosc_event_loop_t *loop, int watch) {
+	sosc_watch_t *w = &loop->watches[watch];
+
+	disarm(loop, watch);
+
+	if( w->timer_cb ) {
+		close(w->fd);
+		w->fd = -1;
+	}
+}
+
+static int uring_run(sosc_event_loop_t *loop) {
+	uring_data_t *ud = loop->backend_data;
+	struct io_uring_cqe *cqe;
+	int watch, events, res, more, ret;
+	unsigned ready;
+	uint64_t user_data, expirations;
+	sosc_watch_t *w;
+
+	do {
+		/* submit whatever (re-)arming is pending and wait for at
+		   least one completion, all in the same syscall. */
+		if( (ret = io_uring_submit_and_wait(&ud->ring, 1)) < 0 ) {
+			if( ret == -EINTR )
+				continue;
+
+			fprintf(stderr, "error in io_uring_submit_and_wait(): %s\n",
+			        strerror(-ret));
+			return 1;
+		}
+
+		loop->iterations++;
+
+		/* only what had completed by now. a callback that arms a
+		   poll can flush the submission queue, and if that poll
+		   completed in this iteration, dispatch would drop it as
+		   belonging to the watch's previous owner. multishot polls
+		   don't come round again, so it would be lost. */
+		ready = io_uring_cq_ready(&ud->ring);
+
+		while( ready-- && !io_uring_peek_cqe(&ud->ring, &cqe) ) {
+			user_data = cqe->user_data;
+			res = cqe->res;
+			more = cqe_has_more(cqe);
+
+			io_uring_cqe_seen(&ud->ring, cqe);
+
+			if( user_data == CANCEL_TAG )
+				continue;
+
+			watch = user_data & 0xFF;
+			if( watch >= SOSC_EVENT_LOOP_MAX_WATCHES
+			    || user_data != ud->armed[watch] )
+				continue; /* stale */
+
+			w = &loop->watches[watch];
+
+			/* kernels before 5.13 reject multishot polls outright */
+			if( res == -EINVAL && ud->multishot ) {
+				ud->multishot = 0;
+				ud->armed[watch] = 0;
+				arm(loop, watch);
+				continue;
+			}
+
+			if( !more )
+				ud->armed[watch] = 0;
+
+			if( res < 0 )
+				events = SOSC_EVENT_ERROR;
+			else
+				events =
+					((res & POLLIN)  ? SOSC_EVENT_READ  : 0) |
+					((res & POLLOUT) ? SOSC_EVENT_WRITE : 0) |
+					((res & (POLLHUP | POLLERR | POLLNVAL))
+					 ? SOSC_EVENT_ERROR : 0);
+
+			/* the timerfd stays readable until we read the count */
+			if( w->timer_cb
+			    && read(w->fd, &expirations, sizeof(expirations)) < 0 )
+				events = 0;
+
+			ret = events ? sosc_event_loop_dispatch(loop, watch, events) : 0;
+
+			/* one-shot poll, or the callback changed nothing about it */
+			if( w->in_use && !ud->armed[watch] )
+				arm(loop, watch);
+
+			if( ret )
+				return ret;
+		}
+
+		if( (ret = sosc_event_loop_end_iteration(loop)) )
+			return ret;
+	} while( 1 );
+}
+
+const sosc_event_backend_t sosc_event_backend_io_uring = {
+	.name   = "io_uring",
+
+	.init   = uring_init,
+	.fini   = uring_fini,
+
+	.add    = uring_add,
+	.modify = uring_modify,
+	.remove = uring_remove,
+	.rearm  = uring_rearm,
+
+	.run    = uring_run
+};
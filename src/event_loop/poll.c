@@ -19,20 +19,33 @@
 #include <poll.h>
 
 #include "serialosc.h"
+#include "event_loop.h"
 
 
-int sosc_event_loop(const sosc_state_t *state) {
-	struct pollfd fds[2];
+static int poll_run(sosc_event_loop_t *loop) {
+	struct pollfd fds[SOSC_EVENT_LOOP_MAX_WATCHES];
+	int ids[SOSC_EVENT_LOOP_MAX_WATCHES];
+	int i, nfds, events, ret;
+	sosc_watch_t *w;
 
-	fds[0].fd = monome_get_fd(state->monome);
-	fds[1].fd = lo_server_get_socket_fd(state->server);
+	do {
+		for( i = nfds = 0; i < SOSC_EVENT_LOOP_MAX_WATCHES; i++ ) {
+			w = &loop->watches[i];
+
+			if( !w->in_use || w->fd < 0 )
+				continue;
 
-	fds[0].events = POLLIN;
-	fds[1].events = POLLIN;
+			fds[nfds].fd = w->fd;
+			fds[nfds].events =
+				((w->events & SOSC_EVENT_READ)  ? POLLIN  : 0) |
+				((w->events & SOSC_EVENT_WRITE) ? POLLOUT : 0);
+			fds[nfds].revents = 0;
 
-	do {
-		/* block until either the monome or liblo have data */
-		if( poll(fds, 2, -1) < 0 )
+			ids[nfds++] = i;
+		}
+
+		/* block until one of our fds has data or a timer is due */
+		if( poll(fds, nfds, sosc_event_loop_next_timeout(loop)) < 0 )
 			switch( errno ) {
 			case EINVAL:
 				perror("error in poll()");
@@ -43,16 +56,28 @@ int sosc_event_loop(const sosc_state_t *state) {
 				continue;
 			}
 
-		/* is the monome still connected? */
-		if( fds[0].revents & (POLLHUP | POLLERR) )
-			return 1;
+		loop->iterations++;
+
+		for( i = 0; i < nfds; i++ ) {
+			events =
+				((fds[i].revents & POLLIN)  ? SOSC_EVENT_READ  : 0) |
+				((fds[i].revents & POLLOUT) ? SOSC_EVENT_WRITE : 0) |
+				((fds[i].revents & (POLLHUP | POLLERR | POLLNVAL))
+				 ? SOSC_EVENT_ERROR : 0);
 
-		/* is there data available for reading from the monome? */
-		if( fds[0].revents & POLLIN )
-			monome_event_handle_next(state->monome);
+			if( events && (ret = sosc_event_loop_dispatch(loop, ids[i], events)) )
+				return ret;
+		}
 
-		/* how about from OSC? */
-		if( fds[1].revents & POLLIN )
-			lo_server_recv_noblock(state->server, 0);
+		if( (ret = sosc_event_loop_run_timers(loop)) )
+			return ret;
+
+		if( (ret = sosc_event_loop_end_iteration(loop)) )
+			return ret;
 	} while( 1 );
 }
+
+const sosc_event_backend_t sosc_event_backend_poll = {
+	.name = "poll",
+	.run  = poll_run
+};
@@ -19,26 +19,46 @@
 #include <sys/select.h>
 
 #include "serialosc.h"
+#include "event_loop.h"
 
 
-int sosc_event_loop(const sosc_state_t *state) {
-	fd_set rfds, efds;
-	int maxfd, mfd, lofd;
-
-	mfd  = monome_get_fd(state->monome);
-	lofd = lo_server_get_socket_fd(state->server);
-	maxfd = ((lofd > mfd) ? lofd : mfd) + 1;
+static int select_run(sosc_event_loop_t *loop) {
+	fd_set rfds, wfds, efds;
+	struct timeval tv, *tvp;
+	int i, maxfd, timeout, events, ret;
+	sosc_watch_t *w;
 
 	do {
 		FD_ZERO(&rfds);
-		FD_SET(mfd, &rfds);
-		FD_SET(lofd, &rfds);
-
+		FD_ZERO(&wfds);
 		FD_ZERO(&efds);
-		FD_SET(mfd, &efds);
+		maxfd = -1;
+
+		for( i = 0; i < SOSC_EVENT_LOOP_MAX_WATCHES; i++ ) {
+			w = &loop->watches[i];
+
+			if( !w->in_use || w->fd < 0 )
+				continue;
+
+			if( w->events & SOSC_EVENT_READ )
+				FD_SET(w->fd, &rfds);
+			if( w->events & SOSC_EVENT_WRITE )
+				FD_SET(w->fd, &wfds);
+			FD_SET(w->fd, &efds);
+
+			if( w->fd > maxfd )
+				maxfd = w->fd;
+		}
 
-		/* block until either the monome or liblo have data */
-		if( select(maxfd, &rfds, NULL, &efds, NULL) < 0 )
+		if( (timeout = sosc_event_loop_next_timeout(loop)) >= 0 ) {
+			tv.tv_sec  = timeout / 1000;
+			tv.tv_usec = (timeout % 1000) * 1000;
+			tvp = &tv;
+		} else
+			tvp = NULL;
+
+		/* block until one of our fds has data or a timer is due */
+		if( select(maxfd + 1, &rfds, &wfds, &efds, tvp) < 0 )
 			switch( errno ) {
 			case EBADF:
 			case EINVAL:
@@ -49,16 +69,32 @@ int sosc_event_loop(const sosc_state_t *state) {
 				continue;
 			}
 
-		/* is the monome still connected? */
-		if( FD_ISSET(mfd, &efds) )
-			return 1;
+		loop->iterations++;
+
+		for( i = 0; i < SOSC_EVENT_LOOP_MAX_WATCHES; i++ ) {
+			w = &loop->watches[i];
+
+			if( !w->in_use || w->fd < 0 )
+				continue;
 
-		/* is there data available for reading from the monome? */
-		if( FD_ISSET(mfd, &rfds) )
-			monome_event_handle_next(state->monome);
+			events =
+				(FD_ISSET(w->fd, &rfds) ? SOSC_EVENT_READ  : 0) |
+				(FD_ISSET(w->fd, &wfds) ? SOSC_EVENT_WRITE : 0) |
+				(FD_ISSET(w->fd, &efds) ? SOSC_EVENT_ERROR : 0);
 
-		/* how about from OSC? */
-		if( FD_ISSET(lofd, &rfds) )
-			lo_server_recv_noblock(state->server, 0);
+			if( events && (ret = sosc_event_loop_dispatch(loop, i, events)) )
+				return ret;
+		}
+
+		if( (ret = sosc_event_loop_run_timers(loop)) )
+			return ret;
+
+		if( (ret = sosc_event_loop_end_iteration(loop)) )
+			return ret;
 	} while( 1 );
 }
+
+const sosc_event_backend_t sosc_event_backend_select = {
+	.name = "select",
+	.run  = select_run
+};
@@ -21,23 +21,70 @@
 #include <io.h>
 
 #include "serialosc.h"
+#include "event_loop.h"
+
+/* the OSC handlers run on the lo_server's thread and the key handlers and
+   timers on the main one, and all of them draw into the framebuffer and
+   flush it. this keeps them out of each other's way. */
+static CRITICAL_SECTION led_lock;
+
+/* set when the main loop has finished, to stop the lo_server's thread */
+static volatile LONG stopping;
+
+/* no backpressure here: the overlapped comm handle doesn't give us
+   anything to wait on for the output queue draining. */
+void sosc_led_output(sosc_state_t *state) {
+	sosc_led_flush(&state->led, state->monome);
+}
 
 static DWORD WINAPI lo_thread(LPVOID param) {
 	sosc_state_t *state = param;
 
-	while( 1 )
-		lo_server_recv(state->server);
+	/* OSC messages are handled here rather than in the main loop, so
+	   without a refresh timer this is where their LED changes go out.
+	   the lock is only taken once there's something to handle, so the
+	   main loop isn't held up while we wait. */
+	while( !stopping ) {
+		if( lo_server_wait(state->server, 1000) <= 0 )
+			continue;
+
+		EnterCriticalSection(&led_lock);
+		lo_server_recv_noblock(state->server, 0);
+
+		if( !state->config.dev.led_refresh_rate )
+			sosc_led_output(state);
+		LeaveCriticalSection(&led_lock);
+	}
+
+	return 0;
+}
 
+/* as on the other platforms, whatever the main loop drew during an
+   iteration (key echo, animation ticks) goes out at its end. */
+static int flush_leds(void *data) {
+	sosc_led_output(data);
 	return 0;
 }
 
-int sosc_event_loop(const sosc_state_t *state) {
+/* the lo_server runs in its own thread and the monome is waited on with
+   overlapped comm events, so the only thing other code can hang off the
+   windows event loop is timers. */
+static int windows_add(sosc_event_loop_t *loop, int watch) {
+	return !loop->watches[watch].timer_cb;
+}
+
+const sosc_event_backend_t sosc_event_backend_windows = {
+	.name = "windows",
+	.add  = windows_add
+};
+
+static int wait_loop(sosc_state_t *state) {
 	OVERLAPPED ov = {0, 0, {{0, 0}}};
-	HANDLE hres, lo_thd_res;
-	DWORD evt_mask;
+	HANDLE hres;
+	DWORD evt_mask, timeout;
+	int waiting, ret;
 
 	hres = (HANDLE) _get_osfhandle(monome_get_fd(state->monome));
-	lo_thd_res = CreateThread(NULL, 0, lo_thread, (void *) state, 0, NULL);
 
 	if( !(ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL)) ) {
 		fprintf(stderr, "serialosc: event_loop: can't allocate event (%ld)\n",
@@ -45,26 +92,45 @@ int sosc_event_loop(const sosc_state_t *state) {
 		return 1;
 	}
 
-	do {
-		SetCommMask(hres, EV_RXCHAR);
-
-		if( !WaitCommEvent(hres, &evt_mask, &ov) )
-			switch( GetLastError() ) {
-			case ERROR_IO_PENDING:
-				break;
+	waiting = 0;
 
-			case ERROR_ACCESS_DENIED:
-				/* evidently we get this when the monome is unplugged? */
-				return 1;
+	do {
+		/* a timer may have woken us up while the last comm event wait
+		   was still pending, in which case we just keep waiting on it. */
+		if( !waiting ) {
+			SetCommMask(hres, EV_RXCHAR);
+
+			if( !WaitCommEvent(hres, &evt_mask, &ov) )
+				switch( GetLastError() ) {
+				case ERROR_IO_PENDING:
+					break;
+
+				case ERROR_ACCESS_DENIED:
+					/* evidently we get this when the monome is unplugged? */
+					return 1;
+
+				default:
+					fprintf(stderr, "event_loop() error: %d\n", GetLastError());
+					return 1;
+				}
+
+			waiting = 1;
+		}
 
-			default:
-				fprintf(stderr, "event_loop() error: %d\n", GetLastError());
-				return 1;
-			}
+		timeout = sosc_event_loop_next_timeout(&state->loop);
+		if( timeout == (DWORD) -1 )
+			timeout = INFINITE;
 
-		switch( WaitForSingleObject(ov.hEvent, INFINITE) ) {
+		switch( WaitForSingleObject(ov.hEvent, timeout) ) {
 		case WAIT_OBJECT_0:
-			while( monome_event_handle_next(state->monome) );
+			/* key handlers draw too (echo), so they go under the lock, and
+			   what they drew goes out with the iteration-end flush. */
+			EnterCriticalSection(&led_lock);
+			while( monome_event_handle_next(state->monome) )
+				state->loop_stats.device_events++;
+			LeaveCriticalSection(&led_lock);
+
+			waiting = 0;
 			break;
 
 		case WAIT_TIMEOUT:
@@ -76,8 +142,42 @@ int sosc_event_loop(const sosc_state_t *state) {
 			        GetLastError());
 			return 1;
 		}
+
+		state->loop.iterations++;
+
+		EnterCriticalSection(&led_lock);
+		if( !(ret = sosc_event_loop_run_timers(&state->loop)) )
+			ret = sosc_event_loop_end_iteration(&state->loop);
+		LeaveCriticalSection(&led_lock);
+
+		if( ret )
+			return ret;
 	} while ( 1 );
 
-	((void) lo_thd_res); /* shut GCC up about this being an unused variable */
 	return 0;
 }
+
+int sosc_event_loop(sosc_state_t *state) {
+	HANDLE lo_thd_res;
+	int ret;
+
+	InitializeCriticalSection(&led_lock);
+
+	if( !state->config.dev.led_refresh_rate )
+		sosc_event_loop_on_iteration_end(&state->loop, flush_leds, state);
+
+	lo_thd_res = CreateThread(NULL, 0, lo_thread, (void *) state, 0, NULL);
+	ret = wait_loop(state);
+
+	/* once we return, the server writes the rules and the LEDs back to the
+	   config, and /sys/rules or an LED message handled on the other thread
+	   in the meantime would change them under it. */
+	stopping = 1;
+
+	if( lo_thd_res ) {
+		WaitForSingleObject(lo_thd_res, INFINITE);
+		CloseHandle(lo_thd_res);
+	}
+
+	return ret;
+}
@@ -0,0 +1,208 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "led.h"
+
+/**
+ * fades, blinks, pulses and ramps, run by the server so that applications
+ * don't have to send them a frame at a time. each tick works out every
+ * animation's level from how long it has been running and fills its
+ * region with that, through the framebuffer like any other drawing. a
+ * region is only redrawn when its level actually changes.
+ */
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+/* both take rectangles already clipped to the grid, so none of the sums
+   can overflow */
+static int overlaps(const sosc_led_anim_t *a, int x, int y, int w, int h) {
+	return a->x < x + w && x < a->x + a->w
+		&& a->y < y + h && y < a->y + a->h;
+}
+
+static int covers(const sosc_led_anim_t *a, const sosc_led_anim_t *b) {
+	return a->x <= b->x && a->y <= b->y
+		&& a->x + a->w >= b->x + b->w && a->y + a->h >= b->y + b->h;
+}
+
+/* drop the animations for which drop() is true, keeping the rest in
+   order */
+static void compact(sosc_led_anims_t *anims,
+                    int (*drop)(const sosc_led_anim_t *, const void *),
+                    const void *data) {
+	int i, n;
+
+	for( i = n = 0; i < anims->count; i++ )
+		if( !drop(&anims->anims[i], data) )
+			anims->anims[n++] = anims->anims[i];
+
+	anims->count = n;
+}
+
+static int covered_by(const sosc_led_anim_t *a, const void *by) {
+	return covers(by, a);
+}
+
+static int touches(const sosc_led_anim_t *a, const void *rect) {
+	const int *r = rect;
+	return overlaps(a, r[0], r[1], r[2], r[3]);
+}
+
+int sosc_led_anim_start(sosc_led_anims_t *anims, const sosc_led_t *led,
+                        const sosc_led_anim_t *anim, uint64_t now_ms) {
+	sosc_led_anim_t a = *anim;
+	int x0, y0, x1, y1;
+
+	if( anim->w < 1 || anim->h < 1 )
+		return -1;
+
+	x0 = MAX(anim->x, 0);
+	y0 = MAX(anim->y, 0);
+	x1 = sosc_led_clip_end(anim->x, anim->w, led->cols);
+	y1 = sosc_led_clip_end(anim->y, anim->h, led->rows);
+
+	if( x0 >= x1 || y0 >= y1 )
+		return -1;
+
+	a.x = x0;
+	a.y = y0;
+	a.w = x1 - x0;
+	a.h = y1 - y0;
+
+	a.from = MIN(MAX(a.from, 0), SOSC_LED_MAX_LEVEL);
+	a.to = MIN(MAX(a.to, 0), SOSC_LED_MAX_LEVEL);
+	a.period_ms = MAX(a.period_ms, 1);
+
+	a.layer = led->target;
+
+	if( a.type == SOSC_LED_ANIM_FADE )
+		a.from = led->layers[a.layer].level[y0][x0];
+
+	a.drawn = SOSC_LED_UNKNOWN;
+	a.start_ms = now_ms;
+
+	compact(anims, covered_by, &a);
+
+	if( anims->count >= SOSC_LED_MAX_ANIMS )
+		return -1;
+
+	anims->anims[anims->count++] = a;
+	return 0;
+}
+
+void sosc_led_anim_stop(sosc_led_anims_t *anims, int x, int y, int w, int h) {
+	int rect[4];
+
+	if( w < 1 || h < 1 )
+		return;
+
+	/* every animation is on the grid, so nothing outside it matters */
+	rect[0] = MAX(x, 0);
+	rect[1] = MAX(y, 0);
+	rect[2] = sosc_led_clip_end(x, w, SOSC_LED_MAX_COLS) - rect[0];
+	rect[3] = sosc_led_clip_end(y, h, SOSC_LED_MAX_ROWS) - rect[1];
+
+	if( rect[2] < 1 || rect[3] < 1 )
+		return;
+
+	compact(anims, touches, rect);
+}
+
+void sosc_led_anim_stop_all(sosc_led_anims_t *anims) {
+	anims->count = 0;
+}
+
+static int in_layer(const sosc_led_anim_t *a, const void *layer) {
+	return a->layer == *(const int *) layer;
+}
+
+void sosc_led_anim_stop_layer(sosc_led_anims_t *anims, int layer) {
+	compact(anims, in_layer, &layer);
+}
+
+/* the level n/d of the way from a->from to a->to. the product is done in
+   64 bits, since with a long period (to - from) * n overflows an int. */
+static int between(const sosc_led_anim_t *a, uint32_t n, uint32_t d) {
+	return a->from + (int) (((int64_t) (a->to - a->from) * n) / d);
+}
+
+/* the level at t ms in, and whether the animation is over */
+static int anim_level(const sosc_led_anim_t *a, uint64_t t, int *done) {
+	uint32_t p = a->period_ms, phase;
+
+	*done = 0;
+
+	if( a->type == SOSC_LED_ANIM_FADE ) {
+		if( t >= p ) {
+			*done = 1;
+			return a->to;
+		}
+
+		return between(a, (uint32_t) t, p);
+	}
+
+	phase = t % p;
+
+	switch( a->type ) {
+	case SOSC_LED_ANIM_BLINK:
+		return (phase < p / 2) ? a->from : a->to;
+
+	case SOSC_LED_ANIM_PULSE:
+		phase = (phase < p / 2) ? phase * 2 : (p - phase) * 2;
+		return between(a, phase, p);
+
+	case SOSC_LED_ANIM_RAMP:
+	default:
+		return between(a, phase, p);
+	}
+}
+
+static int finished(const sosc_led_anim_t *a, const void *data) {
+	return a->drawn == SOSC_LED_UNKNOWN;
+}
+
+int sosc_led_anim_tick(sosc_led_anims_t *anims, sosc_led_t *led,
+                       uint64_t now_ms) {
+	sosc_led_anim_t *a;
+	int i, level, done, any_done, target;
+
+	target = led->target;
+
+	for( i = any_done = 0; i < anims->count; i++ ) {
+		a = &anims->anims[i];
+		level = anim_level(a, now_ms - a->start_ms, &done);
+
+		if( level != a->drawn ) {
+			led->target = a->layer;
+			sosc_led_fill_rect(led, a->x, a->y, a->w, a->h, level);
+		}
+
+		/* a finished animation is marked for dropping once it has drawn
+		   its last level */
+		a->drawn = done ? SOSC_LED_UNKNOWN : level;
+		any_done |= done;
+	}
+
+	led->target = target;
+
+	if( any_done )
+		compact(anims, finished, NULL);
+
+	return anims->count;
+}
@@ -0,0 +1,139 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <monome.h>
+
+#include "led.h"
+
+/**
+ * the RGB half of the framebuffer. there's only the one colour command,
+ * so there's nothing to plan: each flush diffs color[][] against
+ * color_shown[][] a row at a time and sends a monome_led_color() for
+ * every LED that changed.
+ */
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+static uint32_t pack_rgb(int r, int g, int b) {
+	r = MIN(MAX(r, 0), 255);
+	g = MIN(MAX(g, 0), 255);
+	b = MIN(MAX(b, 0), 255);
+
+	return (r << 16) | (g << 8) | b;
+}
+
+static void store(sosc_led_t *led, int x, int y, uint32_t color) {
+	uint32_t *cur = &led->color[y][x];
+
+	if( *cur == color )
+		return;
+
+	if( *cur != led->color_shown[y][x] ) {
+		if( color == led->color_shown[y][x] )
+			led->stats.dropped++;
+		else
+			led->stats.replaced++;
+	}
+
+	*cur = color;
+}
+
+void sosc_led_color_set(sosc_led_t *led, int x, int y, int r, int g, int b) {
+	if( x < 0 || y < 0 || x >= led->cols || y >= led->rows )
+		return;
+
+	store(led, x, y, pack_rgb(r, g, b));
+	led->color_dirty = led->color_used = 1;
+}
+
+void sosc_led_color_rect(sosc_led_t *led, int x, int y, int w, int h,
+                         const uint8_t *rgb) {
+	const uint8_t *p;
+	int x0, y0, x1, y1, i, j;
+
+	if( w < 1 || h < 1 )
+		return;
+
+	x0 = MAX(x, 0);
+	y0 = MAX(y, 0);
+	x1 = sosc_led_clip_end(x, w, led->cols);
+	y1 = sosc_led_clip_end(y, h, led->rows);
+
+	if( x0 >= x1 || y0 >= y1 )
+		return;
+
+	for( j = y0; j < y1; j++ )
+		for( i = x0; i < x1; i++ ) {
+			p = &rgb[(((j - y) * w) + (i - x)) * 3];
+			store(led, i, j, pack_rgb(p[0], p[1], p[2]));
+		}
+
+	led->color_dirty = led->color_used = 1;
+}
+
+/* until an application uses colour we leave the device alone, so a grid
+   without RGB LEDs never sees a colour command. */
+void sosc_led_color_invalidate(sosc_led_t *led) {
+	if( !led->color_used )
+		return;
+
+	memset(led->color_shown, 0xFF, sizeof(led->color_shown));
+	led->color_dirty = 1;
+}
+
+void sosc_led_color_flush(sosc_led_t *led, monome_t *monome, int max_bytes) {
+	uint64_t mask[(SOSC_LED_MAX_COLS * 4) / 64];
+	uint32_t color;
+	int x, y, bit, sent;
+
+	if( !led->color_dirty )
+		return;
+
+	led->color_dirty = 0;
+	sent = 0;
+
+	for( y = 0; y < led->rows; y++ ) {
+		/* a byte at a time, so an LED changed if any of its 4 did */
+		sosc_led_kernels->diff(mask, (const uint8_t *) led->color[y],
+		                       (const uint8_t *) led->color_shown[y],
+		                       led->cols * 4);
+
+		for( x = 0; x < led->cols; x++ ) {
+			bit = x * 4;
+
+			if( !((mask[bit / 64] >> (bit % 64)) & 0xF) )
+				continue;
+
+			/* the rest goes next time */
+			if( sent >= max_bytes ) {
+				led->color_dirty = 1;
+				return;
+			}
+
+			color = led->color[y][x];
+			monome_led_color(monome, x, y, (color >> 16) & 0xFF,
+			                 (color >> 8) & 0xFF, color & 0xFF);
+
+			led->color_shown[y][x] = color;
+			led->stats.sent_bytes += SOSC_LED_COST_COLOR;
+			led->stats.commands++;
+			sent += SOSC_LED_COST_COLOR;
+		}
+	}
+}
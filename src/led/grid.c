@@ -0,0 +1,485 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include <limits.h>
+
+#include <monome.h>
+
+#include "led.h"
+
+/**
+ * a shadow of the grid's LEDs. applications draw into level[][] through
+ * the functions below, and sosc_led_flush() has planner.c work out the
+ * cheapest commands to bring shown[][] up to date, then sends them.
+ *
+ * flushing happens either straight after each OSC message or from a
+ * refresh timer, in which case any number of messages in between just
+ * redraw level[][] and cost nothing on the wire.
+ */
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+static int is_onoff(int level) {
+	return !level || level == SOSC_LED_MAX_LEVEL;
+}
+
+static uint8_t clamp_level(int level) {
+	if( level < 0 )
+		return 0;
+	if( level > SOSC_LED_MAX_LEVEL )
+		return SOSC_LED_MAX_LEVEL;
+	return level;
+}
+
+/* x1 and y1 are exclusive, and everything has already been clipped */
+static void mark_dirty(sosc_led_t *led, int x0, int y0, int x1, int y1) {
+	int qx, qy;
+
+	for( qy = y0 & ~7; qy < y1; qy += 8 )
+		for( qx = x0 & ~7; qx < x1; qx += 8 )
+			led->dirty |= SOSC_LED_QUAD_BIT(qx, qy);
+}
+
+uint16_t sosc_led_grid_quads(const sosc_led_t *led) {
+	sosc_led_t tmp;
+
+	tmp.dirty = 0;
+	mark_dirty(&tmp, 0, 0, led->cols, led->rows);
+	return tmp.dirty;
+}
+
+/* a change which hasn't been sent yet is just replaced by the new one. if
+   the new one puts the LED back the way the device has it, the change is
+   dropped altogether. */
+static void store(sosc_led_t *led, int x, int y, int level) {
+	uint8_t *cur = &led->level[y][x];
+
+	if( *cur == level )
+		return;
+
+	if( *cur != led->shown[y][x] ) {
+		if( level == led->shown[y][x] )
+			led->stats.dropped++;
+		else
+			led->stats.replaced++;
+	}
+
+	*cur = level;
+}
+
+/* into the layer being drawn on, and through to level[][] wherever that
+   layer is the one showing */
+static void draw(sosc_led_t *led, int x, int y, int level) {
+	led->layers[led->target].level[y][x] = level;
+
+	if( led->owner[y][x] == led->target )
+		store(led, x, y, level);
+}
+
+void sosc_led_init(sosc_led_t *led, monome_t *monome) {
+	sosc_led_kernels_init();
+
+	memset(led, 0, sizeof(*led));
+	led->layers[0].in_use = 1;
+	sosc_led_ring_init(led);
+	sosc_led_invalidate(led, monome);
+}
+
+/* after the device has been rotated or reset. everything is sent again,
+   and if the grid changed shape under the application, what it drew is
+   laid out for the old shape, so it's cleared rather than sent wrong. */
+void sosc_led_invalidate(sosc_led_t *led, monome_t *monome) {
+	int cols, rows, i;
+
+	cols = MIN(MAX(monome_get_cols(monome), 0), SOSC_LED_MAX_COLS);
+	rows = MIN(MAX(monome_get_rows(monome), 0), SOSC_LED_MAX_ROWS);
+
+	if( cols != led->cols || rows != led->rows ) {
+		memset(led->level, 0, sizeof(led->level));
+		memset(led->color, 0, sizeof(led->color));
+
+		for( i = 0; i <= SOSC_LED_MAX_LAYERS; i++ )
+			memset(led->layers[i].level, 0, sizeof(led->layers[i].level));
+
+		led->cols = cols;
+		led->rows = rows;
+	}
+
+	memset(led->shown, SOSC_LED_UNKNOWN, sizeof(led->shown));
+	led->dirty = sosc_led_grid_quads(led);
+	sosc_led_color_invalidate(led);
+}
+
+void sosc_led_set(sosc_led_t *led, int x, int y, int level) {
+	if( x < 0 || y < 0 || x >= led->cols || y >= led->rows )
+		return;
+
+	draw(led, x, y, clamp_level(level));
+	led->dirty |= SOSC_LED_QUAD_BIT(x, y);
+}
+
+void sosc_led_echo(sosc_led_t *led, int toggle, int level, int x, int y,
+                   int down) {
+	if( !toggle ) {
+		sosc_led_set(led, x, y, down ? level : 0);
+		return;
+	}
+
+	if( down && x >= 0 && y >= 0 && x < led->cols && y < led->rows )
+		sosc_led_set(led, x, y, led->level[y][x] ? 0 : level);
+}
+
+void sosc_led_fill(sosc_led_t *led, int level) {
+	int x, y;
+
+	level = clamp_level(level);
+
+	for( y = 0; y < led->rows; y++ )
+		for( x = 0; x < led->cols; x++ )
+			draw(led, x, y, level);
+
+	led->dirty |= sosc_led_grid_quads(led);
+}
+
+int sosc_led_clip_end(int start, int n, int limit) {
+	/* limit - start can't overflow, start + n could */
+	if( start >= 0 && n > limit - start )
+		return limit;
+
+	return MIN(start + n, limit);
+}
+
+void sosc_led_fill_rect(sosc_led_t *led, int x, int y, int w, int h,
+                        int level) {
+	int x0, y0, x1, y1, i, j;
+
+	if( w < 1 || h < 1 )
+		return;
+
+	x0 = MAX(x, 0);
+	y0 = MAX(y, 0);
+	x1 = sosc_led_clip_end(x, w, led->cols);
+	y1 = sosc_led_clip_end(y, h, led->rows);
+
+	if( x0 >= x1 || y0 >= y1 )
+		return;
+
+	level = clamp_level(level);
+
+	for( j = y0; j < y1; j++ )
+		for( i = x0; i < x1; i++ )
+			draw(led, i, j, level);
+
+	mark_dirty(led, x0, y0, x1, y1);
+}
+
+void sosc_led_rect(sosc_led_t *led, int x, int y, int w, int h,
+                   const uint8_t *levels) {
+	int x0, y0, x1, y1, i, j;
+
+	if( w < 1 || h < 1 )
+		return;
+
+	x0 = MAX(x, 0);
+	y0 = MAX(y, 0);
+	x1 = sosc_led_clip_end(x, w, led->cols);
+	y1 = sosc_led_clip_end(y, h, led->rows);
+
+	if( x0 >= x1 || y0 >= y1 )
+		return;
+
+	for( j = y0; j < y1; j++ )
+		for( i = x0; i < x1; i++ )
+			draw(led, i, j, clamp_level(levels[((j - y) * w) + (i - x)]));
+
+	mark_dirty(led, x0, y0, x1, y1);
+}
+
+void sosc_led_shift(sosc_led_t *led, int dx, int dy, int level) {
+	uint8_t from[SOSC_LED_MAX_ROWS][SOSC_LED_MAX_COLS];
+	int x, y, sx, sy;
+
+	/* dx and dy come straight off the wire, and x - INT_MIN overflows.
+	   moving the whole width or height or further leaves nothing. */
+	if( dx <= -led->cols || dx >= led->cols
+	    || dy <= -led->rows || dy >= led->rows ) {
+		sosc_led_fill(led, level);
+		return;
+	}
+
+	level = clamp_level(level);
+	memcpy(from, led->layers[led->target].level, sizeof(from));
+
+	for( y = 0; y < led->rows; y++ )
+		for( x = 0; x < led->cols; x++ ) {
+			sx = x - dx;
+			sy = y - dy;
+
+			if( sx < 0 || sy < 0 || sx >= led->cols || sy >= led->rows )
+				draw(led, x, y, level);
+			else
+				draw(led, x, y, from[sy][sx]);
+		}
+
+	led->dirty |= sosc_led_grid_quads(led);
+}
+
+/**
+ * layers
+ */
+
+static int layer_covers(const sosc_led_layer_t *l, int x, int y) {
+	return x >= l->x && y >= l->y && x - l->x < l->w && y - l->y < l->h;
+}
+
+/* work out which layer shows where, and redraw level[][] from them */
+static void composite(sosc_led_t *led) {
+	const sosc_led_layer_t *l;
+	int x, y, i, top;
+
+	for( y = 0; y < SOSC_LED_MAX_ROWS; y++ )
+		for( x = 0; x < SOSC_LED_MAX_COLS; x++ ) {
+			for( i = 1, top = 0; i <= SOSC_LED_MAX_LAYERS; i++ ) {
+				l = &led->layers[i];
+
+				if( l->in_use && layer_covers(l, x, y)
+				    && (!top || l->priority >= led->layers[top].priority) )
+					top = i;
+			}
+
+			led->owner[y][x] = top;
+
+			if( x < led->cols && y < led->rows )
+				store(led, x, y, led->layers[top].level[y][x]);
+		}
+
+	led->dirty |= sosc_led_grid_quads(led);
+}
+
+int sosc_led_layer_add(sosc_led_t *led, int x, int y, int w, int h,
+                       int priority) {
+	sosc_led_layer_t *l;
+	int i;
+
+	for( i = 1; i <= SOSC_LED_MAX_LAYERS; i++ )
+		if( !led->layers[i].in_use )
+			break;
+
+	if( i > SOSC_LED_MAX_LAYERS )
+		return -1;
+
+	l = &led->layers[i];
+	memset(l, 0, sizeof(*l));
+
+	l->in_use = 1;
+	l->x = x;
+	l->y = y;
+	l->w = w;
+	l->h = h;
+	l->priority = priority;
+
+	composite(led);
+	return i;
+}
+
+void sosc_led_layer_remove(sosc_led_t *led, int layer) {
+	if( layer < 1 || layer > SOSC_LED_MAX_LAYERS )
+		return;
+
+	led->layers[layer].in_use = 0;
+
+	if( led->target == layer )
+		led->target = 0;
+
+	composite(led);
+}
+
+int sosc_led_layer_at(const sosc_led_t *led, int x, int y) {
+	if( x < 0 || y < 0 || x >= led->cols || y >= led->rows )
+		return 0;
+
+	return led->owner[y][x];
+}
+
+/**
+ * sending
+ */
+
+static void sent(sosc_led_t *led, int bytes) {
+	led->stats.sent_bytes += bytes;
+	led->stats.commands++;
+}
+
+static void send_all(sosc_led_t *led, monome_t *monome, int level) {
+	if( is_onoff(level) ) {
+		monome_led_all(monome, !!level);
+		sent(led, SOSC_LED_COST_ALL);
+	} else {
+		monome_led_level_all(monome, level);
+		sent(led, SOSC_LED_COST_LEVEL_ALL);
+	}
+
+	memset(led->shown, level, sizeof(led->shown));
+}
+
+static void send_set(sosc_led_t *led, monome_t *monome, int x, int y) {
+	int level = led->level[y][x];
+
+	if( is_onoff(level) ) {
+		monome_led_set(monome, x, y, !!level);
+		sent(led, SOSC_LED_COST_SET);
+	} else {
+		monome_led_level_set(monome, x, y, level);
+		sent(led, SOSC_LED_COST_LEVEL_SET);
+	}
+
+	led->shown[y][x] = level;
+}
+
+/* n LEDs of a row (stride 1) or column (stride SOSC_LED_MAX_COLS) at a
+   multiple of 8, as one command. */
+static void send_line(sosc_led_t *led, monome_t *monome, int x, int y,
+                      int n, int stride) {
+	const uint8_t *src = &led->level[y][x];
+	uint8_t *dst = &led->shown[y][x];
+	uint8_t levels[8], bits;
+	int i, onoff;
+
+	for( i = bits = 0, onoff = 1; i < n; i++ ) {
+		levels[i] = dst[i * stride] = src[i * stride];
+		onoff &= is_onoff(levels[i]);
+		bits |= !!levels[i] << i;
+	}
+
+	if( stride == 1 ) {
+		if( onoff )
+			monome_led_row(monome, x, y, 1, &bits);
+		else
+			monome_led_level_row(monome, x, y, n, levels);
+	} else {
+		if( onoff )
+			monome_led_col(monome, x, y, 1, &bits);
+		else
+			monome_led_level_col(monome, x, y, n, levels);
+	}
+
+	sent(led, onoff ? SOSC_LED_COST_ROW : SOSC_LED_COST_LEVEL_ROW);
+}
+
+static void send_map(sosc_led_t *led, monome_t *monome, int qx, int qy) {
+	uint8_t levels[64], bits[8];
+	int x, y, onoff;
+
+	memset(bits, 0, sizeof(bits));
+	onoff = 1;
+
+	for( y = 0; y < 8; y++ )
+		for( x = 0; x < 8; x++ ) {
+			levels[(y * 8) + x] = led->level[qy + y][qx + x];
+			onoff &= is_onoff(levels[(y * 8) + x]);
+			bits[y] |= !!levels[(y * 8) + x] << x;
+		}
+
+	if( onoff ) {
+		monome_led_map(monome, qx, qy, bits);
+		sent(led, SOSC_LED_COST_MAP);
+	} else {
+		monome_led_level_map(monome, qx, qy, levels);
+		sent(led, SOSC_LED_COST_LEVEL_MAP);
+	}
+
+	for( y = 0; y < 8; y++ )
+		memcpy(&led->shown[qy + y][qx], &led->level[qy + y][qx], 8);
+}
+
+static void send_cmd(sosc_led_t *led, monome_t *monome,
+                     const sosc_led_cmd_t *cmd) {
+	switch( cmd->type ) {
+	case SOSC_LED_CMD_SET:
+		send_set(led, monome, cmd->x, cmd->y);
+		break;
+
+	case SOSC_LED_CMD_ALL:
+		send_all(led, monome, cmd->level);
+		break;
+
+	case SOSC_LED_CMD_MAP:
+		send_map(led, monome, cmd->x, cmd->y);
+		break;
+
+	case SOSC_LED_CMD_ROW:
+		send_line(led, monome, cmd->x, cmd->y, cmd->n, 1);
+		break;
+
+	case SOSC_LED_CMD_COL:
+		send_line(led, monome, cmd->x, cmd->y, cmd->n, SOSC_LED_MAX_COLS);
+		break;
+	}
+}
+
+int sosc_led_pending(const sosc_led_t *led) {
+	return led->dirty || led->color_dirty || led->ring_dirty;
+}
+
+void sosc_led_flush(sosc_led_t *led, monome_t *monome) {
+	sosc_led_flush_some(led, monome, INT_MAX);
+}
+
+void sosc_led_flush_some(sosc_led_t *led, monome_t *monome, int max_bytes) {
+	static sosc_led_cmd_t cmds[SOSC_LED_MAX_CMDS];
+	unsigned long start = led->stats.sent_bytes;
+	const sosc_led_cmd_t *cmd;
+	uint16_t dirty;
+	int i, n;
+
+	sosc_led_color_flush(led, monome, max_bytes);
+	if( led->stats.sent_bytes - start >= (unsigned long) max_bytes )
+		return;
+
+	sosc_led_ring_flush(led, monome,
+	                    max_bytes - (int) (led->stats.sent_bytes - start));
+	if( led->stats.sent_bytes - start >= (unsigned long) max_bytes )
+		return;
+
+	/* on windows the OSC handlers run on the lo_server's thread while the
+	   refresh timer runs on the main one. taking the dirty bits before
+	   looking at level[][] means a quad redrawn while we're flushing is
+	   still marked for the next flush. */
+	if( !(dirty = led->dirty) )
+		return;
+
+	led->dirty = 0;
+	led->stats.flushes++;
+
+	n = sosc_led_plan(led, dirty, cmds, NULL);
+
+	for( i = 0; i < n
+	     && led->stats.sent_bytes - start < (unsigned long) max_bytes; i++ )
+		send_cmd(led, monome, &cmds[i]);
+
+	/* shown[][] has everything that did go out, so the quads the rest
+	   were for just get planned again next time */
+	for( ; i < n; i++ ) {
+		cmd = &cmds[i];
+
+		if( cmd->type == SOSC_LED_CMD_ALL )
+			led->dirty |= dirty;
+		else
+			led->dirty |= SOSC_LED_QUAD_BIT(cmd->x, cmd->y);
+	}
+}
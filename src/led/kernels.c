@@ -0,0 +1,447 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "led.h"
+
+/**
+ * the per-LED inner loops: turning OSC int32 arguments into levels,
+ * packing levels two to a byte and back, and finding which LEDs differ
+ * between two buffers. there's a plain C version of each, and SSE2, AVX2
+ * and NEON ones where the compiler and CPU have them. sosc_led_kernels
+ * points at the best set once sosc_led_kernels_init() has run.
+ *
+ * every kernel takes any length; the vector versions hand whatever's left
+ * over after their last full vector to the scalar ones.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+#include <immintrin.h>
+#define TARGET(t) __attribute__((target(t)))
+#elif defined(__aarch64__)
+#define KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+/**
+ * scalar
+ */
+
+static void narrow_scalar(uint8_t *dst, const int32_t *src, size_t n) {
+	size_t i;
+
+	for( i = 0; i < n; i++ )
+		dst[i] = (src[i] < 0) ? 0
+			: (src[i] > SOSC_LED_MAX_LEVEL) ? SOSC_LED_MAX_LEVEL : src[i];
+}
+
+static void pack_scalar(uint8_t *dst, const uint8_t *src, size_t n) {
+	size_t i;
+
+	for( i = 0; i + 1 < n; i += 2 )
+		dst[i / 2] = ((src[i] & 0x0F) << 4) | (src[i + 1] & 0x0F);
+
+	if( n & 1 )
+		dst[n / 2] = (src[n - 1] & 0x0F) << 4;
+}
+
+static void unpack_scalar(uint8_t *dst, const uint8_t *src, size_t n) {
+	size_t i;
+
+	for( i = 0; i < n; i++ )
+		dst[i] = (i & 1) ? (src[i / 2] & 0x0F) : (src[i / 2] >> 4);
+}
+
+static uint64_t diff64_scalar(const uint8_t *a, const uint8_t *b, size_t n) {
+	uint64_t mask = 0;
+	size_t i;
+
+	for( i = 0; i < n; i++ )
+		mask |= (uint64_t) (a[i] != b[i]) << i;
+
+	return mask;
+}
+
+/* the diffs work 64 LEDs at a time, one mask word for each */
+#define DIFF(name, diff64) \
+	static void name(uint64_t *mask, const uint8_t *a, const uint8_t *b, \
+	                 size_t n) { \
+		size_t i; \
+		for( i = 0; i < n; i += 64 ) \
+			*mask++ = diff64(a + i, b + i, (n - i < 64) ? n - i : 64); \
+	}
+
+DIFF(diff_scalar, diff64_scalar)
+
+static uint64_t diff_quad_scalar(const uint8_t *a, const uint8_t *b,
+                                 size_t stride) {
+	uint64_t mask = 0;
+	int y;
+
+	for( y = 0; y < 8; y++ )
+		mask |= diff64_scalar(a + (y * stride), b + (y * stride), 8) << (y * 8);
+
+	return mask;
+}
+
+static const sosc_led_kernels_t kernels_scalar = {
+	.name      = "scalar",
+	.narrow    = narrow_scalar,
+	.pack      = pack_scalar,
+	.unpack    = unpack_scalar,
+	.diff      = diff_scalar,
+	.diff_quad = diff_quad_scalar
+};
+
+/**
+ * SSE2 and AVX2
+ */
+
+#ifdef KERNELS_X86
+
+/* int32s saturate to int16s, then to uint8s, which leaves anything
+   negative at 0. after that it's just a min against 15. */
+TARGET("sse2")
+static void narrow_sse2(uint8_t *dst, const int32_t *src, size_t n) {
+	const __m128i max = _mm_set1_epi8(SOSC_LED_MAX_LEVEL);
+	__m128i lo, hi;
+	size_t i;
+
+	for( i = 0; i + 16 <= n; i += 16 ) {
+		lo = _mm_packs_epi32(
+			_mm_loadu_si128((const __m128i *) &src[i]),
+			_mm_loadu_si128((const __m128i *) &src[i + 4]));
+		hi = _mm_packs_epi32(
+			_mm_loadu_si128((const __m128i *) &src[i + 8]),
+			_mm_loadu_si128((const __m128i *) &src[i + 12]));
+
+		_mm_storeu_si128((__m128i *) &dst[i],
+		                 _mm_min_epu8(_mm_packus_epi16(lo, hi), max));
+	}
+
+	narrow_scalar(dst + i, src + i, n - i);
+}
+
+/* in each 16-bit lane, the first level is the low byte. that goes in the
+   high nibble. */
+TARGET("sse2")
+static void pack_sse2(uint8_t *dst, const uint8_t *src, size_t n) {
+	const __m128i nibble = _mm_set1_epi8(0x0F), low = _mm_set1_epi16(0xFF);
+	__m128i a, b;
+	size_t i;
+
+	for( i = 0; i + 32 <= n; i += 32 ) {
+		a = _mm_and_si128(_mm_loadu_si128((const __m128i *) &src[i]), nibble);
+		b = _mm_and_si128(_mm_loadu_si128((const __m128i *) &src[i + 16]),
+		                  nibble);
+
+		a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, low), 4),
+		                 _mm_srli_epi16(a, 8));
+		b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, low), 4),
+		                 _mm_srli_epi16(b, 8));
+
+		_mm_storeu_si128((__m128i *) &dst[i / 2], _mm_packus_epi16(a, b));
+	}
+
+	pack_scalar(dst + (i / 2), src + i, n - i);
+}
+
+TARGET("sse2")
+static void unpack_sse2(uint8_t *dst, const uint8_t *src, size_t n) {
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	__m128i v, hi, lo;
+	size_t i;
+
+	for( i = 0; i + 32 <= n; i += 32 ) {
+		v  = _mm_loadu_si128((const __m128i *) &src[i / 2]);
+		hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+		lo = _mm_and_si128(v, nibble);
+
+		_mm_storeu_si128((__m128i *) &dst[i], _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *) &dst[i + 16], _mm_unpackhi_epi8(hi, lo));
+	}
+
+	unpack_scalar(dst + i, src + (i / 2), n - i);
+}
+
+TARGET("sse2")
+static uint64_t diff64_sse2(const uint8_t *a, const uint8_t *b, size_t n) {
+	uint64_t mask = 0;
+	__m128i eq;
+	size_t i;
+
+	for( i = 0; i + 16 <= n; i += 16 ) {
+		eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) &a[i]),
+		                    _mm_loadu_si128((const __m128i *) &b[i]));
+		mask |= (uint64_t) (~_mm_movemask_epi8(eq) & 0xFFFF) << i;
+	}
+
+	if( i < n )
+		mask |= diff64_scalar(a + i, b + i, n - i) << i;
+
+	return mask;
+}
+
+DIFF(diff_sse2, diff64_sse2)
+
+/* two rows of the quad per compare */
+TARGET("sse2")
+static uint64_t diff_quad_sse2(const uint8_t *a, const uint8_t *b,
+                               size_t stride) {
+	uint64_t mask = 0;
+	__m128i va, vb;
+	int y;
+
+	for( y = 0; y < 8; y += 2 ) {
+		va = _mm_unpacklo_epi64(
+			_mm_loadl_epi64((const __m128i *) (a + (y * stride))),
+			_mm_loadl_epi64((const __m128i *) (a + ((y + 1) * stride))));
+		vb = _mm_unpacklo_epi64(
+			_mm_loadl_epi64((const __m128i *) (b + (y * stride))),
+			_mm_loadl_epi64((const __m128i *) (b + ((y + 1) * stride))));
+
+		mask |= (uint64_t)
+			(~_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xFFFF) << (y * 8);
+	}
+
+	return mask;
+}
+
+/* the packs work within each 128-bit lane, so the four groups of 8 come
+   out interleaved and one cross-lane permute puts them back in order. */
+TARGET("avx2")
+static void narrow_avx2(uint8_t *dst, const int32_t *src, size_t n) {
+	const __m256i max = _mm256_set1_epi8(SOSC_LED_MAX_LEVEL);
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	__m256i ab, cd, v;
+	size_t i;
+
+	for( i = 0; i + 32 <= n; i += 32 ) {
+		ab = _mm256_packs_epi32(
+			_mm256_loadu_si256((const __m256i *) &src[i]),
+			_mm256_loadu_si256((const __m256i *) &src[i + 8]));
+		cd = _mm256_packs_epi32(
+			_mm256_loadu_si256((const __m256i *) &src[i + 16]),
+			_mm256_loadu_si256((const __m256i *) &src[i + 24]));
+
+		v = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(ab, cd), order);
+		_mm256_storeu_si256((__m256i *) &dst[i], _mm256_min_epu8(v, max));
+	}
+
+	/* the SSE2 code isn't VEX encoded, and running it with the upper
+	   halves dirty is slow. gcc leaves out its own vzeroupper when the
+	   call below becomes a tail call. */
+	_mm256_zeroupper();
+	narrow_sse2(dst + i, src + i, n - i);
+}
+
+TARGET("avx2")
+static uint64_t diff64_avx2(const uint8_t *a, const uint8_t *b, size_t n) {
+	uint64_t mask = 0;
+	__m256i eq;
+	size_t i;
+
+	for( i = 0; i + 32 <= n; i += 32 ) {
+		eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) &a[i]),
+		                       _mm256_loadu_si256((const __m256i *) &b[i]));
+		mask |= (uint64_t) ~(uint32_t) _mm256_movemask_epi8(eq) << i;
+	}
+
+	/* as in narrow_avx2() */
+	_mm256_zeroupper();
+
+	if( i < n )
+		mask |= diff64_sse2(a + i, b + i, n - i) << i;
+
+	return mask;
+}
+
+DIFF(diff_avx2, diff64_avx2)
+
+static const sosc_led_kernels_t kernels_sse2 = {
+	.name      = "sse2",
+	.narrow    = narrow_sse2,
+	.pack      = pack_sse2,
+	.unpack    = unpack_sse2,
+	.diff      = diff_sse2,
+	.diff_quad = diff_quad_sse2
+};
+
+/* nibble packing and the quad diff are too short to gain anything from
+   the wider registers. */
+static const sosc_led_kernels_t kernels_avx2 = {
+	.name      = "avx2",
+	.narrow    = narrow_avx2,
+	.pack      = pack_sse2,
+	.unpack    = unpack_sse2,
+	.diff      = diff_avx2,
+	.diff_quad = diff_quad_sse2
+};
+
+#endif /* defined KERNELS_X86 */
+
+/**
+ * NEON (aarch64 only, where it's always there)
+ */
+
+#ifdef KERNELS_NEON
+
+static void narrow_neon(uint8_t *dst, const int32_t *src, size_t n) {
+	const uint8x16_t max = vdupq_n_u8(SOSC_LED_MAX_LEVEL);
+	int16x8_t lo, hi;
+	size_t i;
+
+	for( i = 0; i + 16 <= n; i += 16 ) {
+		lo = vcombine_s16(vqmovn_s32(vld1q_s32(&src[i])),
+		                  vqmovn_s32(vld1q_s32(&src[i + 4])));
+		hi = vcombine_s16(vqmovn_s32(vld1q_s32(&src[i + 8])),
+		                  vqmovn_s32(vld1q_s32(&src[i + 12])));
+
+		vst1q_u8(&dst[i], vminq_u8(
+			vcombine_u8(vqmovun_s16(lo), vqmovun_s16(hi)), max));
+	}
+
+	narrow_scalar(dst + i, src + i, n - i);
+}
+
+static void pack_neon(uint8_t *dst, const uint8_t *src, size_t n) {
+	const uint8x16_t nibble = vdupq_n_u8(0x0F);
+	uint8x16x2_t v;
+	size_t i;
+
+	for( i = 0; i + 32 <= n; i += 32 ) {
+		/* de-interleaves into the first and second of each pair */
+		v = vld2q_u8(&src[i]);
+		vst1q_u8(&dst[i / 2], vorrq_u8(
+			vshlq_n_u8(vandq_u8(v.val[0], nibble), 4),
+			vandq_u8(v.val[1], nibble)));
+	}
+
+	pack_scalar(dst + (i / 2), src + i, n - i);
+}
+
+static void unpack_neon(uint8_t *dst, const uint8_t *src, size_t n) {
+	const uint8x16_t nibble = vdupq_n_u8(0x0F);
+	uint8x16x2_t out;
+	uint8x16_t v;
+	size_t i;
+
+	for( i = 0; i + 32 <= n; i += 32 ) {
+		v = vld1q_u8(&src[i / 2]);
+		out.val[0] = vshrq_n_u8(v, 4);
+		out.val[1] = vandq_u8(v, nibble);
+		vst2q_u8(&dst[i], out);
+	}
+
+	unpack_scalar(dst + i, src + (i / 2), n - i);
+}
+
+/* there's no movemask, so weight each lane by its bit and add across */
+static uint64_t movemask_neon(uint8x16_t ne) {
+	static const uint8_t weights[16] = {
+		1, 2, 4, 8, 16, 32, 64, 128,
+		1, 2, 4, 8, 16, 32, 64, 128
+	};
+	uint8x16_t bits = vandq_u8(ne, vld1q_u8(weights));
+
+	return vaddv_u8(vget_low_u8(bits))
+		| ((uint64_t) vaddv_u8(vget_high_u8(bits)) << 8);
+}
+
+static uint64_t diff64_neon(const uint8_t *a, const uint8_t *b, size_t n) {
+	uint64_t mask = 0;
+	size_t i;
+
+	for( i = 0; i + 16 <= n; i += 16 )
+		mask |= movemask_neon(vmvnq_u8(
+			vceqq_u8(vld1q_u8(&a[i]), vld1q_u8(&b[i])))) << i;
+
+	if( i < n )
+		mask |= diff64_scalar(a + i, b + i, n - i) << i;
+
+	return mask;
+}
+
+DIFF(diff_neon, diff64_neon)
+
+static uint64_t diff_quad_neon(const uint8_t *a, const uint8_t *b,
+                               size_t stride) {
+	uint64_t mask = 0;
+	uint8x16_t va, vb;
+	int y;
+
+	for( y = 0; y < 8; y += 2 ) {
+		va = vcombine_u8(vld1_u8(a + (y * stride)),
+		                 vld1_u8(a + ((y + 1) * stride)));
+		vb = vcombine_u8(vld1_u8(b + (y * stride)),
+		                 vld1_u8(b + ((y + 1) * stride)));
+
+		mask |= movemask_neon(vmvnq_u8(vceqq_u8(va, vb))) << (y * 8);
+	}
+
+	return mask;
+}
+
+static const sosc_led_kernels_t kernels_neon = {
+	.name      = "neon",
+	.narrow    = narrow_neon,
+	.pack      = pack_neon,
+	.unpack    = unpack_neon,
+	.diff      = diff_neon,
+	.diff_quad = diff_quad_neon
+};
+
+#endif /* defined KERNELS_NEON */
+
+/**
+ * dispatch
+ */
+
+const sosc_led_kernels_t *sosc_led_kernels = &kernels_scalar;
+
+const sosc_led_kernels_t **sosc_led_kernels_supported(void) {
+	static const sosc_led_kernels_t *sets[4];
+	int n = 0;
+
+	sets[n++] = &kernels_scalar;
+
+#if defined(KERNELS_X86)
+	__builtin_cpu_init();
+
+	if( __builtin_cpu_supports("sse2") )
+		sets[n++] = &kernels_sse2;
+	if( __builtin_cpu_supports("avx2") )
+		sets[n++] = &kernels_avx2;
+#elif defined(KERNELS_NEON)
+	sets[n++] = &kernels_neon;
+#endif
+
+	sets[n] = NULL;
+	return sets;
+}
+
+void sosc_led_kernels_init(void) {
+	const sosc_led_kernels_t **sets = sosc_led_kernels_supported();
+
+	while( sets[1] )
+		sets++;
+
+	sosc_led_kernels = *sets;
+}
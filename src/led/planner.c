@@ -0,0 +1,257 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "led.h"
+
+/**
+ * works out what to send to bring the device up to date.
+ *
+ * within a dirty quad, the LEDs that changed can be covered by row
+ * commands, column commands, single sets, or one map of the whole quad.
+ * we try every combination of row commands for the rows with changes in
+ * them (at most 256 of them). given the rows, each column independently
+ * takes whichever is cheaper of a column command or sets for whatever
+ * changes the rows didn't cover, so that gives the cheapest mix of rows,
+ * columns and sets, and the map is one more candidate on top.
+ *
+ * when the whole grid is dirty we also try an all to the most common
+ * level followed by a plan for what's left, and keep whichever is cheaper.
+ */
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+typedef struct {
+	const sosc_led_t *led;
+	const uint8_t (*shown)[SOSC_LED_MAX_COLS];
+
+	sosc_led_cmd_t *cmds;
+	int n;
+	int cost;
+} plan_t;
+
+static int is_onoff(int level) {
+	return !level || level == SOSC_LED_MAX_LEVEL;
+}
+
+static int popcount8(unsigned int v) {
+	v = v - ((v >> 1) & 0x55);
+	v = (v & 0x33) + ((v >> 2) & 0x33);
+	return (v + (v >> 4)) & 0x0F;
+}
+
+/* sets for the LEDs in changes, levels being the ones which can't use
+   the on/off form */
+static int sets_cost(unsigned int changes, unsigned int levels) {
+	return (SOSC_LED_COST_SET * popcount8(changes))
+		+ ((SOSC_LED_COST_LEVEL_SET - SOSC_LED_COST_SET)
+		   * popcount8(changes & levels));
+}
+
+static void emit(plan_t *p, sosc_led_cmd_type_t type, int x, int y, int n,
+                 int cost) {
+	sosc_led_cmd_t *cmd = &p->cmds[p->n++];
+
+	cmd->type  = type;
+	cmd->x     = x;
+	cmd->y     = y;
+	cmd->n     = n;
+	cmd->level = 0;
+
+	p->cost += cost;
+}
+
+static void plan_quad(plan_t *p, int qx, int qy) {
+	const sosc_led_t *led = p->led;
+	unsigned int row_changes[8], col_changes[8], col_levels[8], rows, r, left;
+	int row_cost[8], col_cost[8], col_onoff[8], row_onoff, quad_onoff;
+	int x, y, w, h, level, cost, best, best_rows;
+	uint64_t changes;
+
+	w = MIN(8, led->cols - qx);
+	h = MIN(8, led->rows - qy);
+
+	/* the whole 8x8 is always inside the buffers, even when it isn't all
+	   on the grid, so diff all of it and drop what's off the edge. */
+	changes = sosc_led_kernels->diff_quad(
+		&led->level[qy][qx], &p->shown[qy][qx], SOSC_LED_MAX_COLS);
+
+	if( w < 8 || h < 8 )
+		changes &= (0x0101010101010101ULL * ((1 << w) - 1))
+			& (~0ULL >> (64 - (h * 8)));
+
+	if( !changes )
+		return;
+
+	for( x = 0; x < 8; x++ ) {
+		col_changes[x] = col_levels[x] = 0;
+		col_onoff[x] = 1;
+	}
+
+	quad_onoff = 1;
+	rows = 0;
+
+	for( y = 0; y < h; y++ ) {
+		row_changes[y] = (changes >> (y * 8)) & 0xFF;
+		row_onoff = 1;
+
+		for( x = 0; x < w; x++ ) {
+			level = led->level[qy + y][qx + x];
+
+			if( !is_onoff(level) )
+				row_onoff = col_onoff[x] = quad_onoff = 0;
+
+			if( !(row_changes[y] & (1 << x)) )
+				continue;
+
+			col_changes[x] |= 1 << y;
+
+			if( !is_onoff(level) )
+				col_levels[x] |= 1 << y;
+		}
+
+		row_cost[y] = row_onoff ? SOSC_LED_COST_ROW : SOSC_LED_COST_LEVEL_ROW;
+
+		if( row_changes[y] )
+			rows |= 1 << y;
+	}
+
+	if( !rows )
+		return;
+
+	for( x = 0; x < w; x++ )
+		col_cost[x] = col_onoff[x]
+			? SOSC_LED_COST_ROW : SOSC_LED_COST_LEVEL_ROW;
+
+	/* every subset of the rows with changes in them, down to none */
+	best = best_rows = -1;
+	r = rows;
+
+	do {
+		for( y = cost = 0; y < h; y++ )
+			if( r & (1 << y) )
+				cost += row_cost[y];
+
+		for( x = 0; x < w; x++ )
+			if( (left = col_changes[x] & ~r) )
+				cost += MIN(col_cost[x], sets_cost(left, col_levels[x]));
+
+		if( best < 0 || cost < best ) {
+			best = cost;
+			best_rows = r;
+		}
+
+		r = (r - 1) & rows;
+	} while( r != rows );
+
+	/* a partial quad at the edge of a small grid can't take a map */
+	if( w == 8 && h == 8 ) {
+		cost = quad_onoff ? SOSC_LED_COST_MAP : SOSC_LED_COST_LEVEL_MAP;
+
+		if( cost < best ) {
+			emit(p, SOSC_LED_CMD_MAP, qx, qy, 0, cost);
+			return;
+		}
+	}
+
+	for( y = 0; y < h; y++ )
+		if( best_rows & (1 << y) )
+			emit(p, SOSC_LED_CMD_ROW, qx, qy + y, w, row_cost[y]);
+
+	for( x = 0; x < w; x++ ) {
+		if( !(left = col_changes[x] & ~best_rows) )
+			continue;
+
+		if( col_cost[x] < sets_cost(left, col_levels[x]) ) {
+			emit(p, SOSC_LED_CMD_COL, qx + x, qy, h, col_cost[x]);
+			continue;
+		}
+
+		for( y = 0; y < h; y++ )
+			if( left & (1 << y) )
+				emit(p, SOSC_LED_CMD_SET, qx + x, qy + y, 0,
+				     sets_cost(1 << y, col_levels[x]));
+	}
+}
+
+static void plan_quads(plan_t *p, uint16_t dirty) {
+	int qx, qy;
+
+	for( qy = 0; qy < p->led->rows; qy += 8 )
+		for( qx = 0; qx < p->led->cols; qx += 8 )
+			if( dirty & SOSC_LED_QUAD_BIT(qx, qy) )
+				plan_quad(p, qx, qy);
+}
+
+static int most_common_level(const sosc_led_t *led) {
+	int count[SOSC_LED_MAX_LEVEL + 1] = {0};
+	int x, y, level;
+
+	for( y = 0; y < led->rows; y++ )
+		for( x = 0; x < led->cols; x++ )
+			count[led->level[y][x]]++;
+
+	for( x = level = 0; x <= SOSC_LED_MAX_LEVEL; x++ )
+		if( count[x] > count[level] )
+			level = x;
+
+	return level;
+}
+
+int sosc_led_plan(const sosc_led_t *led, uint16_t dirty,
+                  sosc_led_cmd_t *cmds, int *cost) {
+	static uint8_t filled[SOSC_LED_MAX_ROWS][SOSC_LED_MAX_COLS];
+	static sosc_led_cmd_t alt_cmds[SOSC_LED_MAX_CMDS];
+	plan_t plan, alt;
+	int level;
+
+	plan.led   = led;
+	plan.shown = (const uint8_t (*)[SOSC_LED_MAX_COLS]) led->shown;
+	plan.cmds  = cmds;
+	plan.n     = plan.cost = 0;
+
+	plan_quads(&plan, dirty);
+
+	/* nothing beats a lone all */
+	if( dirty == sosc_led_grid_quads(led)
+	    && plan.cost > SOSC_LED_COST_ALL ) {
+		level = most_common_level(led);
+		memset(filled, level, sizeof(filled));
+
+		alt.led   = led;
+		alt.shown = (const uint8_t (*)[SOSC_LED_MAX_COLS]) filled;
+		alt.cmds  = alt_cmds;
+		alt.n     = alt.cost = 0;
+
+		emit(&alt, SOSC_LED_CMD_ALL, 0, 0, 0, is_onoff(level)
+			? SOSC_LED_COST_ALL : SOSC_LED_COST_LEVEL_ALL);
+		alt_cmds[0].level = level;
+
+		plan_quads(&alt, dirty);
+
+		if( alt.cost < plan.cost ) {
+			memcpy(cmds, alt_cmds, alt.n * sizeof(*cmds));
+			plan.n = alt.n;
+			plan.cost = alt.cost;
+		}
+	}
+
+	if( cost )
+		*cost = plan.cost;
+
+	return plan.n;
+}
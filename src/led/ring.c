@@ -0,0 +1,235 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <monome.h>
+
+#include "led.h"
+
+/**
+ * the arc half of the framebuffer. ring commands draw into ring[][], and
+ * each flush works out, per ring, the cheapest of:
+ *
+ *   - one all, if the whole ring is a single level
+ *   - one map
+ *   - for each run of neighbouring changed LEDs going to the same level,
+ *     a range or a set apiece, whichever is cheaper
+ *
+ * a ring the device already shows costs nothing, however it was drawn.
+ */
+
+#define RING_MASK (SOSC_LED_RING_SIZE - 1)
+
+static uint8_t clamp_level(int level) {
+	if( level < 0 )
+		return 0;
+	if( level > SOSC_LED_MAX_LEVEL )
+		return SOSC_LED_MAX_LEVEL;
+	return level;
+}
+
+static int changed(uint64_t mask, int x) {
+	return (mask >> (x & RING_MASK)) & 1;
+}
+
+static void store(sosc_led_t *led, int n, int x, int level) {
+	uint8_t *cur = &led->ring[n][x];
+
+	if( *cur == level )
+		return;
+
+	if( *cur != led->ring_shown[n][x] ) {
+		if( level == led->ring_shown[n][x] )
+			led->stats.dropped++;
+		else
+			led->stats.replaced++;
+	}
+
+	*cur = level;
+}
+
+void sosc_led_ring_init(sosc_led_t *led) {
+	memset(led->ring, 0, sizeof(led->ring));
+	memset(led->ring_shown, SOSC_LED_UNKNOWN, sizeof(led->ring_shown));
+	led->ring_dirty = 0;
+}
+
+void sosc_led_ring_set(sosc_led_t *led, int n, int x, int level) {
+	if( n < 0 || n >= SOSC_LED_MAX_RINGS )
+		return;
+
+	store(led, n, x & RING_MASK, clamp_level(level));
+	led->ring_dirty |= 1 << n;
+}
+
+void sosc_led_ring_fill(sosc_led_t *led, int n, int level) {
+	sosc_led_ring_range(led, n, 0, RING_MASK, level);
+}
+
+void sosc_led_ring_range(sosc_led_t *led, int n, int x1, int x2, int level) {
+	int x;
+
+	if( n < 0 || n >= SOSC_LED_MAX_RINGS )
+		return;
+
+	level = clamp_level(level);
+	x2 &= RING_MASK;
+
+	for( x = x1 & RING_MASK;; x = (x + 1) & RING_MASK ) {
+		store(led, n, x, level);
+
+		if( x == x2 )
+			break;
+	}
+
+	led->ring_dirty |= 1 << n;
+}
+
+void sosc_led_ring_map(sosc_led_t *led, int n, const uint8_t *levels) {
+	int x;
+
+	if( n < 0 || n >= SOSC_LED_MAX_RINGS )
+		return;
+
+	for( x = 0; x < SOSC_LED_RING_SIZE; x++ )
+		store(led, n, x, levels[x]);
+
+	led->ring_dirty |= 1 << n;
+}
+
+void sosc_led_ring_rotate(sosc_led_t *led, int n, int d) {
+	uint8_t from[SOSC_LED_RING_SIZE];
+	int x;
+
+	if( n < 0 || n >= SOSC_LED_MAX_RINGS )
+		return;
+
+	memcpy(from, led->ring[n], sizeof(from));
+	d &= RING_MASK;
+
+	for( x = 0; x < SOSC_LED_RING_SIZE; x++ )
+		store(led, n, x, from[(x - d) & RING_MASK]);
+
+	led->ring_dirty |= 1 << n;
+}
+
+/**
+ * sending
+ */
+
+static void sent(sosc_led_t *led, int bytes) {
+	led->stats.sent_bytes += bytes;
+	led->stats.commands++;
+}
+
+/* cost of the runs, and if monome isn't NULL, send them too. a run can
+   wrap past LED 63, so we start at a changed LED that doesn't continue
+   one from the LED before it. */
+static int ring_runs(sosc_led_t *led, monome_t *monome, int n,
+                     uint64_t mask) {
+	const uint8_t *ring = led->ring[n];
+	int start, x, len, cost;
+
+	for( start = 0; start < SOSC_LED_RING_SIZE; start++ )
+		if( changed(mask, start)
+		    && !(changed(mask, start - 1)
+		         && ring[(start - 1) & RING_MASK] == ring[start]) )
+			break;
+
+	for( x = start, cost = 0; x < start + SOSC_LED_RING_SIZE; x += len ) {
+		if( !changed(mask, x) ) {
+			len = 1;
+			continue;
+		}
+
+		for( len = 1; len < SOSC_LED_RING_SIZE
+		     && changed(mask, x + len)
+		     && ring[(x + len) & RING_MASK] == ring[x & RING_MASK]; len++ );
+
+		if( SOSC_LED_COST_RING_RANGE < SOSC_LED_COST_RING_SET * len ) {
+			cost += SOSC_LED_COST_RING_RANGE;
+
+			if( monome ) {
+				monome_led_ring_range(monome, n, x & RING_MASK,
+				                      (x + len - 1) & RING_MASK, ring[x & RING_MASK]);
+				sent(led, SOSC_LED_COST_RING_RANGE);
+			}
+		} else {
+			cost += SOSC_LED_COST_RING_SET * len;
+
+			if( monome )
+				for( ; len; len--, x++ ) {
+					monome_led_ring_set(monome, n, x & RING_MASK,
+					                    ring[x & RING_MASK]);
+					sent(led, SOSC_LED_COST_RING_SET);
+				}
+		}
+	}
+
+	return cost;
+}
+
+static void ring_flush(sosc_led_t *led, monome_t *monome, int n) {
+	const uint8_t *ring = led->ring[n];
+	uint64_t mask;
+	int x, runs;
+
+	sosc_led_kernels->diff(&mask, ring, led->ring_shown[n],
+	                       SOSC_LED_RING_SIZE);
+
+	if( !mask )
+		return;
+
+	for( x = 1; x < SOSC_LED_RING_SIZE && ring[x] == ring[0]; x++ );
+
+	runs = ring_runs(led, NULL, n, mask);
+
+	if( x == SOSC_LED_RING_SIZE && SOSC_LED_COST_RING_ALL < runs ) {
+		monome_led_ring_all(monome, n, ring[0]);
+		sent(led, SOSC_LED_COST_RING_ALL);
+	} else if( SOSC_LED_COST_RING_MAP < runs ) {
+		monome_led_ring_map(monome, n, ring);
+		sent(led, SOSC_LED_COST_RING_MAP);
+	} else
+		ring_runs(led, monome, n, mask);
+
+	memcpy(led->ring_shown[n], ring, SOSC_LED_RING_SIZE);
+}
+
+void sosc_led_ring_flush(sosc_led_t *led, monome_t *monome, int max_bytes) {
+	unsigned long start = led->stats.sent_bytes;
+	uint8_t dirty;
+	int n;
+
+	if( !(dirty = led->ring_dirty) )
+		return;
+
+	led->ring_dirty = 0;
+
+	for( n = 0; n < SOSC_LED_MAX_RINGS; n++ ) {
+		if( !(dirty & (1 << n)) )
+			continue;
+
+		/* this ring and the rest go next time */
+		if( led->stats.sent_bytes - start >= (unsigned long) max_bytes ) {
+			led->ring_dirty |= dirty & ~((1 << n) - 1);
+			return;
+		}
+
+		ring_flush(led, monome, n);
+	}
+}
@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "led.h"
+
+/**
+ * key feedback rules, so that common bits of UI (lighting a row, radio
+ * buttons, toggles) happen on the server the moment a key comes in
+ * instead of after a round trip to the application.
+ *
+ * rules are written as text, in the config file or over OSC:
+ *
+ *     op x y w h edge level
+ *
+ * where the rule applies to keys inside the w * h area at x, y, edge is
+ * "down", "up" or "both", and op is one of:
+ *
+ *     set     the key's LED to level
+ *     toggle  the key's LED between 0 and level
+ *     row     the key's row, across the area, to level
+ *     col     the key's column, down the area, to level
+ *     radio   the whole area to 0, then the key's LED to level
+ *     fill    the whole area to level
+ *
+ * the text is only parsed once, into a sosc_led_rule_t. every rule that
+ * matches a key runs, in the order they were added.
+ */
+
+#define ARRAY_LENGTH(x) (sizeof(x) / sizeof(*x))
+
+static const char *op_names[] = {
+	[SOSC_LED_RULE_SET]    = "set",
+	[SOSC_LED_RULE_TOGGLE] = "toggle",
+	[SOSC_LED_RULE_ROW]    = "row",
+	[SOSC_LED_RULE_COL]    = "col",
+	[SOSC_LED_RULE_RADIO]  = "radio",
+	[SOSC_LED_RULE_FILL]   = "fill"
+};
+
+static const char *edge_names[] = {
+	[SOSC_LED_RULE_DOWN] = "down",
+	[SOSC_LED_RULE_UP]   = "up",
+	[SOSC_LED_RULE_BOTH] = "both"
+};
+
+static int lookup(const char **names, int n, const char *name) {
+	int i;
+
+	for( i = 0; i < n; i++ )
+		if( names[i] && !strcmp(name, names[i]) )
+			return i;
+
+	return -1;
+}
+
+int sosc_led_rule_parse(sosc_led_rule_t *rule, const char *text) {
+	char op[8], edge[8];
+	int x, y, w, h, level, i, j;
+
+	if( sscanf(text, "%7s %d %d %d %d %7s %d",
+	           op, &x, &y, &w, &h, edge, &level) != 7 )
+		return -1;
+
+	if( (i = lookup(op_names, ARRAY_LENGTH(op_names), op)) < 0
+	    || (j = lookup(edge_names, ARRAY_LENGTH(edge_names), edge)) < 0 )
+		return -1;
+
+	/* with x and y known to be positive, subtracting them can't overflow
+	   where x + w could */
+	if( x < 0 || y < 0 || w < 1 || h < 1
+	    || w > SOSC_LED_MAX_COLS - x || h > SOSC_LED_MAX_ROWS - y
+	    || level < 0 || level > SOSC_LED_MAX_LEVEL )
+		return -1;
+
+	rule->op = i;
+	rule->edges = j;
+	rule->x0 = x;
+	rule->y0 = y;
+	rule->x1 = x + w;
+	rule->y1 = y + h;
+	rule->level = level;
+
+	return 0;
+}
+
+void sosc_led_rule_format(const sosc_led_rule_t *rule, char *buf,
+                          size_t len) {
+	snprintf(buf, len, "%s %d %d %d %d %s %d",
+	         op_names[rule->op], rule->x0, rule->y0,
+	         rule->x1 - rule->x0, rule->y1 - rule->y0,
+	         edge_names[rule->edges], rule->level);
+}
+
+int sosc_led_rules_add(sosc_led_rules_t *rules, const sosc_led_rule_t *rule) {
+	if( rules->count >= SOSC_LED_MAX_RULES )
+		return -1;
+
+	rules->rules[rules->count++] = *rule;
+	return 0;
+}
+
+void sosc_led_rules_press(const sosc_led_rules_t *rules, sosc_led_t *led,
+                          int x, int y, int down) {
+	const sosc_led_rule_t *r, *end;
+	int edge = down ? SOSC_LED_RULE_DOWN : SOSC_LED_RULE_UP;
+
+	for( r = rules->rules, end = r + rules->count; r < end; r++ ) {
+		if( x < r->x0 || x >= r->x1 || y < r->y0 || y >= r->y1
+		    || !(r->edges & edge) )
+			continue;
+
+		switch( r->op ) {
+		case SOSC_LED_RULE_SET:
+			sosc_led_set(led, x, y, r->level);
+			break;
+
+		case SOSC_LED_RULE_TOGGLE:
+			if( x < led->cols && y < led->rows )
+				sosc_led_set(led, x, y, led->level[y][x] ? 0 : r->level);
+			break;
+
+		case SOSC_LED_RULE_ROW:
+			sosc_led_fill_rect(led, r->x0, y, r->x1 - r->x0, 1, r->level);
+			break;
+
+		case SOSC_LED_RULE_COL:
+			sosc_led_fill_rect(led, x, r->y0, 1, r->y1 - r->y0, r->level);
+			break;
+
+		case SOSC_LED_RULE_RADIO:
+			sosc_led_fill_rect(led, r->x0, r->y0, r->x1 - r->x0,
+			                   r->y1 - r->y0, 0);
+			sosc_led_set(led, x, y, r->level);
+			break;
+
+		case SOSC_LED_RULE_FILL:
+			sosc_led_fill_rect(led, r->x0, r->y0, r->x1 - r->x0,
+			                   r->y1 - r->y0, r->level);
+			break;
+		}
+	}
+}
@@ -0,0 +1,162 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "led.h"
+
+/**
+ * the framebuffer as a compact binary blob, saved when the device goes
+ * away so that it can be put back up as soon as it comes back. this is
+ * what the application last drew (with every layer flattened into one),
+ * not necessarily what made it to the device. it's only put back if the
+ * device comes back soon after: a frame from last week is just noise.
+ *
+ *   "sled", version, cols, rows, flags, ring mask
+ *   when it was saved, in seconds since the epoch, 8 bytes big endian
+ *   levels, two to a byte, row by row
+ *   if flags has SNAPSHOT_COLOR: r g b for each LED, row by row
+ *   for each ring in the mask: its levels, two to a byte
+ *
+ * only rings with something lit are kept, so nothing's sent to the rings
+ * of a grid, or to the ones an arc application left dark.
+ */
+
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_HEADER  17
+
+#define SNAPSHOT_COLOR   0x01
+
+static const uint8_t magic[4] = {'s', 'l', 'e', 'd'};
+
+static int ring_lit(const sosc_led_t *led, int n) {
+	int x;
+
+	for( x = 0; x < SOSC_LED_RING_SIZE; x++ )
+		if( led->ring[n][x] )
+			return 1;
+
+	return 0;
+}
+
+size_t sosc_led_snapshot(const sosc_led_t *led, uint8_t *buf,
+                         uint64_t saved) {
+	uint8_t rows[SOSC_LED_MAX_ROWS * SOSC_LED_MAX_COLS];
+	uint8_t *p = buf + SNAPSHOT_HEADER;
+	uint32_t color;
+	int x, y, n, mask;
+
+	for( n = mask = 0; n < SOSC_LED_MAX_RINGS; n++ )
+		if( ring_lit(led, n) )
+			mask |= 1 << n;
+
+	memcpy(buf, magic, sizeof(magic));
+	buf[4] = SNAPSHOT_VERSION;
+	buf[5] = led->cols;
+	buf[6] = led->rows;
+	buf[7] = led->color_used ? SNAPSHOT_COLOR : 0;
+	buf[8] = mask;
+
+	for( n = 0; n < 8; n++ )
+		buf[9 + n] = saved >> (56 - (n * 8));
+
+	for( y = 0; y < led->rows; y++ )
+		memcpy(&rows[y * led->cols], led->level[y], led->cols);
+
+	n = led->cols * led->rows;
+	sosc_led_kernels->pack(p, rows, n);
+	p += (n + 1) / 2;
+
+	if( led->color_used )
+		for( y = 0; y < led->rows; y++ )
+			for( x = 0; x < led->cols; x++ ) {
+				color = led->color[y][x];
+
+				*p++ = color >> 16;
+				*p++ = color >> 8;
+				*p++ = color;
+			}
+
+	for( n = 0; n < SOSC_LED_MAX_RINGS; n++ )
+		if( mask & (1 << n) ) {
+			sosc_led_kernels->pack(p, led->ring[n], SOSC_LED_RING_SIZE);
+			p += SOSC_LED_RING_SIZE / 2;
+		}
+
+	return p - buf;
+}
+
+/* draws a snapshot into the framebuffer. it has to be from a grid the
+   same size, and saved at most max_age seconds before now, or nothing's
+   drawn. */
+int sosc_led_restore(sosc_led_t *led, const uint8_t *buf, size_t len,
+                     uint64_t now, uint64_t max_age) {
+	uint8_t levels[SOSC_LED_MAX_ROWS * SOSC_LED_MAX_COLS];
+	const uint8_t *p = buf + SNAPSHOT_HEADER;
+	const uint8_t *end = buf + len;
+	uint64_t saved;
+	int n, flags, mask;
+	size_t need;
+
+	if( len < SNAPSHOT_HEADER || memcmp(buf, magic, sizeof(magic))
+	    || buf[4] != SNAPSHOT_VERSION
+	    || buf[5] != led->cols || buf[6] != led->rows )
+		return 1;
+
+	for( n = 0, saved = 0; n < 8; n++ )
+		saved = (saved << 8) | buf[9 + n];
+
+	/* a clock that's gone backwards tells us nothing, so that's too old
+	   as well */
+	if( saved > now || now - saved > max_age )
+		return 1;
+
+	flags = buf[7];
+	mask  = buf[8];
+
+	n = led->cols * led->rows;
+	need = (n + 1) / 2;
+
+	if( flags & SNAPSHOT_COLOR )
+		need += n * 3;
+
+	for( n = 0; n < SOSC_LED_MAX_RINGS; n++ )
+		if( mask & (1 << n) )
+			need += SOSC_LED_RING_SIZE / 2;
+
+	if( (size_t) (end - p) != need )
+		return 1;
+
+	n = led->cols * led->rows;
+	sosc_led_kernels->unpack(levels, p, n);
+	sosc_led_rect(led, 0, 0, led->cols, led->rows, levels);
+	p += (n + 1) / 2;
+
+	if( flags & SNAPSHOT_COLOR ) {
+		sosc_led_color_rect(led, 0, 0, led->cols, led->rows, p);
+		p += n * 3;
+	}
+
+	for( n = 0; n < SOSC_LED_MAX_RINGS; n++ )
+		if( mask & (1 << n) ) {
+			sosc_led_kernels->unpack(levels, p, SOSC_LED_RING_SIZE);
+			sosc_led_ring_map(led, n, levels);
+			p += SOSC_LED_RING_SIZE / 2;
+		}
+
+	return 0;
+}
@@ -0,0 +1,202 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#else
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+#include "serialosc.h"
+#include "event_loop.h"
+#include "osc.h"
+
+/**
+ * applications sharing a grid. one that sends /sys/layer gets an LED
+ * layer over part of the grid, and from then on everything it draws goes
+ * into that layer and the keys in the part of the grid it shows on are
+ * sent to it rather than to the usual destination. everyone else keeps
+ * drawing into the base layer and getting the rest of the keys.
+ *
+ * applications are told apart by the address their messages come from,
+ * which the receive path hands us in state->rx_src. on windows liblo
+ * does the receiving, so there's no address and no layers.
+ *
+ * an application can go away without releasing its layer, so one we
+ * haven't heard anything from in a while loses it.
+ */
+
+static struct sockaddr *copy_addr(const struct sockaddr *addr, int len) {
+	struct sockaddr *copy;
+
+	if( !(copy = s_malloc(len)) ) {
+		fprintf(stderr, "aieee, could not allocate memory in "
+				"copy_addr(), bailing out!\n");
+
+		/* in a child process, use _exit() instead of exit() */
+		_exit(EXIT_FAILURE);
+	}
+
+	memcpy(copy, addr, len);
+	return copy;
+}
+
+static void set_port(struct sockaddr *addr, int port) {
+	switch( addr->sa_family ) {
+	case AF_INET:
+		((struct sockaddr_in *) addr)->sin_port = htons(port);
+		break;
+
+	case AF_INET6:
+		((struct sockaddr_in6 *) addr)->sin6_port = htons(port);
+		break;
+	}
+}
+
+static sosc_client_t *find_client(sosc_state_t *state) {
+	sosc_client_t *c;
+	int i;
+
+	if( !state->rx_src )
+		return NULL;
+
+	for( i = 0; i < SOSC_LED_MAX_LAYERS; i++ ) {
+		c = &state->clients[i];
+
+		if( c->src && c->src_len == state->rx_src_len
+		    && !memcmp(c->src, state->rx_src, c->src_len) )
+			return c;
+	}
+
+	return NULL;
+}
+
+static void free_client(sosc_state_t *state, sosc_client_t *c) {
+	int layer = (c - state->clients) + 1;
+
+	sosc_led_anim_stop_layer(&state->anims, layer);
+	sosc_led_layer_remove(&state->led, layer);
+
+	s_free(c->src);
+	s_free(c->dst);
+	memset(c, 0, sizeof(*c));
+
+	state->nclients--;
+}
+
+/* the layer of whoever sent the datagram being handled, which also
+   counts as hearing from them */
+int osc_client_layer(sosc_state_t *state, uint64_t now) {
+	sosc_client_t *c;
+
+	if( !(c = find_client(state)) )
+		return 0;
+
+	c->last_heard = now;
+	return (c - state->clients) + 1;
+}
+
+/* claiming again moves the layer, and leaves it empty */
+int osc_client_claim(sosc_state_t *state, int x, int y, int w, int h,
+                     int priority, int port) {
+	sosc_client_t *c;
+	int layer;
+
+	if( !state->rx_src || port < 1 || port > 65535 )
+		return -1;
+
+	if( (c = find_client(state)) )
+		free_client(state, c);
+
+	if( (layer = sosc_led_layer_add(&state->led, x, y, w, h, priority)) < 0 )
+		return -1;
+
+	c = &state->clients[layer - 1];
+
+	c->src = copy_addr(state->rx_src, state->rx_src_len);
+	c->src_len = state->rx_src_len;
+
+	c->dst = copy_addr(state->rx_src, state->rx_src_len);
+	c->dst_len = state->rx_src_len;
+	set_port(c->dst, port);
+
+	c->last_heard = sosc_event_loop_now();
+	state->nclients++;
+
+	/* the rest of this datagram draws into the new layer */
+	state->led.target = layer;
+	return 0;
+}
+
+/* back to wherever the datagram being handled came from. returns nonzero
+   if it couldn't be sent there, or if we don't know where that is. */
+int osc_client_reply(sosc_state_t *state, const char *path, lo_message m) {
+	size_t size;
+	void *data;
+	int ret;
+
+	if( !state->rx_src
+	    || !(data = lo_message_serialise(m, path, NULL, &size)) )
+		return 1;
+
+	ret = sendto(lo_server_get_socket_fd(state->server), data, size, 0,
+	             state->rx_src, state->rx_src_len) < 0;
+
+	free(data);
+	return ret;
+}
+
+void osc_client_release(sosc_state_t *state) {
+	sosc_client_t *c;
+
+	if( (c = find_client(state)) )
+		free_client(state, c);
+}
+
+/* frees the layers of everyone we've not heard from in timeout_ms, and
+   returns how many that was */
+int osc_client_expire(sosc_state_t *state, uint64_t now, uint64_t timeout_ms) {
+	sosc_client_t *c;
+	int i, n;
+
+	for( i = n = 0; i < SOSC_LED_MAX_LAYERS; i++ ) {
+		c = &state->clients[i];
+
+		if( c->src && now - c->last_heard >= timeout_ms ) {
+			free_client(state, c);
+			n++;
+		}
+	}
+
+	return n;
+}
+
+void osc_client_free_all(sosc_state_t *state) {
+	int i;
+
+	for( i = 0; i < SOSC_LED_MAX_LAYERS; i++ )
+		if( state->clients[i].src )
+			free_client(state, &state->clients[i]);
+}
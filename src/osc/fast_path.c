@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <arpa/inet.h>
+#else
+#include <winsock2.h>
+#endif
+
+#include <lo/lo.h>
+
+#include "serialosc.h"
+#include "osc.h"
+
+/* grid/led/level/map, the biggest message we handle here */
+#define MAX_ARGS 66
+
+/* returns a pointer just past the padding of the OSC string at p, or
+   NULL if it isn't terminated inside the packet. */
+static const char *skip_osc_string(const char *p, const char *end) {
+	const char *nul;
+
+	if( !(nul = memchr(p, '\0', end - p)) )
+		return NULL;
+
+	p += ((nul - p) + 4) & ~3;
+	return (p <= end) ? p : NULL;
+}
+
+/**
+ * decode an all-int32 message addressed to one of the hot mext paths
+ * straight out of the receive buffer and call its handler, without
+ * liblo allocating an lo_message or walking its method list.
+ *
+ * returns nonzero for anything we don't handle here (bundles, other
+ * typetags, /sys/ methods, patterns...), which the caller should then
+ * hand to liblo.
+ */
+int osc_dispatch_raw(sosc_state_t *state, const uint8_t *buf, size_t nbytes) {
+	const char *addr, *types, *args, *end, *prefix;
+	const osc_method_t *method;
+	lo_arg *argv[MAX_ARGS];
+	int32_t vals[MAX_ARGS];
+	size_t prefix_len;
+	uint32_t v;
+	int i, argc;
+
+	addr = (const char *) buf;
+	end = addr + nbytes;
+
+	if( nbytes < 8 || (nbytes & 3) || *addr != '/' )
+		return 1;
+
+	if( !(types = skip_osc_string(addr, end)) || types == end
+	    || *types != ',' )
+		return 1;
+
+	if( !(args = skip_osc_string(types, end)) )
+		return 1;
+
+	types++;
+	argc = strlen(types);
+
+	if( argc > MAX_ARGS || (end - args) != argc * 4
+	    || strspn(types, "i") != argc )
+		return 1;
+
+	prefix = state->config.app.osc_prefix;
+	prefix_len = strlen(prefix);
+
+	if( strncmp(addr, prefix, prefix_len) || addr[prefix_len] != '/' )
+		return 1;
+
+	if( !(method = osc_mext_lookup(addr + prefix_len + 1, types, argc)) )
+		return 1;
+
+	for( i = 0; i < argc; i++ ) {
+		memcpy(&v, args + (i * 4), sizeof(v));
+		vals[i] = ntohl(v);
+		argv[i] = (lo_arg *) &vals[i];
+	}
+
+	method->handler(addr, types, argv, argc, NULL, state);
+	return 0;
+}
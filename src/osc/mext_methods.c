@@ -16,12 +16,17 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <lo/lo.h>
 #include <monome.h>
 
 #include "serialosc.h"
 #include "osc.h"
+#include "led.h"
+#include "osc_method_hash.h"
+
+#define ARRAY_LENGTH(x) (sizeof(x) / sizeof(*x))
 
 static int coerce_arg_to_int(lo_type type, lo_arg *src)
 {
@@ -34,336 +39,606 @@ static int coerce_arg_to_int(lo_type type, lo_arg *src)
 	return 0;
 }
 
+/* the row and col methods take up to 34 arguments of any type coercible
+   to int32. nearly everyone sends plain ints though, and those need no
+   coercing at all, so check for that with one comparison first. */
+#define MAX_LINE_ARGS 34
+
+static const char all_ints[MAX_LINE_ARGS + 1] =
+	"iiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiiii";
+
+static int coerce_args_to_int(const char *types, lo_arg **argv, int argc)
+{
+	int i;
+
+	if (!memcmp(types, all_ints, argc))
+		return 0;
+
+	for (i = 0; i < argc; i++)
+		if (coerce_arg_to_int(types[i], argv[i]))
+			return -1; /* only integers are invited to this party */
+
+	return 0;
+}
+
+/* the grid handlers only draw into the LED framebuffer. what changed is
+   sent to the device at the end of the event loop iteration, or by the
+   refresh timer if there is one. cost is what the command would have
+   taken on the wire if we'd passed it straight through. */
+static int led_drawn(sosc_state_t *state, int cost) {
+	state->led.stats.requested_bytes += cost;
+	return 0;
+}
+
+/* a level map for every quad of the grid */
+static int grid_redraw_cost(const sosc_led_t *led) {
+	return SOSC_LED_COST_LEVEL_MAP
+		* ((led->cols + 7) / 8) * ((led->rows + 7) / 8);
+}
+
+/* on/off bitmasks, 8 LEDs to a byte with the lowest bit leftmost */
+static void unpack_bits(uint8_t *levels, int bits) {
+	int i;
+
+	for( i = 0; i < 8; i++ )
+		levels[i] = (bits & (1 << i)) ? SOSC_LED_MAX_LEVEL : 0;
+}
+
+/* liblo (and the fast path) lay a message's int arguments out back to
+   back, so a run of them can usually go through the vector kernel in one
+   go. anything else gets clamped one at a time. */
+static void args_to_levels(uint8_t *levels, lo_arg **argv, int n) {
+	int i;
+
+	if( (const char *) argv[n - 1] - (const char *) argv[0]
+	    == (ptrdiff_t) ((n - 1) * sizeof(int32_t)) ) {
+		sosc_led_kernels->narrow(levels, &argv[0]->i, n);
+		return;
+	}
+
+	for( i = 0; i < n; i++ ) {
+		if( argv[i]->i < 0 )
+			levels[i] = 0;
+		else if( argv[i]->i > SOSC_LED_MAX_LEVEL )
+			levels[i] = SOSC_LED_MAX_LEVEL;
+		else
+			levels[i] = argv[i]->i;
+	}
+}
+
+/* a blob of n levels, either a byte each or packed two to a byte with
+   the first in the high nibble. anything else is ignored. */
+static int blob_to_levels(uint8_t *levels, lo_arg *arg, int n) {
+	const uint8_t *data = lo_blob_dataptr((lo_blob) arg);
+	uint32_t size = lo_blob_datasize((lo_blob) arg);
+	int i;
+
+	if( size == n ) {
+		for( i = 0; i < n; i++ )
+			levels[i] = (data[i] > SOSC_LED_MAX_LEVEL)
+				? SOSC_LED_MAX_LEVEL : data[i];
+		return 0;
+	} else if( size == (n + 1) / 2 ) {
+		sosc_led_kernels->unpack(levels, data, n);
+		return 0;
+	}
+
+	return -1;
+}
+
 OSC_HANDLER_FUNC(led_set_handler) {
-	monome_t *monome = user_data;
-	return monome_led_set(monome, argv[0]->i, argv[1]->i, !!argv[2]->i);
+	sosc_state_t *state = user_data;
+
+	sosc_led_set(&state->led, argv[0]->i, argv[1]->i,
+	             argv[2]->i ? SOSC_LED_MAX_LEVEL : 0);
+	return led_drawn(state, SOSC_LED_COST_SET);
 }
 
 OSC_HANDLER_FUNC(led_all_handler) {
-	monome_t *monome = user_data;
-	return monome_led_all(monome, !!argv[0]->i);
+	sosc_state_t *state = user_data;
+
+	sosc_led_fill(&state->led, argv[0]->i ? SOSC_LED_MAX_LEVEL : 0);
+	return led_drawn(state, SOSC_LED_COST_ALL);
 }
 
 OSC_HANDLER_FUNC(led_map_handler) {
-	monome_t *monome = user_data;
-	uint8_t buf[8];
+	sosc_state_t *state = user_data;
+	uint8_t buf[64];
 	int i;
 
 	for( i = 0; i < 8; i++ )
-		buf[i] = argv[i + (argc - 8)]->i;
+		unpack_bits(&buf[i * 8], argv[i + (argc - 8)]->i);
 
-	return monome_led_map(monome, argv[0]->i, argv[1]->i, buf);
+	sosc_led_rect(&state->led, argv[0]->i & ~7, argv[1]->i & ~7, 8, 8, buf);
+	return led_drawn(state, SOSC_LED_COST_MAP);
 }
 
 OSC_HANDLER_FUNC(led_col_handler) {
-	monome_t *monome = user_data;
-	uint8_t buf[32];
+	sosc_state_t *state = user_data;
+	uint8_t buf[256];
 	int i;
 
-	if (argc < 3 || argc > 34)
+	if (argc < 3 || argc > MAX_LINE_ARGS)
 		return 1;
 
-	for (i = 0; i < argc; i++)
-		if (coerce_arg_to_int(types[i], argv[i]))
-			return 1; /* only integers are invited to this party */
+	if (coerce_args_to_int(types, argv, argc))
+		return 1;
 
 	for (i = 0; i < (argc - 2); i++)
-		buf[i] = argv[i + 2]->i;
+		unpack_bits(&buf[i * 8], argv[i + 2]->i);
 
-	return monome_led_col(monome, argv[0]->i, argv[1]->i, argc - 2, buf);
+	sosc_led_rect(&state->led, argv[0]->i, argv[1]->i & ~7,
+	              1, (argc - 2) * 8, buf);
+	return led_drawn(state, SOSC_LED_COST_ROW * (argc - 2));
 }
 
 OSC_HANDLER_FUNC(led_row_handler) {
-	monome_t *monome = user_data;
-	uint8_t buf[32];
+	sosc_state_t *state = user_data;
+	uint8_t buf[256];
 	int i;
 
-	if (argc < 3 || argc > 34)
+	if (argc < 3 || argc > MAX_LINE_ARGS)
 		return 1;
 
-	for (i = 0; i < argc; i++)
-		if (coerce_arg_to_int(types[i], argv[i]))
-			return 1;
+	if (coerce_args_to_int(types, argv, argc))
+		return 1;
 
 	for (i = 0; i < (argc - 2); i++)
-		buf[i] = argv[i + 2]->i;
+		unpack_bits(&buf[i * 8], argv[i + 2]->i);
 
-	return monome_led_row(monome, argv[0]->i, argv[1]->i, argc - 2, buf);
+	sosc_led_rect(&state->led, argv[0]->i & ~7, argv[1]->i,
+	              (argc - 2) * 8, 1, buf);
+	return led_drawn(state, SOSC_LED_COST_ROW * (argc - 2));
 }
 
 OSC_HANDLER_FUNC(led_intensity_handler) {
-	monome_t *monome = user_data;
+	monome_t *monome = ((sosc_state_t *) user_data)->monome;
 	return monome_led_intensity(monome, argv[0]->i);
 }
 
 // Owen added for Chronome color support
 OSC_HANDLER_FUNC(led_color_handler) {
-    monome_t *monome = user_data;
-	return monome_led_color(monome, argv[0]->i, argv[1]->i, argv[2]->i, argv[3]->i, argv[4]->i);
+	sosc_state_t *state = user_data;
+
+	sosc_led_color_set(&state->led, argv[0]->i, argv[1]->i,
+	                   argv[2]->i, argv[3]->i, argv[4]->i);
+	return led_drawn(state, SOSC_LED_COST_COLOR);
+}
+
+/* an 8x8 quad of r, g, b bytes, row by row */
+OSC_HANDLER_FUNC(led_color_map_handler) {
+	sosc_state_t *state = user_data;
+
+	if( lo_blob_datasize((lo_blob) argv[2]) != 64 * 3 )
+		return 1;
+
+	sosc_led_color_rect(&state->led, argv[0]->i & ~7, argv[1]->i & ~7, 8, 8,
+	                    lo_blob_dataptr((lo_blob) argv[2]));
+	return led_drawn(state, SOSC_LED_COST_COLOR * 64);
+}
+
+/* the whole grid, like grid/led/level/frame */
+OSC_HANDLER_FUNC(led_color_frame_handler) {
+	sosc_state_t *state = user_data;
+	sosc_led_t *led = &state->led;
+
+	if( !led->cols || !led->rows
+	    || lo_blob_datasize((lo_blob) argv[0]) != led->cols * led->rows * 3 )
+		return 1;
+
+	sosc_led_color_rect(led, 0, 0, led->cols, led->rows,
+	                    lo_blob_dataptr((lo_blob) argv[0]));
+	return led_drawn(state, SOSC_LED_COST_COLOR * led->cols * led->rows);
 }
 
 OSC_HANDLER_FUNC(led_level_set_handler) {
-	monome_t *monome = user_data;
-	return monome_led_level_set(monome, argv[0]->i, argv[1]->i, argv[2]->i);
+	sosc_state_t *state = user_data;
+
+	sosc_led_set(&state->led, argv[0]->i, argv[1]->i, argv[2]->i);
+	return led_drawn(state, SOSC_LED_COST_LEVEL_SET);
 }
 
 OSC_HANDLER_FUNC(led_level_all_handler) {
-	monome_t *monome = user_data;
-	return monome_led_level_all(monome, argv[0]->i);
+	sosc_state_t *state = user_data;
+
+	sosc_led_fill(&state->led, argv[0]->i);
+	return led_drawn(state, SOSC_LED_COST_LEVEL_ALL);
 }
 
 OSC_HANDLER_FUNC(led_level_map_handler) {
-	monome_t *monome = user_data;
+	sosc_state_t *state = user_data;
 	uint8_t buf[64];
-	int i;
 
-	for( i = 0; i < 64; i++ )
-		buf[i] = argv[i + (argc - 64)]->i;
+	args_to_levels(buf, argv + (argc - 64), 64);
 
-	return monome_led_level_map(monome, argv[0]->i, argv[1]->i, buf);
+	sosc_led_rect(&state->led, argv[0]->i & ~7, argv[1]->i & ~7, 8, 8, buf);
+	return led_drawn(state, SOSC_LED_COST_LEVEL_MAP);
 }
 
-OSC_HANDLER_FUNC(led_level_col_handler) {
-	monome_t *monome = user_data;
-	uint8_t buf[32];
-	int i;
+OSC_HANDLER_FUNC(led_level_map_blob_handler) {
+	sosc_state_t *state = user_data;
+	uint8_t buf[64];
 
-	if (argc < 3 || argc > 34)
+	if( blob_to_levels(buf, argv[2], 64) )
 		return 1;
 
-	for (i = 0; i < argc; i++)
-		if (coerce_arg_to_int(types[i], argv[i]))
-			return 1; /* only integers are invited to this party */
-
-	for (i = 0; i < (argc - 2); i++)
-		buf[i] = argv[i + 2]->i;
-
-	return monome_led_level_col(monome, argv[0]->i, argv[1]->i, argc - 2, buf);
+	sosc_led_rect(&state->led, argv[0]->i & ~7, argv[1]->i & ~7, 8, 8, buf);
+	return led_drawn(state, SOSC_LED_COST_LEVEL_MAP);
 }
 
-OSC_HANDLER_FUNC(led_level_row_handler) {
-	monome_t *monome = user_data;
-	uint8_t buf[32];
-	int i;
+/* the whole grid at once, row by row in the application's orientation,
+   as cols * rows ints or a blob. it's drawn in one go, so the next flush
+   sends all of it together instead of a quad at a time. */
+OSC_HANDLER_FUNC(led_level_frame_handler) {
+	sosc_state_t *state = user_data;
+	uint8_t buf[SOSC_LED_MAX_ROWS * SOSC_LED_MAX_COLS];
+	sosc_led_t *led = &state->led;
+	int i, n;
 
-	if (argc < 3 || argc > 34)
+	n = led->cols * led->rows;
+
+	if( !n )
 		return 1;
 
-	for (i = 0; i < argc; i++)
-		if (coerce_arg_to_int(types[i], argv[i]))
+	if( argc == 1 && types[0] == LO_BLOB ) {
+		if( blob_to_levels(buf, argv[0], n) )
+			return 1;
+	} else {
+		if( argc != n )
 			return 1;
 
-	for (i = 0; i < (argc - 2); i++)
-		buf[i] = argv[i + 2]->i;
+		for( i = 0; i < argc; i++ )
+			if( types[i] != LO_INT32 && coerce_arg_to_int(types[i], argv[i]) )
+				return 1;
 
-	return monome_led_level_row(monome, argv[0]->i, argv[1]->i, argc - 2, buf);
+		args_to_levels(buf, argv, n);
+	}
+
+	sosc_led_rect(led, 0, 0, led->cols, led->rows, buf);
+	return led_drawn(state, grid_redraw_cost(led));
 }
 
-OSC_HANDLER_FUNC(led_ring_set_handler) {
-	monome_t *monome = user_data;
+/* dx dy [level]. the cost is what redrawing the whole grid would have
+   been, since that's what an application had to do without this. */
+OSC_HANDLER_FUNC(led_level_shift_handler) {
+	sosc_state_t *state = user_data;
+	sosc_led_t *led = &state->led;
 
-	return monome_led_ring_set(monome, argv[0]->i, argv[1]->i, argv[2]->i);
+	sosc_led_shift(led, argv[0]->i, argv[1]->i, (argc > 2) ? argv[2]->i : 0);
+	return led_drawn(state, grid_redraw_cost(led));
 }
 
-OSC_HANDLER_FUNC(led_ring_all_handler) {
-	monome_t *monome = user_data;
+/**
+ * animations. everything takes x y w h first, in the same coordinates as
+ * the drawing methods, and a period in milliseconds last.
+ */
+
+static int start_anim(sosc_state_t *state, sosc_led_anim_t *anim,
+                      lo_arg **argv) {
+	if( !state->config.dev.led_anim_rate )
+		return 1;
+
+	anim->x = argv[0]->i;
+	anim->y = argv[1]->i;
+	anim->w = argv[2]->i;
+	anim->h = argv[3]->i;
+
+	if( sosc_led_anim_start(&state->anims, &state->led, anim,
+	                        sosc_event_loop_now()) )
+		return 1;
 
-	return monome_led_ring_all(monome, argv[0]->i, argv[1]->i);
+	sosc_led_anim_wake(state);
+	return 0;
 }
 
-OSC_HANDLER_FUNC(led_ring_map_handler) {
-	monome_t *monome = user_data;
-	uint8_t buf[64];
-	int i;
+/* x y w h level ms, from whatever the region shows now */
+OSC_HANDLER_FUNC(led_anim_fade_handler) {
+	sosc_led_anim_t anim = {
+		.type = SOSC_LED_ANIM_FADE,
+		.to = argv[4]->i,
+		.period_ms = (argv[5]->i > 0) ? argv[5]->i : 0
+	};
 
-	for( i = 0; i < 64; i++ )
-		buf[i] = argv[i + (argc - 64)]->i;
+	return start_anim(user_data, &anim, argv);
+}
 
-	return monome_led_ring_map(monome, argv[0]->i, buf);
+/* x y w h from to ms, for blink, pulse and ramp */
+static int start_periodic_anim(sosc_state_t *state, sosc_led_anim_type_t type,
+                               lo_arg **argv) {
+	sosc_led_anim_t anim = {
+		.type = type,
+		.from = argv[4]->i,
+		.to = argv[5]->i,
+		.period_ms = (argv[6]->i > 0) ? argv[6]->i : 0
+	};
+
+	return start_anim(state, &anim, argv);
 }
 
-OSC_HANDLER_FUNC(led_ring_range_handler) {
-	monome_t *monome = user_data;
+OSC_HANDLER_FUNC(led_anim_blink_handler) {
+	return start_periodic_anim(user_data, SOSC_LED_ANIM_BLINK, argv);
+}
 
-	return monome_led_ring_range(monome, argv[0]->i, argv[1]->i, argv[2]->i, argv[3]->i);
+OSC_HANDLER_FUNC(led_anim_pulse_handler) {
+	return start_periodic_anim(user_data, SOSC_LED_ANIM_PULSE, argv);
 }
 
-OSC_HANDLER_FUNC(tilt_set_handler) {
-	monome_t *monome = user_data;
+OSC_HANDLER_FUNC(led_anim_ramp_handler) {
+	return start_periodic_anim(user_data, SOSC_LED_ANIM_RAMP, argv);
+}
 
-	if( argv[1]->i )
-		return monome_tilt_enable(monome, argv[0]->i);
+/* x y w h stops whatever touches that rectangle, no arguments stops
+   everything. the LEDs stay as the animations left them. */
+OSC_HANDLER_FUNC(led_anim_stop_handler) {
+	sosc_state_t *state = user_data;
+
+	if( argc )
+		sosc_led_anim_stop(&state->anims, argv[0]->i, argv[1]->i,
+		                   argv[2]->i, argv[3]->i);
 	else
-		return monome_tilt_disable(monome, argv[0]->i);
+		sosc_led_anim_stop_all(&state->anims);
+
+	return 0;
 }
 
-#define METHOD(path) for( cmd_buf = osc_path(path, prefix); cmd_buf; \
-                          s_free(cmd_buf), cmd_buf = NULL )
+OSC_HANDLER_FUNC(led_level_col_handler) {
+	sosc_state_t *state = user_data;
+	uint8_t buf[32];
 
-void osc_register_methods(sosc_state_t *state) {
-	char *prefix, *cmd_buf;
-	monome_t *monome;
-	lo_server srv;
+	if (argc < 3 || argc > MAX_LINE_ARGS)
+		return 1;
 
-	prefix = state->config.app.osc_prefix;
-	monome = state->monome;
-	srv = state->server;
+	if (coerce_args_to_int(types, argv, argc))
+		return 1;
 
-#define REGISTER(typetags, cb) \
-	lo_server_add_method(srv, cmd_buf, typetags, cb, monome)
+	args_to_levels(buf, argv + 2, argc - 2);
 
-	METHOD("grid/led/set")
-		REGISTER("iii", led_set_handler);
+	sosc_led_rect(&state->led, argv[0]->i, argv[1]->i & ~7,
+	              1, argc - 2, buf);
+	return led_drawn(state, SOSC_LED_COST_LEVEL_ROW * ((argc + 5) / 8));
+}
 
-	METHOD("grid/led/all")
-		REGISTER("i", led_all_handler);
+OSC_HANDLER_FUNC(led_level_row_handler) {
+	sosc_state_t *state = user_data;
+	uint8_t buf[32];
 
-	METHOD("grid/led/map")
-		REGISTER("iiiiiiiiii", led_map_handler);
+	if (argc < 3 || argc > MAX_LINE_ARGS)
+		return 1;
 
-	METHOD("grid/led/col")
-		REGISTER(NULL, led_col_handler);
+	if (coerce_args_to_int(types, argv, argc))
+		return 1;
 
-	METHOD("grid/led/row")
-		REGISTER(NULL, led_row_handler);
+	args_to_levels(buf, argv + 2, argc - 2);
 
-	METHOD("grid/led/intensity")
-		REGISTER("i", led_intensity_handler);
-    
-    // Owen added for Chronome color support
-    METHOD("grid/led/color")
-        REGISTER("iiiii", led_color_handler);
+	sosc_led_rect(&state->led, argv[0]->i & ~7, argv[1]->i,
+	              argc - 2, 1, buf);
+	return led_drawn(state, SOSC_LED_COST_LEVEL_ROW * ((argc + 5) / 8));
+}
 
-	METHOD("grid/led/level/set")
-		REGISTER("iii", led_level_set_handler);
+OSC_HANDLER_FUNC(led_ring_set_handler) {
+	sosc_state_t *state = user_data;
 
-	METHOD("grid/led/level/all")
-		REGISTER("i", led_level_all_handler);
+	sosc_led_ring_set(&state->led, argv[0]->i, argv[1]->i, argv[2]->i);
+	return led_drawn(state, SOSC_LED_COST_RING_SET);
+}
 
-	METHOD("grid/led/level/map")
-		REGISTER("ii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii",
-		         led_level_map_handler);
+OSC_HANDLER_FUNC(led_ring_all_handler) {
+	sosc_state_t *state = user_data;
 
-	METHOD("grid/led/level/col")
-		REGISTER(NULL, led_level_col_handler);
+	sosc_led_ring_fill(&state->led, argv[0]->i, argv[1]->i);
+	return led_drawn(state, SOSC_LED_COST_RING_ALL);
+}
 
-	METHOD("grid/led/level/row")
-		REGISTER(NULL, led_level_row_handler);
+OSC_HANDLER_FUNC(led_ring_map_handler) {
+	sosc_state_t *state = user_data;
+	uint8_t buf[64];
 
-	METHOD("ring/set")
-		REGISTER("iii", led_ring_set_handler);
+	args_to_levels(buf, argv + (argc - 64), 64);
 
-	METHOD("ring/all")
-		REGISTER("ii", led_ring_all_handler);
+	sosc_led_ring_map(&state->led, argv[0]->i, buf);
+	return led_drawn(state, SOSC_LED_COST_RING_MAP);
+}
 
-	METHOD("ring/map")
-		REGISTER("i"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii"
-		         "iiiiiiii",
-		         led_ring_map_handler);
+OSC_HANDLER_FUNC(led_ring_map_blob_handler) {
+	sosc_state_t *state = user_data;
+	uint8_t buf[64];
+
+	if( blob_to_levels(buf, argv[1], 64) )
+		return 1;
+
+	sosc_led_ring_map(&state->led, argv[0]->i, buf);
+	return led_drawn(state, SOSC_LED_COST_RING_MAP);
+}
 
-	METHOD("ring/range")
-		REGISTER("iiii", led_ring_range_handler);
+OSC_HANDLER_FUNC(led_ring_range_handler) {
+	sosc_state_t *state = user_data;
+
+	sosc_led_ring_range(&state->led, argv[0]->i, argv[1]->i, argv[2]->i,
+	                    argv[3]->i);
+	return led_drawn(state, SOSC_LED_COST_RING_RANGE);
+}
 
-	METHOD("tilt/set")
-		REGISTER("ii", tilt_set_handler);
+OSC_HANDLER_FUNC(led_ring_rotate_handler) {
+	sosc_state_t *state = user_data;
 
-#undef REGISTER
+	sosc_led_ring_rotate(&state->led, argv[0]->i, argv[1]->i);
+	return led_drawn(state, SOSC_LED_COST_RING_MAP);
 }
 
-void osc_unregister_methods(sosc_state_t *state) {
-	char *prefix, *cmd_buf;
-	lo_server srv;
+/**
+ * reading back what's been drawn, so an application that restarts can
+ * pick up where it left off rather than redrawing everything blind. the
+ * reply is one message holding a blob of levels packed two to a byte,
+ * the same as the drawing methods take. like /sys/info replies, it goes
+ * to [host] port if they're given. otherwise it goes back to whoever
+ * asked, or to the application when we can't tell who that was (on
+ * windows, where liblo does the receiving).
+ */
+
+static int send_state(sosc_state_t *state, const char *path,
+                      lo_arg **argv, int argc, lo_message m) {
+	const char *host;
+	lo_address dst;
+	char port[6];
+	char *full;
+	int ret = 0;
+
+	full = osc_path(path, state->config.app.osc_prefix);
+
+	if( !argc ) {
+		if( state->rx_src )
+			ret = osc_client_reply(state, full, m);
+		else
+			lo_send_message_from(state->outgoing, state->server, full, m);
+	} else {
+		host = (argc == 2)
+			? &argv[0]->s : lo_address_get_hostname(state->outgoing);
+		snprintf(port, sizeof(port), "%d", argv[argc - 1]->i);
+
+		if( (dst = lo_address_new(host, port)) ) {
+			lo_send_message_from(dst, state->server, full, m);
+			lo_address_free(dst);
+		} else
+			ret = 1;
+	}
+
+	s_free(full);
+	return ret;
+}
+
+static int send_levels(sosc_state_t *state, const char *path,
+                       lo_arg **argv, int argc, int a, int b,
+                       const uint8_t *levels, int n) {
+	uint8_t packed[(SOSC_LED_MAX_ROWS * SOSC_LED_MAX_COLS) / 2];
+	lo_message m;
+	lo_blob blob;
+	int ret = 1;
+
+	sosc_led_kernels->pack(packed, levels, n);
+
+	if( !(m = lo_message_new()) )
+		return 1;
+
+	if( (blob = lo_blob_new((n + 1) / 2, packed)) ) {
+		lo_message_add_int32(m, a);
+		lo_message_add_int32(m, b);
+		lo_message_add_blob(m, blob);
+
+		ret = send_state(state, path, argv, argc, m);
+		lo_blob_free(blob);
+	}
 
-	prefix = state->config.app.osc_prefix;
-	srv = state->server;
+	lo_message_free(m);
+	return ret;
+}
 
-#define UNREGISTER(typetags) \
-	lo_server_del_method(srv, cmd_buf, typetags)
+/* replies with cols rows and the levels row by row, which can be sent
+   straight back to grid/led/level/frame */
+OSC_HANDLER_FUNC(led_level_state_handler) {
+	sosc_state_t *state = user_data;
+	uint8_t buf[SOSC_LED_MAX_ROWS * SOSC_LED_MAX_COLS];
+	sosc_led_t *led = &state->led;
+	int y;
 
-	METHOD("grid/led/set")
-		UNREGISTER("iii");
+	if( !led->cols || !led->rows )
+		return 1;
 
-	METHOD("grid/led/all")
-		UNREGISTER("i");
+	for( y = 0; y < led->rows; y++ )
+		memcpy(&buf[y * led->cols], led->layers[led->target].level[y],
+		       led->cols);
 
-	METHOD("grid/led/map")
-		UNREGISTER("iiiiiiiiii");
+	return send_levels(state, "grid/led/level/state", argv, argc,
+	                   led->cols, led->rows, buf, led->cols * led->rows);
+}
 
-	METHOD("grid/led/col")
-		UNREGISTER(NULL);
+/* every ring, since we can't tell how many encoders there are. replies
+   with the number of rings and LEDs per ring, then the levels. */
+OSC_HANDLER_FUNC(led_ring_state_handler) {
+	sosc_state_t *state = user_data;
 
-	METHOD("grid/led/row")
-		UNREGISTER(NULL);
+	return send_levels(state, "ring/state", argv, argc,
+	                   SOSC_LED_MAX_RINGS, SOSC_LED_RING_SIZE,
+	                   &state->led.ring[0][0],
+	                   SOSC_LED_MAX_RINGS * SOSC_LED_RING_SIZE);
+}
 
-	METHOD("grid/led/intensity")
-		UNREGISTER("i");
-    
-    // Owen added for Chronome color support
-    METHOD("grid/led/color")
-        UNREGISTER("iiiii");
-    
-	METHOD("grid/led/level/set")
-		UNREGISTER("iii");
+OSC_HANDLER_FUNC(tilt_set_handler) {
+	monome_t *monome = ((sosc_state_t *) user_data)->monome;
 
-	METHOD("grid/led/level/all")
-		UNREGISTER("i");
+	if( argv[1]->i )
+		return monome_tilt_enable(monome, argv[0]->i);
+	else
+		return monome_tilt_disable(monome, argv[0]->i);
+}
 
-	METHOD("grid/led/level/map")
-		UNREGISTER("ii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii");
+static const osc_method_t mext_methods[] = {
+#define MEXT_METHOD(path, types, handler) \
+	{path, types, sizeof(types) - 1, handler},
+#define MEXT_METHOD_VARARGS(path, handler) \
+	{path, NULL, 0, handler},
+#define SYS_METHOD(path, types, handler)
 
-	METHOD("grid/led/level/col")
-		UNREGISTER(NULL);
+#include "methods.def"
 
-	METHOD("grid/led/level/row")
-		UNREGISTER(NULL);
+#undef SYS_METHOD
+#undef MEXT_METHOD_VARARGS
+#undef MEXT_METHOD
+};
 
-	METHOD("ring/set")
-		UNREGISTER("iii");
+/* has to match gen_method_hash() in src/wscript */
+static uint32_t method_hash(const char *path) {
+	uint32_t h = 2166136261u ^ OSC_METHOD_HASH_SEED;
 
-	METHOD("ring/all")
-		UNREGISTER("ii");
+	while( *path ) {
+		h ^= (uint8_t) *path++;
+		h *= 16777619u;
+	}
 
-	METHOD("ring/map")
-		UNREGISTER("i"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii"
-		           "iiiiiiii");
+	return h;
+}
+
+/* find the method for an (unprefixed) path and a typetag string of argc
+   int32s. one hash, one strcmp, and a memcmp per typetag variant. */
+const osc_method_t *osc_mext_lookup(const char *path, const char *types,
+                                    int argc) {
+	const osc_method_t *m, *end;
+	const int8_t *slot;
+
+	slot = osc_method_hash_slots[method_hash(path) & OSC_METHOD_HASH_MASK];
 
-	METHOD("ring/range")
-		UNREGISTER("iiii");
+	if( slot[0] < 0 || strcmp(mext_methods[slot[0]].path, path) )
+		return NULL;
 
-	METHOD("tilt/set")
-		UNREGISTER("ii");
+	m = &mext_methods[slot[0]];
+	end = m + slot[1];
 
-#undef UNREGISTER
+	for( ; m < end; m++ )
+		if( !m->types
+		    || (m->types_len == argc && !memcmp(m->types, types, argc)) )
+			return m;
+
+	return NULL;
 }
 
-#undef METHOD
+void osc_register_methods(sosc_state_t *state) {
+	const osc_method_t *m;
+	char *cmd_buf;
+
+	for( m = mext_methods; m < mext_methods + ARRAY_LENGTH(mext_methods); m++ ) {
+		cmd_buf = osc_path(m->path, state->config.app.osc_prefix);
+		lo_server_add_method(state->server, cmd_buf, m->types,
+		                     m->handler, state);
+		s_free(cmd_buf);
+	}
+}
+
+void osc_unregister_methods(sosc_state_t *state) {
+	const osc_method_t *m;
+	char *cmd_buf;
+
+	for( m = mext_methods; m < mext_methods + ARRAY_LENGTH(mext_methods); m++ ) {
+		cmd_buf = osc_path(m->path, state->config.app.osc_prefix);
+		lo_server_del_method(state->server, cmd_buf, m->types);
+		s_free(cmd_buf);
+	}
+}
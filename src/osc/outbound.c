@@ -0,0 +1,207 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* for getaddrinfo() under -std=c99 */
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#else
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+#include <lo/lo.h>
+
+#include "serialosc.h"
+#include "osc.h"
+
+/**
+ * every device event we forward has a fixed shape: a prefixed path and
+ * two to four int32s. rather than going through osc_path() and liblo
+ * (two heap round trips and a fresh lo_message per key press), we lay
+ * each packet out once when the prefix changes and then just store the
+ * arguments into it.
+ */
+
+static const struct {
+	const char *path;
+	int argc;
+} outbound_msgs[SOSC_OUTBOUND_MSG_COUNT] = {
+	[SOSC_OUTBOUND_GRID_KEY]      = {"grid/key",      3},
+	[SOSC_OUTBOUND_GRID_PRESSURE] = {"grid/pressure", 3},
+	[SOSC_OUTBOUND_ENC_DELTA]     = {"enc/delta",     2},
+	[SOSC_OUTBOUND_ENC_KEY]       = {"enc/key",       2},
+	[SOSC_OUTBOUND_TILT]          = {"tilt",          4}
+};
+
+/* OSC strings are NUL-terminated and padded out to a multiple of 4 */
+static size_t osc_strsize(size_t len) {
+	return (len + 4) & ~3;
+}
+
+static void build_msg(sosc_outbound_msg_t *msg, const char *prefix,
+                      const char *path, int argc) {
+	size_t path_len, addr_size, tt_size;
+	char *p;
+
+	path_len  = strlen(prefix) + 1 + strlen(path);
+	addr_size = osc_strsize(path_len);
+	tt_size   = osc_strsize(argc + 1);
+
+	msg->nbytes = addr_size + tt_size + (argc * sizeof(int32_t));
+
+	if( !(msg->packet = s_calloc(1, msg->nbytes)) ) {
+		fprintf(stderr, "aieee, could not allocate memory in "
+				"build_msg(), bailing out!\n");
+
+		/* in a child process, use _exit() instead of exit() */
+		_exit(EXIT_FAILURE);
+	}
+
+	p = (char *) msg->packet;
+	snprintf(p, path_len + 1, "%s/%s", prefix, path);
+
+	p += addr_size;
+	*p = ',';
+	memset(p + 1, 'i', argc);
+
+	msg->argv = (int32_t *) (p + tt_size);
+	msg->argc = argc;
+}
+
+static void free_msgs(sosc_outbound_t *out) {
+	int i;
+
+	for( i = 0; i < SOSC_OUTBOUND_MSG_COUNT; i++ ) {
+		s_free(out->msgs[i].packet);
+		out->msgs[i].packet = NULL;
+	}
+}
+
+void osc_outbound_set_prefix(sosc_state_t *state) {
+	sosc_outbound_t *out = &state->outbound;
+	int i;
+
+	free_msgs(out);
+
+	for( i = 0; i < SOSC_OUTBOUND_MSG_COUNT; i++ )
+		build_msg(&out->msgs[i], state->config.app.osc_prefix,
+		          outbound_msgs[i].path, outbound_msgs[i].argc);
+}
+
+int osc_outbound_set_destination(sosc_state_t *state) {
+	sosc_outbound_t *out = &state->outbound;
+	struct sockaddr_storage local;
+	struct addrinfo hints, *ai;
+	socklen_t local_len;
+
+	s_free(out->dst);
+	out->dst = NULL;
+	out->dst_len = 0;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_DGRAM;
+
+	/* resolve for whichever address family liblo bound the server
+	   socket to, since that's the socket we send from. */
+	local_len = sizeof(local);
+	if( !getsockname(lo_server_get_socket_fd(state->server),
+	                 (struct sockaddr *) &local, &local_len) )
+		hints.ai_family = local.ss_family;
+
+#ifdef AI_V4MAPPED
+	if( hints.ai_family == AF_INET6 )
+		hints.ai_flags = AI_V4MAPPED;
+#endif
+
+	if( getaddrinfo(lo_address_get_hostname(state->outgoing),
+	                lo_address_get_port(state->outgoing), &hints, &ai) )
+		return 1;
+
+	if( (out->dst = s_malloc(ai->ai_addrlen)) ) {
+		memcpy(out->dst, ai->ai_addr, ai->ai_addrlen);
+		out->dst_len = ai->ai_addrlen;
+	}
+
+	freeaddrinfo(ai);
+	return !out->dst;
+}
+
+void osc_outbound_free(sosc_state_t *state) {
+	free_msgs(&state->outbound);
+
+	s_free(state->outbound.dst);
+	state->outbound.dst = NULL;
+	state->outbound.dst_len = 0;
+}
+
+static void send_through_liblo(sosc_state_t *state, sosc_outbound_msg_t *msg,
+                               const int32_t *argv) {
+	lo_message m;
+	int i;
+
+	if( !(m = lo_message_new()) )
+		return;
+
+	for( i = 0; i < msg->argc; i++ )
+		lo_message_add_int32(m, argv[i]);
+
+	lo_send_message_from(state->outgoing, state->server,
+	                     (const char *) msg->packet, m);
+	lo_message_free(m);
+}
+
+static int send_packet(sosc_state_t *state, sosc_outbound_msg_t *msg,
+                       const int32_t *argv, const struct sockaddr *dst,
+                       int dst_len) {
+	int i;
+
+	for( i = 0; i < msg->argc; i++ )
+		msg->argv[i] = htonl(argv[i]);
+
+	return sendto(lo_server_get_socket_fd(state->server),
+	              (const char *) msg->packet, msg->nbytes, 0,
+	              dst, dst_len) < 0;
+}
+
+void osc_outbound_send(sosc_state_t *state, sosc_outbound_msg_type_t type,
+                       const int32_t *argv) {
+	sosc_outbound_t *out = &state->outbound;
+	sosc_outbound_msg_t *msg = &out->msgs[type];
+
+	if( out->dst_len
+	    && !send_packet(state, msg, argv, out->dst, out->dst_len) )
+		return;
+
+	send_through_liblo(state, msg, argv);
+}
+
+/* for applications with a layer of their own, which we only ever know by
+   a resolved address */
+void osc_outbound_send_to(sosc_state_t *state, sosc_outbound_msg_type_t type,
+                          const int32_t *argv, const struct sockaddr *dst,
+                          int dst_len) {
+	send_packet(state, &state->outbound.msgs[type], argv, dst, dst_len);
+}
@@ -0,0 +1,329 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/* for getaddrinfo() under -std=c99 */
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#else
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+#include <monome.h>
+
+#include "serialosc.h"
+#include "osc.h"
+
+/**
+ * what gets through to the OSC parser. every datagram is checked against
+ * the host it came from before anything looks inside it:
+ *
+ *   - if there's an allowlist, hosts that aren't on it are refused,
+ *     before they're given an entry of their own
+ *   - otherwise each host gets a token bucket per class of message,
+ *     holding up to a second's worth, and whatever's over is dropped
+ *
+ * once every entry is taken, a new host takes over the one heard from
+ * longest ago, and from then on shares one set of buckets with every
+ * other host that came in that way. a fresh bucket for each newcomer
+ * would let anyone sending from more addresses than there are entries
+ * get around the limit.
+ *
+ * a message's class comes from the first few bytes of its address, so
+ * it costs next to nothing to work out. a bundle is walked, and costs a
+ * token for every message in it, of that message's class; it goes
+ * through whole if there are tokens for all of them and is dropped
+ * otherwise. hosts are told apart by IP address alone, so all
+ * of one workstation's patches share its budget, and that workstation
+ * can't use up anyone else's.
+ *
+ * on windows liblo does the receiving, so none of this happens there.
+ */
+
+/* tokens are kept in thousandths, so a rate in messages a second refills
+   rate of them every millisecond */
+#define TOKEN 1000
+
+/* bundles inside bundles any deeper than this are charged as one LED
+   message without looking inside */
+#define MAX_BUNDLE_DEPTH 8
+
+static const uint8_t v4mapped[12] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+
+/* IPv4 addresses are kept as IPv4-mapped IPv6 ones, so that the same
+   host matches whichever way the server socket sees it */
+static void addr_key(uint8_t *key, const struct sockaddr *addr) {
+	switch( addr->sa_family ) {
+	case AF_INET:
+		memcpy(key, v4mapped, sizeof(v4mapped));
+		memcpy(key + 12, &((const struct sockaddr_in *) addr)->sin_addr, 4);
+		break;
+
+	case AF_INET6:
+		memcpy(key, &((const struct sockaddr_in6 *) addr)->sin6_addr, 16);
+		break;
+
+	default:
+		memset(key, 0, SOSC_RX_ADDR_SIZE);
+		break;
+	}
+}
+
+static void allow_host(sosc_rx_filter_t *f, const char *host) {
+	struct addrinfo hints, *ai, *p;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_DGRAM;
+
+	if( getaddrinfo(host, NULL, &hints, &ai) ) {
+		fprintf(stderr, "serialosc: couldn't resolve allowed host \"%s\"\n",
+		        host);
+		return;
+	}
+
+	for( p = ai; p && f->nallow < SOSC_RX_MAX_ALLOW; p = p->ai_next )
+		addr_key(f->allow[f->nallow++], p->ai_addr);
+
+	freeaddrinfo(ai);
+}
+
+void osc_rx_filter_init(sosc_state_t *state) {
+	sosc_rx_filter_t *f = &state->rx_filter;
+	int i;
+
+	memset(f, 0, sizeof(*f));
+
+	f->rate[SOSC_RX_LED] = state->config.server.led_rate;
+	f->rate[SOSC_RX_SYS] = state->config.server.sys_rate;
+
+	/* an allowlist that doesn't resolve to anything lets nobody in */
+	f->allowlist = state->config.server.nallow > 0;
+
+	for( i = 0; i < state->config.server.nallow; i++ )
+		allow_host(f, state->config.server.allow[i]);
+
+	f->active = f->allowlist
+		|| f->rate[SOSC_RX_LED] || f->rate[SOSC_RX_SYS];
+
+	for( i = 0; i < SOSC_RX_CLASS_COUNT; i++ )
+		f->forgotten.tokens[i] = (uint64_t) f->rate[i] * TOKEN;
+}
+
+static int allowed(const sosc_rx_filter_t *f, const uint8_t *key) {
+	int i;
+
+	if( !f->allowlist )
+		return 1;
+
+	for( i = 0; i < f->nallow; i++ )
+		if( !memcmp(f->allow[i], key, SOSC_RX_ADDR_SIZE) )
+			return 1;
+
+	return 0;
+}
+
+/* the host's entry, taking over whichever was heard from longest ago if
+   they're all in use. that one's counts go into the totals, and the new
+   host gets the shared tokens rather than a full set of its own. */
+static sosc_rx_source_t *find_source(sosc_rx_filter_t *f,
+                                     const uint8_t *key, uint64_t now) {
+	sosc_rx_source_t *s, *oldest = NULL;
+	int i, shared;
+
+	for( i = 0; i < SOSC_RX_MAX_SOURCES; i++ ) {
+		s = &f->sources[i];
+
+		if( s->in_use && !memcmp(s->addr, key, SOSC_RX_ADDR_SIZE) )
+			return s;
+
+		if( !oldest || !s->in_use
+		    || (oldest->in_use && s->last_ms < oldest->last_ms) )
+			oldest = s;
+	}
+
+	s = oldest;
+	shared = s->in_use;
+
+	if( shared ) {
+		f->forgotten.accepted += s->accepted;
+
+		for( i = 0; i < SOSC_RX_CLASS_COUNT; i++ )
+			f->forgotten.dropped[i] += s->dropped[i];
+	}
+
+	memset(s, 0, sizeof(*s));
+	memcpy(s->addr, key, SOSC_RX_ADDR_SIZE);
+
+	s->in_use  = 1;
+	s->shared  = shared;
+	s->last_ms = now;
+
+	for( i = 0; i < SOSC_RX_CLASS_COUNT; i++ )
+		s->tokens[i] = (uint64_t) f->rate[i] * TOKEN;
+
+	return s;
+}
+
+/* adds up the messages of each class in a packet: one for a message,
+   and everything inside it for a bundle. an element that runs off the
+   end stops the walk, as the parser will turn the bundle down anyway. */
+static void classify(const uint8_t *buf, size_t len, int depth,
+                     unsigned *count) {
+	uint32_t size;
+	size_t at;
+
+	if( len >= 5 && !memcmp(buf, "/sys/", 5) ) {
+		count[SOSC_RX_SYS]++;
+		return;
+	}
+
+	/* the application prefix, or something the parser will turn down */
+	if( len < 16 || memcmp(buf, "#bundle", 8)
+	    || depth >= MAX_BUNDLE_DEPTH ) {
+		count[SOSC_RX_LED]++;
+		return;
+	}
+
+	/* "#bundle\0" and a timetag, then each element after its size */
+	for( at = 16; len - at >= 4; at += size ) {
+		memcpy(&size, buf + at, sizeof(size));
+		size = ntohl(size);
+		at += 4;
+
+		if( size > len - at )
+			return;
+
+		classify(buf + at, size, depth + 1, count);
+	}
+}
+
+int osc_rx_filter(sosc_state_t *state, const struct sockaddr *src,
+                  const uint8_t *buf, size_t len, uint64_t now) {
+	sosc_rx_filter_t *f = &state->rx_filter;
+	unsigned count[SOSC_RX_CLASS_COUNT] = {0};
+	uint8_t key[SOSC_RX_ADDR_SIZE];
+	sosc_rx_source_t *s, *bucket;
+	uint64_t full, elapsed;
+	int i, over;
+
+	if( !f->active )
+		return 0;
+
+	addr_key(key, src);
+
+	/* before it gets an entry, so a host that isn't allowed can't push
+	   out one that is */
+	if( !allowed(f, key) ) {
+		f->refused++;
+		return 1;
+	}
+
+	s = find_source(f, key, now);
+
+	/* just an allowlist, with nothing to count */
+	if( !f->rate[SOSC_RX_LED] && !f->rate[SOSC_RX_SYS] ) {
+		s->last_ms = now;
+		s->accepted++;
+		return 0;
+	}
+
+	bucket = s->shared ? &f->forgotten : s;
+
+	elapsed = now - bucket->last_ms;
+	bucket->last_ms = now;
+	s->last_ms = now;
+
+	for( i = 0; i < SOSC_RX_CLASS_COUNT; i++ ) {
+		full = (uint64_t) f->rate[i] * TOKEN;
+		bucket->tokens[i] += elapsed * f->rate[i];
+
+		if( bucket->tokens[i] > full )
+			bucket->tokens[i] = full;
+	}
+
+	classify(buf, len, 0, count);
+
+	/* an empty bundle still costs something */
+	if( !count[SOSC_RX_LED] && !count[SOSC_RX_SYS] )
+		count[SOSC_RX_LED] = 1;
+
+	for( i = over = 0; i < SOSC_RX_CLASS_COUNT; i++ )
+		if( f->rate[i] && bucket->tokens[i] < (uint64_t) count[i] * TOKEN ) {
+			s->dropped[i]++;
+			over = 1;
+		}
+
+	if( over )
+		return 1;
+
+	for( i = 0; i < SOSC_RX_CLASS_COUNT; i++ )
+		if( f->rate[i] )
+			bucket->tokens[i] -= (uint64_t) count[i] * TOKEN;
+
+	s->accepted++;
+	return 0;
+}
+
+static void print_source(const char *serial, const char *who,
+                         const sosc_rx_source_t *s) {
+	if( !s->dropped[SOSC_RX_LED] && !s->dropped[SOSC_RX_SYS] )
+		return;
+
+	fprintf(stderr, "serialosc [%s]: %s: %lu osc messages accepted, "
+	        "%lu with LED and %lu with sys messages over the limit\n",
+	        serial, who, s->accepted,
+	        s->dropped[SOSC_RX_LED], s->dropped[SOSC_RX_SYS]);
+}
+
+void osc_rx_filter_print_stats(sosc_state_t *state) {
+	const char *serial = monome_get_serial(state->monome);
+	sosc_rx_filter_t *f = &state->rx_filter;
+	char who[INET6_ADDRSTRLEN];
+	sosc_rx_source_t *s;
+	int i;
+
+	for( i = 0; i < SOSC_RX_MAX_SOURCES; i++ ) {
+		s = &f->sources[i];
+
+		if( !s->in_use )
+			continue;
+
+		if( !memcmp(s->addr, v4mapped, sizeof(v4mapped)) )
+			inet_ntop(AF_INET, s->addr + 12, who, sizeof(who));
+		else
+			inet_ntop(AF_INET6, s->addr, who, sizeof(who));
+
+		print_source(serial, who, s);
+	}
+
+	print_source(serial, "other hosts", &f->forgotten);
+
+	if( f->refused )
+		fprintf(stderr, "serialosc [%s]: %lu osc messages refused from hosts "
+		        "not on the allowlist\n", serial, f->refused);
+}
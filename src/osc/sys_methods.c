@@ -23,6 +23,7 @@
 #include "serialosc.h"
 #include "osc.h"
 
+#define ARRAY_LENGTH(x) (sizeof(x) / sizeof(*x))
 
 /**
  * utils
@@ -163,6 +164,7 @@ OSC_HANDLER_FUNC(sys_cable_legacy_handler) {
 		return 0;
 
 	monome_set_rotation(state->monome, new);
+	sosc_led_invalidate(&state->led, state->monome);
 	info_reply_rotation(state->outgoing, state);
 	return 0;
 }
@@ -178,10 +180,86 @@ OSC_HANDLER_FUNC(sys_rotation_handler) {
 		return 0;
 
 	monome_set_rotation(state->monome, new);
+	sosc_led_invalidate(&state->led, state->monome);
 	info_reply_rotation(state->outgoing, state);
 	return 0;
 }
 
+static void echo_reply(lo_address *to, sosc_state_t *state) {
+	lo_send_from(to, state->server, LO_TT_IMMEDIATE, "/sys/echo", "si",
+	             sosc_echo_mode_name(state->config.dev.echo),
+	             state->config.dev.echo_level);
+}
+
+/* mode [level], or nothing to just ask */
+OSC_HANDLER_FUNC(sys_echo_handler) {
+	sosc_state_t *state = user_data;
+	sosc_echo_mode_t mode;
+
+	if( argc ) {
+		if( sosc_echo_mode_parse(&argv[0]->s, &mode) )
+			return 1;
+
+		state->config.dev.echo = mode;
+
+		if( argc > 1 && argv[1]->i >= 1 && argv[1]->i <= SOSC_LED_MAX_LEVEL )
+			state->config.dev.echo_level = argv[1]->i;
+	}
+
+	echo_reply(state->outgoing, state);
+	return 0;
+}
+
+/* LED feedback rules, as text like in the config file. they're compiled
+   here and never looked at as text again. */
+OSC_HANDLER_FUNC(sys_rules_add_handler) {
+	sosc_state_t *state = user_data;
+	sosc_led_rule_t rule;
+
+	if( sosc_led_rule_parse(&rule, &argv[0]->s) )
+		return 1;
+
+	return !!sosc_led_rules_add(&state->config.dev.rules, &rule);
+}
+
+OSC_HANDLER_FUNC(sys_rules_clear_handler) {
+	sosc_state_t *state = user_data;
+
+	state->config.dev.rules.count = 0;
+	return 0;
+}
+
+/* x y w h priority port: the part of the grid this application wants to
+   itself, and the port it takes its key presses on. priority goes from 0
+   to SOSC_LED_MAX_PRIORITY. */
+OSC_HANDLER_FUNC(sys_layer_handler) {
+	int x = argv[0]->i, y = argv[1]->i, w = argv[2]->i, h = argv[3]->i;
+	int priority = argv[4]->i;
+
+	if( priority < 0 || priority > SOSC_LED_MAX_PRIORITY )
+		return 1;
+
+	/* an empty area, or one that starts off the biggest grid there is,
+	   would never show anything. the size is cut down to fit, which also
+	   keeps x + w and y + h from overflowing. */
+	if( w < 1 || h < 1 || x < 0 || y < 0
+	    || x >= SOSC_LED_MAX_COLS || y >= SOSC_LED_MAX_ROWS )
+		return 1;
+
+	if( w > SOSC_LED_MAX_COLS - x )
+		w = SOSC_LED_MAX_COLS - x;
+
+	if( h > SOSC_LED_MAX_ROWS - y )
+		h = SOSC_LED_MAX_ROWS - y;
+
+	return !!osc_client_claim(user_data, x, y, w, h, priority, argv[5]->i);
+}
+
+OSC_HANDLER_FUNC(sys_layer_release_handler) {
+	osc_client_release(user_data);
+	return 0;
+}
+
 OSC_HANDLER_FUNC(sys_port_handler) {
 	sosc_state_t *state = user_data;
 	lo_address *new, *old = state->outgoing;
@@ -195,6 +273,7 @@ OSC_HANDLER_FUNC(sys_port_handler) {
 	}
 
 	state->outgoing = new;
+	osc_outbound_set_destination(state);
 
 	info_reply_port(old, state);
 	info_reply_port(new, state);
@@ -214,6 +293,7 @@ OSC_HANDLER_FUNC(sys_host_handler) {
 	}
 
 	state->outgoing = new;
+	osc_outbound_set_destination(state);
 
 	info_reply_host(old, state);
 	info_reply_host(new, state);
@@ -236,6 +316,7 @@ OSC_HANDLER_FUNC(sys_prefix_handler) {
 	osc_unregister_methods(state);
 	state->config.app.osc_prefix = new;
 	osc_register_methods(state);
+	osc_outbound_set_prefix(state);
 
 	info_reply_prefix(state->outgoing, state);
 
@@ -244,47 +325,23 @@ OSC_HANDLER_FUNC(sys_prefix_handler) {
 	return 0;
 }
 
-void osc_register_sys_methods(sosc_state_t *state) {
-	char *cmd;
-
-#define METHOD(path) for( cmd = "/sys/" path; cmd; cmd = NULL )
-#define REGISTER(types, handler, context) \
-	lo_server_add_method(state->server, cmd, types, handler, context)
-#define REGISTER_INFO_PROP(prop) do {\
-	METHOD("info/" #prop) {\
-		REGISTER("si", sys_info_##prop##_handler, state);\
-		REGISTER("i", sys_info_##prop##_handler, state);\
-		REGISTER("", sys_info_##prop##_handler_default, state);\
-	} } while ( 0 )
-
-	REGISTER_INFO_PROP(id);
-	REGISTER_INFO_PROP(size);
-	REGISTER_INFO_PROP(host);
-	REGISTER_INFO_PROP(port);
-	REGISTER_INFO_PROP(prefix);
-	REGISTER_INFO_PROP(rotation);
-
-	METHOD("info") {
-		REGISTER("si", sys_info_handler, state);
-		REGISTER("i", sys_info_handler, state);
-		REGISTER("", sys_info_handler_default, state);
-	}
-
-	METHOD("cable")
-		REGISTER("s", sys_cable_legacy_handler, state);
+static const osc_method_t sys_methods[] = {
+#define MEXT_METHOD(path, types, handler)
+#define MEXT_METHOD_VARARGS(path, handler)
+#define SYS_METHOD(path, types, handler) \
+	{"/" path, types, sizeof(types) - 1, handler},
 
-	METHOD("rotation")
-		REGISTER("i", sys_rotation_handler, state);
+#include "methods.def"
 
-	METHOD("port")
-		REGISTER("i", sys_port_handler, state);
+#undef SYS_METHOD
+#undef MEXT_METHOD_VARARGS
+#undef MEXT_METHOD
+};
 
-	METHOD("host")
-		REGISTER("s", sys_host_handler, state);
-
-	METHOD("prefix")
-		REGISTER("s", sys_prefix_handler, state);
+void osc_register_sys_methods(sosc_state_t *state) {
+	const osc_method_t *m;
 
-#undef REGISTER
-#undef METHOD
+	for( m = sys_methods; m < sys_methods + ARRAY_LENGTH(sys_methods); m++ )
+		lo_server_add_method(state->server, m->path, m->types,
+		                     m->handler, state);
 }
@@ -0,0 +1,128 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SOSC_EVENT_LOOP_H
+#define SOSC_EVENT_LOOP_H
+
+#include <stdint.h>
+
+#define SOSC_EVENT_LOOP_MAX_WATCHES 16
+
+typedef enum {
+	SOSC_EVENT_READ  = 0x1,
+	SOSC_EVENT_WRITE = 0x2,
+	SOSC_EVENT_ERROR = 0x4
+} sosc_event_flags_t;
+
+/* callbacks return nonzero to stop the event loop, which then returns
+   that value to whoever is running it. */
+typedef int (sosc_fd_cb_t)(int fd, int events, void *data);
+typedef int (sosc_timer_cb_t)(void *data);
+typedef int (sosc_iteration_cb_t)(void *data);
+
+typedef struct {
+	int in_use;
+
+	/* the loop iteration the watch was added in. events the backend
+	   collected during that iteration were for whatever had the slot
+	   before, so they're not delivered. */
+	unsigned long added;
+
+	/* for timers this is -1, or a timerfd on backends that use them */
+	int fd;
+	int events;
+	sosc_fd_cb_t *fd_cb;
+
+	sosc_timer_cb_t *timer_cb;
+	unsigned int interval_ms;
+	uint64_t deadline;
+
+	void *data;
+} sosc_watch_t;
+
+struct sosc_event_backend;
+
+typedef struct {
+	const struct sosc_event_backend *backend;
+	int backend_fd;
+	void *backend_data;
+
+	sosc_watch_t watches[SOSC_EVENT_LOOP_MAX_WATCHES];
+	unsigned long iterations;
+
+	/* called once every callback for an iteration has run */
+	sosc_iteration_cb_t *iteration_end_cb;
+	void *iteration_end_data;
+} sosc_event_loop_t;
+
+/* a backend only needs to fill in the functions it cares about.
+   add() and modify() are called after the watch has been filled in. */
+typedef struct sosc_event_backend {
+	const char *name;
+
+	int  (*init)(sosc_event_loop_t *loop);
+	void (*fini)(sosc_event_loop_t *loop);
+
+	int  (*add)(sosc_event_loop_t *loop, int watch);
+	int  (*modify)(sosc_event_loop_t *loop, int watch);
+	void (*remove)(sosc_event_loop_t *loop, int watch);
+
+	void (*rearm)(sosc_event_loop_t *loop, int watch);
+
+	int  (*run)(sosc_event_loop_t *loop);
+} sosc_event_backend_t;
+
+/* src/event_loop/common.c */
+int  sosc_event_loop_init(sosc_event_loop_t *loop);
+int  sosc_event_loop_init_backend(sosc_event_loop_t *loop,
+                                  const sosc_event_backend_t *backend);
+void sosc_event_loop_fini(sosc_event_loop_t *loop);
+
+/* these return a watch id, or -1 on failure */
+int  sosc_event_loop_add_fd(sosc_event_loop_t *loop, int fd, int events,
+                            sosc_fd_cb_t *cb, void *data);
+int  sosc_event_loop_add_timer(sosc_event_loop_t *loop,
+                               unsigned int interval_ms,
+                               sosc_timer_cb_t *cb, void *data);
+
+int  sosc_event_loop_modify_fd(sosc_event_loop_t *loop, int watch,
+                               int events);
+void sosc_event_loop_remove(sosc_event_loop_t *loop, int watch);
+
+/* for a callback which stopped before its fd was drained (it ran out of
+   budget, say). level-triggered backends report the fd again regardless,
+   but a backend that only hears about new readiness needs telling. */
+void sosc_event_loop_rearm(sosc_event_loop_t *loop, int watch);
+
+void sosc_event_loop_on_iteration_end(sosc_event_loop_t *loop,
+                                      sosc_iteration_cb_t *cb, void *data);
+
+int  sosc_event_loop_run(sosc_event_loop_t *loop);
+
+/* helpers for backends */
+uint64_t sosc_event_loop_now(void);
+int sosc_event_loop_next_timeout(sosc_event_loop_t *loop);
+int sosc_event_loop_run_timers(sosc_event_loop_t *loop);
+int sosc_event_loop_dispatch(sosc_event_loop_t *loop, int watch, int events);
+int sosc_event_loop_end_iteration(sosc_event_loop_t *loop);
+
+extern const sosc_event_backend_t sosc_event_backend_io_uring;
+extern const sosc_event_backend_t sosc_event_backend_poll;
+extern const sosc_event_backend_t sosc_event_backend_select;
+extern const sosc_event_backend_t sosc_event_backend_epoll;
+extern const sosc_event_backend_t sosc_event_backend_windows;
+
+#endif /* defined SOSC_EVENT_LOOP_H */
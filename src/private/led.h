@@ -0,0 +1,383 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SOSC_LED_H
+#define SOSC_LED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <monome.h>
+
+/* the biggest grid we keep a framebuffer for, in either orientation */
+#define SOSC_LED_MAX_COLS  32
+#define SOSC_LED_MAX_ROWS  32
+#define SOSC_LED_MAX_LEVEL 15
+
+/* in shown[][], for LEDs we haven't told the device about yet */
+#define SOSC_LED_UNKNOWN 0xFF
+
+/* what each command costs on the wire with the mext protocol, in bytes.
+   row and col commands cost this much for every 8 LEDs. */
+#define SOSC_LED_COST_SET       3
+#define SOSC_LED_COST_ALL       1
+#define SOSC_LED_COST_MAP       11
+#define SOSC_LED_COST_ROW       4
+#define SOSC_LED_COST_LEVEL_SET 4
+#define SOSC_LED_COST_LEVEL_ALL 2
+#define SOSC_LED_COST_LEVEL_MAP 35
+#define SOSC_LED_COST_LEVEL_ROW 7
+
+/* and the same for arc rings */
+#define SOSC_LED_COST_RING_SET   4
+#define SOSC_LED_COST_RING_ALL   3
+#define SOSC_LED_COST_RING_MAP   34
+#define SOSC_LED_COST_RING_RANGE 5
+
+/* grid/led/color on a chronome: header, x, y, r, g, b */
+#define SOSC_LED_COST_COLOR 6
+
+/* in color_shown[][], like SOSC_LED_UNKNOWN. colours are 0xRRGGBB. */
+#define SOSC_LED_COLOR_UNKNOWN 0xFFFFFFFFu
+
+/* arcs have up to 8 encoders, each with a ring of 64 LEDs */
+#define SOSC_LED_MAX_RINGS 8
+#define SOSC_LED_RING_SIZE 64
+
+/* applications which can each own part of the grid, on top of the base
+   layer everyone else draws into */
+#define SOSC_LED_MAX_LAYERS 4
+
+/* where layers overlap, the one with the highest priority shows. */
+#define SOSC_LED_MAX_PRIORITY 255
+
+#define SOSC_LED_QUAD_BIT(x, y) (1 << ((((y) / 8) * 4) + ((x) / 8)))
+
+typedef struct {
+	/* what the commands applications sent us would have cost, and what
+	   we actually sent to the device instead. */
+	unsigned long requested_bytes;
+	unsigned long sent_bytes;
+	unsigned long commands;
+	unsigned long flushes;
+
+	/* LED changes which were overwritten before we got to send them, and
+	   ones which were undone (so didn't need sending at all). */
+	unsigned long replaced;
+	unsigned long dropped;
+
+	/* flushes put off because the serial port was still busy */
+	unsigned long deferred;
+} sosc_led_stats_t;
+
+/* what one application has drawn. where layers overlap, the one with the
+   highest priority shows, with ties going to the later slot. */
+typedef struct {
+	int in_use;
+	int x, y, w, h;
+	int priority;
+
+	uint8_t level[SOSC_LED_MAX_ROWS][SOSC_LED_MAX_COLS];
+} sosc_led_layer_t;
+
+typedef struct {
+	/* in application coordinates, so with rows and cols swapped if the
+	   grid is rotated by 90 or 270 degrees. */
+	int cols;
+	int rows;
+
+	/* what applications want the grid to show, composited from their
+	   layers, and what we last told the device to show. both hold levels;
+	   on/off commands are stored as 0 and SOSC_LED_MAX_LEVEL. */
+	uint8_t level[SOSC_LED_MAX_ROWS][SOSC_LED_MAX_COLS];
+	uint8_t shown[SOSC_LED_MAX_ROWS][SOSC_LED_MAX_COLS];
+
+	/* SOSC_LED_QUAD_BIT() for each 8x8 quad which may differ from what's
+	   shown */
+	uint16_t dirty;
+
+	/* layers[0] is the base layer, which covers the whole grid below all
+	   the others. owner[][] is the layer showing at each LED, and target
+	   the one the grid drawing functions currently draw into. */
+	sosc_led_layer_t layers[SOSC_LED_MAX_LAYERS + 1];
+	uint8_t owner[SOSC_LED_MAX_ROWS][SOSC_LED_MAX_COLS];
+	int target;
+
+	/* the same again for the RGB LEDs on chronome devices, which are
+	   separate from the levels. nothing is sent for them until an
+	   application has drawn some colour. */
+	uint32_t color[SOSC_LED_MAX_ROWS][SOSC_LED_MAX_COLS];
+	uint32_t color_shown[SOSC_LED_MAX_ROWS][SOSC_LED_MAX_COLS];
+	int color_dirty;
+	int color_used;
+
+	/* and for arc rings. bit n of ring_dirty is set when ring n may
+	   differ from what's shown. */
+	uint8_t ring[SOSC_LED_MAX_RINGS][SOSC_LED_RING_SIZE];
+	uint8_t ring_shown[SOSC_LED_MAX_RINGS][SOSC_LED_RING_SIZE];
+	uint8_t ring_dirty;
+
+	sosc_led_stats_t stats;
+} sosc_led_t;
+
+typedef enum {
+	SOSC_LED_CMD_SET,
+	SOSC_LED_CMD_ALL,
+	SOSC_LED_CMD_MAP,
+	SOSC_LED_CMD_ROW,
+	SOSC_LED_CMD_COL
+} sosc_led_cmd_type_t;
+
+/* the LEDs a command covers are sent whatever level[][] holds for them,
+   in the on/off form of the command if that's all they need. rows and
+   columns start at a multiple of 8 and are at most 8 long. */
+typedef struct {
+	uint8_t type;
+	uint8_t x;
+	uint8_t y;
+	uint8_t n;
+	uint8_t level; /* for SOSC_LED_CMD_ALL */
+} sosc_led_cmd_t;
+
+/* a set for every LED, plus an all */
+#define SOSC_LED_MAX_CMDS ((SOSC_LED_MAX_COLS * SOSC_LED_MAX_ROWS) + 1)
+
+/* src/led/grid.c */
+void sosc_led_init(sosc_led_t *led, monome_t *monome);
+uint16_t sosc_led_grid_quads(const sosc_led_t *led);
+void sosc_led_invalidate(sosc_led_t *led, monome_t *monome);
+
+void sosc_led_set(sosc_led_t *led, int x, int y, int level);
+
+/* local key echo: with toggle, each press flips the LED between off and
+   level; otherwise it's lit at level while the key is held */
+void sosc_led_echo(sosc_led_t *led, int toggle, int level, int x, int y,
+                   int down);
+
+void sosc_led_fill(sosc_led_t *led, int level);
+
+/* where a span of n (at least 1) from start ends once it's clipped to
+   limit, without overflowing however big n is */
+int sosc_led_clip_end(int start, int n, int limit);
+
+/* levels is w * h bytes, row by row. anything off the grid is clipped. */
+void sosc_led_rect(sosc_led_t *led, int x, int y, int w, int h,
+                   const uint8_t *levels);
+
+/* whether there's anything for sosc_led_flush() to send */
+int sosc_led_pending(const sosc_led_t *led);
+
+/* returns the new layer, or -1 if they're all taken */
+int  sosc_led_layer_add(sosc_led_t *led, int x, int y, int w, int h,
+                        int priority);
+void sosc_led_layer_remove(sosc_led_t *led, int layer);
+
+/* the layer showing at x, y: 0 for the base layer, or off the grid */
+int  sosc_led_layer_at(const sosc_led_t *led, int x, int y);
+
+/* like sosc_led_fill(), for a w * h rectangle */
+void sosc_led_fill_rect(sosc_led_t *led, int x, int y, int w, int h,
+                        int level);
+
+/* move everything dx to the right and dy down, filling in what's left
+   with level. anything moved off the grid is gone, so a shift as far
+   as the grid is wide or tall is just a fill. */
+void sosc_led_shift(sosc_led_t *led, int dx, int dy, int level);
+
+/* send whatever differs between level[][] and shown[][], and between
+   color[][] and color_shown[][] */
+void sosc_led_flush(sosc_led_t *led, monome_t *monome);
+
+/* the same, but stopping once about max_bytes have gone out. commands
+   aren't split, so it can go over by one. whatever's left stays dirty
+   for the next flush. */
+void sosc_led_flush_some(sosc_led_t *led, monome_t *monome, int max_bytes);
+
+/* src/led/color.c */
+void sosc_led_color_set(sosc_led_t *led, int x, int y, int r, int g, int b);
+
+/* rgb is w * h * 3 bytes, row by row. anything off the grid is clipped. */
+void sosc_led_color_rect(sosc_led_t *led, int x, int y, int w, int h,
+                         const uint8_t *rgb);
+
+void sosc_led_color_invalidate(sosc_led_t *led);
+void sosc_led_color_flush(sosc_led_t *led, monome_t *monome, int max_bytes);
+
+/* src/led/ring.c */
+void sosc_led_ring_init(sosc_led_t *led);
+
+/* positions are taken modulo SOSC_LED_RING_SIZE, as the arc does, and
+   ranges run clockwise from x1 to x2 inclusive. */
+void sosc_led_ring_set(sosc_led_t *led, int n, int x, int level);
+void sosc_led_ring_fill(sosc_led_t *led, int n, int level);
+void sosc_led_ring_range(sosc_led_t *led, int n, int x1, int x2, int level);
+
+/* levels is SOSC_LED_RING_SIZE bytes, already clamped */
+void sosc_led_ring_map(sosc_led_t *led, int n, const uint8_t *levels);
+
+/* turn ring n by d LEDs, clockwise for positive d */
+void sosc_led_ring_rotate(sosc_led_t *led, int n, int d);
+
+void sosc_led_ring_flush(sosc_led_t *led, monome_t *monome, int max_bytes);
+
+/* src/led/kernels.c */
+
+typedef struct {
+	const char *name;
+
+	/* int32s to levels, clamped to 0-15 */
+	void (*narrow)(uint8_t *dst, const int32_t *src, size_t n);
+
+	/* n levels to and from (n + 1) / 2 bytes, the first in the high
+	   nibble */
+	void (*pack)(uint8_t *dst, const uint8_t *src, size_t n);
+	void (*unpack)(uint8_t *dst, const uint8_t *src, size_t n);
+
+	/* bit i of mask[i / 64] is set where a[i] != b[i] */
+	void (*diff)(uint64_t *mask, const uint8_t *a, const uint8_t *b,
+	             size_t n);
+
+	/* the same for an 8x8 quad, bit (y * 8) + x */
+	uint64_t (*diff_quad)(const uint8_t *a, const uint8_t *b, size_t stride);
+} sosc_led_kernels_t;
+
+/* the best the CPU can do, once sosc_led_kernels_init() has run */
+extern const sosc_led_kernels_t *sosc_led_kernels;
+void sosc_led_kernels_init(void);
+
+/* every set this CPU can run, scalar first and the best last, ending
+   with NULL. sosc_led_kernels_init() picks the last. */
+const sosc_led_kernels_t **sosc_led_kernels_supported(void);
+
+/* src/led/snapshot.c */
+
+/* header, levels, colours and every ring */
+#define SOSC_LED_SNAPSHOT_MAX \
+	(17 + ((SOSC_LED_MAX_ROWS * SOSC_LED_MAX_COLS) / 2) \
+	 + (SOSC_LED_MAX_ROWS * SOSC_LED_MAX_COLS * 3) \
+	 + ((SOSC_LED_MAX_RINGS * SOSC_LED_RING_SIZE) / 2))
+
+/* saved and now are in seconds, from the same clock */
+size_t sosc_led_snapshot(const sosc_led_t *led, uint8_t *buf,
+                         uint64_t saved);
+int sosc_led_restore(sosc_led_t *led, const uint8_t *buf, size_t len,
+                     uint64_t now, uint64_t max_age);
+
+/* src/led/anim.c */
+
+#define SOSC_LED_MAX_ANIMS 64
+
+typedef enum {
+	SOSC_LED_ANIM_FADE,  /* from -> to once, then stays at to */
+	SOSC_LED_ANIM_BLINK, /* from for half the period, to for the other */
+	SOSC_LED_ANIM_PULSE, /* from -> to -> from, over and over */
+	SOSC_LED_ANIM_RAMP   /* from -> to, jumping back to from each time */
+} sosc_led_anim_type_t;
+
+typedef struct {
+	sosc_led_anim_type_t type;
+	int x, y, w, h;
+	int from, to;
+
+	/* what we last drew, or SOSC_LED_UNKNOWN */
+	int drawn;
+
+	/* the layer it draws into, the one being drawn on when it started */
+	int layer;
+
+	uint32_t period_ms;
+	uint64_t start_ms;
+} sosc_led_anim_t;
+
+/* animations later in the table draw over earlier ones */
+typedef struct {
+	sosc_led_anim_t anims[SOSC_LED_MAX_ANIMS];
+	int count;
+} sosc_led_anims_t;
+
+/* anim's region is clipped to the grid, and for a fade, from is taken
+   from the level its first LED has now. any animation the new one covers
+   completely is stopped. returns -1 if the region is off the grid or the
+   table is full. */
+int sosc_led_anim_start(sosc_led_anims_t *anims, const sosc_led_t *led,
+                        const sosc_led_anim_t *anim, uint64_t now_ms);
+
+/* stops every animation touching the rectangle */
+void sosc_led_anim_stop(sosc_led_anims_t *anims, int x, int y, int w, int h);
+void sosc_led_anim_stop_all(sosc_led_anims_t *anims);
+
+/* stops the animations drawing into a layer. call it when the layer goes,
+   before its slot can be given to someone else. */
+void sosc_led_anim_stop_layer(sosc_led_anims_t *anims, int layer);
+
+/* draws every animation for the time now_ms and drops the finished ones.
+   returns how many are left. */
+int sosc_led_anim_tick(sosc_led_anims_t *anims, sosc_led_t *led,
+                       uint64_t now_ms);
+
+/* src/led/rules.c */
+
+#define SOSC_LED_MAX_RULES 32
+
+typedef enum {
+	SOSC_LED_RULE_SET,
+	SOSC_LED_RULE_TOGGLE,
+	SOSC_LED_RULE_ROW,
+	SOSC_LED_RULE_COL,
+	SOSC_LED_RULE_RADIO,
+	SOSC_LED_RULE_FILL
+} sosc_led_rule_op_t;
+
+/* a bitmask */
+typedef enum {
+	SOSC_LED_RULE_DOWN = 1,
+	SOSC_LED_RULE_UP   = 2,
+	SOSC_LED_RULE_BOTH = 3
+} sosc_led_rule_edge_t;
+
+/* x1 and y1 are exclusive */
+typedef struct {
+	uint8_t op;
+	uint8_t edges;
+	uint8_t x0, y0, x1, y1;
+	uint8_t level;
+} sosc_led_rule_t;
+
+typedef struct {
+	sosc_led_rule_t rules[SOSC_LED_MAX_RULES];
+	int count;
+} sosc_led_rules_t;
+
+/* "op x y w h edge level", see rules.c. returns -1 if it doesn't parse. */
+int sosc_led_rule_parse(sosc_led_rule_t *rule, const char *text);
+void sosc_led_rule_format(const sosc_led_rule_t *rule, char *buf,
+                          size_t len);
+
+/* returns -1 if the table is full */
+int sosc_led_rules_add(sosc_led_rules_t *rules, const sosc_led_rule_t *rule);
+
+/* runs every rule matching a key going down or up */
+void sosc_led_rules_press(const sosc_led_rules_t *rules, sosc_led_t *led,
+                          int x, int y, int down);
+
+/* src/led/planner.c */
+
+/* fills cmds (SOSC_LED_MAX_CMDS long) with the cheapest set of commands,
+   by bytes on the wire, which makes the dirty quads of shown[][] match
+   level[][]. returns how many there are, and their cost in *cost. */
+int sosc_led_plan(const sosc_led_t *led, uint16_t dirty,
+                  sosc_led_cmd_t *cmds, int *cost);
+
+#endif /* defined SOSC_LED_H */
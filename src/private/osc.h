@@ -22,9 +22,46 @@
 				 lo_arg **argv, int argc,\
 				 lo_message data, void *user_data)
 
+/* one entry from osc/methods.def. for mext methods the path doesn't
+   include the prefix. a NULL typetag accepts any number of arguments. */
+typedef struct {
+	const char *path;
+	const char *types;
+	int types_len;
+	lo_method_handler handler;
+} osc_method_t;
+
 void osc_register_sys_methods(sosc_state_t *state);
 
 void osc_register_methods(sosc_state_t *state);
 void osc_unregister_methods(sosc_state_t *state);
 
+const osc_method_t *osc_mext_lookup(const char *path, const char *types,
+                                    int argc);
+int osc_dispatch_raw(sosc_state_t *state, const uint8_t *buf, size_t nbytes);
+
 char *osc_path(const char *path, const char *prefix);
+
+void osc_outbound_set_prefix(sosc_state_t *state);
+int  osc_outbound_set_destination(sosc_state_t *state);
+void osc_outbound_free(sosc_state_t *state);
+void osc_outbound_send(sosc_state_t *state, sosc_outbound_msg_type_t type,
+                       const int32_t *argv);
+void osc_outbound_send_to(sosc_state_t *state, sosc_outbound_msg_type_t type,
+                          const int32_t *argv, const struct sockaddr *dst,
+                          int dst_len);
+
+/* what's let through to the parser, see osc/rx_filter.c */
+void osc_rx_filter_init(sosc_state_t *state);
+int  osc_rx_filter(sosc_state_t *state, const struct sockaddr *src,
+                   const uint8_t *buf, size_t len, uint64_t now);
+void osc_rx_filter_print_stats(sosc_state_t *state);
+
+/* applications with LED layers of their own, see osc/clients.c */
+int  osc_client_layer(sosc_state_t *state, uint64_t now);
+int  osc_client_claim(sosc_state_t *state, int x, int y, int w, int h,
+                      int priority, int port);
+void osc_client_release(sosc_state_t *state);
+int  osc_client_reply(sosc_state_t *state, const char *path, lo_message m);
+void osc_client_free_all(sosc_state_t *state);
+int  osc_client_expire(sosc_state_t *state, uint64_t now, uint64_t timeout_ms);
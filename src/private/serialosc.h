@@ -21,6 +21,8 @@
 #include <dns_sd.h>
 #endif
 
+#include <stdint.h>
+
 #include <lo/lo.h>
 #include <monome.h>
 
@@ -28,13 +30,35 @@
 #define SERIALOSC_H
 
 #include "platform.h"
+#include "event_loop.h"
+#include "led.h"
 
 #define SOSC_SUPERVISOR_OSC_PORT "12002"
 #define SOSC_WIN_SERVICE_NAME "serialosc"
 
+/* what the server draws itself when a key is pressed, before the
+   application has had a chance to answer */
+typedef enum {
+	SOSC_ECHO_OFF,
+	SOSC_ECHO_MOMENTARY, /* lit while held */
+	SOSC_ECHO_TOGGLE     /* each press flips the LED */
+} sosc_echo_mode_t;
+
+/* most hosts listed in the "allow" option, and addresses they resolve to */
+#define SOSC_RX_MAX_ALLOW 16
+
 typedef struct {
 	struct {
 		char port[6];
+
+		/* OSC messages a second each host may send us, 0 for no limit.
+		   see osc/rx_filter.c. */
+		int led_rate;
+		int sys_rate;
+
+		/* the hosts allowed to send OSC. everyone if there are none. */
+		char *allow[SOSC_RX_MAX_ALLOW];
+		int nallow;
 	} server;
 
 	struct {
@@ -45,9 +69,132 @@ typedef struct {
 
 	struct {
 		monome_rotate_t rotation;
+
+		/* how many device events or OSC messages the event loop will
+		   handle from one source before giving the other a turn. */
+		int event_budget;
+
+		/* if nonzero, LED commands only draw into the framebuffer and
+		   changes are sent to the device this many times a second. */
+		int led_refresh_rate;
+
+		/* how many times a second running LED animations are redrawn.
+		   0 turns the animation methods off. */
+		int led_anim_rate;
+
+		sosc_echo_mode_t echo;
+		int echo_level;
+
+		/* seconds an application with a layer can go without sending
+		   anything before its layer is taken away. 0 never does. */
+		int layer_timeout;
+
+		/* compiled from the "rules" list, see led/rules.c */
+		sosc_led_rules_t rules;
 	} dev;
 } sosc_config_t;
 
+/* fixed-shape messages we send for every device event. their packets are
+   laid out once per prefix change so that sending one is just a handful
+   of integer stores and a sendto(). */
+typedef enum {
+	SOSC_OUTBOUND_GRID_KEY,
+	SOSC_OUTBOUND_GRID_PRESSURE,
+	SOSC_OUTBOUND_ENC_DELTA,
+	SOSC_OUTBOUND_ENC_KEY,
+	SOSC_OUTBOUND_TILT,
+
+	SOSC_OUTBOUND_MSG_COUNT
+} sosc_outbound_msg_type_t;
+
+typedef struct {
+	/* address, typetags and arguments, back to back. the address
+	   (and therefore the prefixed path) is at the very start. */
+	uint32_t *packet;
+	size_t nbytes;
+
+	/* points into the packet, in network byte order */
+	int32_t *argv;
+	int argc;
+} sosc_outbound_msg_t;
+
+typedef struct {
+	sosc_outbound_msg_t msgs[SOSC_OUTBOUND_MSG_COUNT];
+
+	/* the resolved state->outgoing. if resolution failed we fall back
+	   to sending through liblo. */
+	struct sockaddr *dst;
+	int dst_len;
+} sosc_outbound_t;
+
+/* an application with an LED layer of its own, which is how it's known:
+   by the address it sends from. its key presses go to dst. */
+typedef struct {
+	struct sockaddr *src;
+	int src_len;
+
+	struct sockaddr *dst;
+	int dst_len;
+
+	/* when it last sent us anything, in sosc_event_loop_now() time */
+	uint64_t last_heard;
+} sosc_client_t;
+
+/* incoming OSC, by what it's for, each with its own rate limit */
+typedef enum {
+	SOSC_RX_LED, /* anything under the application prefix */
+	SOSC_RX_SYS, /* /sys/... */
+
+	SOSC_RX_CLASS_COUNT
+} sosc_rx_class_t;
+
+#define SOSC_RX_MAX_SOURCES 16
+#define SOSC_RX_ADDR_SIZE   16
+
+/* a host we've heard from. IPv4 addresses are IPv4-mapped. */
+typedef struct {
+	uint8_t addr[SOSC_RX_ADDR_SIZE];
+	int in_use;
+
+	/* it took over another host's entry, so it draws on the shared
+	   tokens in forgotten rather than its own */
+	int shared;
+
+	uint64_t last_ms;
+	uint64_t tokens[SOSC_RX_CLASS_COUNT];
+
+	unsigned long accepted;
+	unsigned long dropped[SOSC_RX_CLASS_COUNT];
+} sosc_rx_source_t;
+
+typedef struct {
+	int active;
+	int rate[SOSC_RX_CLASS_COUNT];
+
+	int allowlist;
+	uint8_t allow[SOSC_RX_MAX_ALLOW][SOSC_RX_ADDR_SIZE];
+	int nallow;
+
+	/* datagrams from hosts not on the allowlist. they never get an entry
+	   in sources, so they can't push out a host that's allowed. */
+	unsigned long refused;
+
+	sosc_rx_source_t sources[SOSC_RX_MAX_SOURCES];
+
+	/* the counts of sources which had to make room for newer ones, and
+	   the tokens of the ones which took their places */
+	sosc_rx_source_t forgotten;
+} sosc_rx_filter_t;
+
+typedef struct {
+	unsigned long device_events;
+	unsigned long device_budget_hits;
+
+	unsigned long osc_messages;
+	unsigned long osc_fast_path;
+	unsigned long osc_budget_hits;
+} sosc_loop_stats_t;
+
 typedef struct {
 	monome_t *monome;
 	lo_address *outgoing;
@@ -59,9 +206,38 @@ typedef struct {
 #endif
 
 	sosc_config_t config;
+	sosc_outbound_t outbound;
+	sosc_rx_filter_t rx_filter;
+	sosc_event_loop_t loop;
+	sosc_loop_stats_t loop_stats;
+	sosc_led_t led;
+
+	/* the device's watch on the event loop, and whether it's waiting for
+	   the serial port to drain before it gets any more LED changes */
+	int device_watch;
+	int led_blocked;
+
+	/* the OSC socket's watch */
+	int osc_watch;
+
+	/* server-side LED animations, and the timer that runs them while
+	   there are any */
+	sosc_led_anims_t anims;
+	int anim_watch;
+
+	/* clients[i] owns LED layer i + 1 if its src is set */
+	sosc_client_t clients[SOSC_LED_MAX_LAYERS];
+	int nclients;
+
+	/* where the datagram being handled came from, when the receive path
+	   knows. NULL otherwise. */
+	const struct sockaddr *rx_src;
+	int rx_src_len;
 } sosc_state_t;
 
-int  sosc_event_loop(const sosc_state_t *state);
+int  sosc_event_loop(sosc_state_t *state);
+void sosc_led_output(sosc_state_t *state);
+void sosc_led_anim_wake(sosc_state_t *state);
 int  sosc_detector_run(const char *exec);
 void sosc_server_run(monome_t *monome);
 int  sosc_supervisor_run(char *progname);
@@ -69,6 +245,12 @@ int  sosc_supervisor_run(char *progname);
 int sosc_config_create_directory();
 int sosc_config_read(const char *serial, sosc_config_t *config);
 int sosc_config_write(const char *serial, sosc_state_t *state);
+int sosc_config_read_leds(const char *serial, sosc_led_t *led);
+int sosc_config_write_leds(const char *serial, const sosc_led_t *led);
+
+/* "off", "momentary" or "toggle". parsing returns -1 for anything else. */
+const char *sosc_echo_mode_name(sosc_echo_mode_t mode);
+int sosc_echo_mode_parse(const char *name, sosc_echo_mode_t *mode);
 
 void sosc_port_itos(char *dest, long int port);
 
@@ -53,55 +53,79 @@ static const char *null_if_zero(const char *s) {
 	return s;
 }
 
+/* with echo on, the key's LED changes in the same loop iteration as the
+   press comes in, without waiting on the application. the application
+   still gets the key, and whatever it draws afterwards wins. */
+static void echo_press(sosc_state_t *state, int x, int y, int down) {
+	if( state->config.dev.echo == SOSC_ECHO_OFF )
+		return;
+
+	sosc_led_echo(&state->led, state->config.dev.echo == SOSC_ECHO_TOGGLE,
+	              state->config.dev.echo_level, x, y, down);
+}
+
+/* grid events go to whichever application's LED layer shows where they
+   happened, argv[0] and argv[1] being x and y. returns the layer. */
+static int send_grid_event(sosc_state_t *state, sosc_outbound_msg_type_t type,
+                           const int32_t *argv) {
+	sosc_client_t *c;
+	int layer;
+
+	if( !(layer = sosc_led_layer_at(&state->led, argv[0], argv[1])) ) {
+		osc_outbound_send(state, type, argv);
+		return 0;
+	}
+
+	c = &state->clients[layer - 1];
+	osc_outbound_send_to(state, type, argv, c->dst, c->dst_len);
+	return layer;
+}
+
 static void handle_press(const monome_event_t *e, void *data) {
 	sosc_state_t *state = data;
-	char *cmd;
+	int32_t argv[] = {
+		e->grid.x, e->grid.y, e->event_type == MONOME_BUTTON_DOWN};
 
-	cmd = osc_path("grid/key", state->config.app.osc_prefix);
-	lo_send_from(state->outgoing, state->server, LO_TT_IMMEDIATE, cmd, "iii",
-	             e->grid.x, e->grid.y, e->event_type == MONOME_BUTTON_DOWN);
-	s_free(cmd);
+	/* local feedback draws into the layer the key belongs to */
+	state->led.target = sosc_led_layer_at(&state->led, argv[0], argv[1]);
+
+	sosc_led_rules_press(&state->config.dev.rules, &state->led,
+	                     argv[0], argv[1], argv[2]);
+
+	send_grid_event(state, SOSC_OUTBOUND_GRID_KEY, argv);
+	echo_press(state, argv[0], argv[1], argv[2]);
+
+	state->led.target = 0;
 }
 
 // added by owen for Chronome
 static void handle_pressure(const monome_event_t *e, void *data) {
 	sosc_state_t *state = data;
-	char *cmd;
-    
-	cmd = osc_path("grid/pressure", state->config.app.osc_prefix);
-	lo_send_from(state->outgoing, state->server, LO_TT_IMMEDIATE, cmd, "iii",
-	             e->pressure.x, e->pressure.y, e->pressure.value);
-	s_free(cmd);
+	int32_t argv[] = {e->pressure.x, e->pressure.y, e->pressure.value};
+
+	send_grid_event(state, SOSC_OUTBOUND_GRID_PRESSURE, argv);
 }
 
 static void handle_enc_delta(const monome_event_t *e, void *data) {
 	sosc_state_t *state = data;
-	char *cmd;
+	int32_t argv[] = {e->encoder.number, e->encoder.delta};
 
-	cmd = osc_path("enc/delta", state->config.app.osc_prefix);
-	lo_send_from(state->outgoing, state->server, LO_TT_IMMEDIATE, cmd, "ii",
-	             e->encoder.number, e->encoder.delta);
-	s_free(cmd);
+	osc_outbound_send(state, SOSC_OUTBOUND_ENC_DELTA, argv);
 }
 
 static void handle_enc_key(const monome_event_t *e, void *data) {
 	sosc_state_t *state = data;
-	char *cmd;
+	int32_t argv[] = {
+		e->encoder.number, e->event_type == MONOME_ENCODER_KEY_DOWN};
 
-	cmd = osc_path("enc/key", state->config.app.osc_prefix);
-	lo_send_from(state->outgoing, state->server, LO_TT_IMMEDIATE, cmd, "ii",
-	             e->encoder.number, e->event_type == MONOME_ENCODER_KEY_DOWN);
-	s_free(cmd);
+	osc_outbound_send(state, SOSC_OUTBOUND_ENC_KEY, argv);
 }
 
 static void handle_tilt(const monome_event_t *e, void *data) {
 	sosc_state_t *state = data;
-	char *cmd;
+	int32_t argv[] = {e->tilt.sensor, e->tilt.x, e->tilt.y, e->tilt.z};
 
-	cmd = osc_path("tilt", state->config.app.osc_prefix);
-	lo_send_from(state->outgoing, state->server, LO_TT_IMMEDIATE, cmd, "iiii",
-	             e->tilt.sensor, e->tilt.x, e->tilt.y, e->tilt.z);
-	s_free(cmd);
+	osc_outbound_send(state, SOSC_OUTBOUND_TILT, argv);
 }
 
 static void send_connection_status(sosc_state_t *state, int status) {
@@ -114,6 +138,92 @@ static void send_connection_status(sosc_state_t *state, int status) {
 	lo_send_from(state->outgoing, state->server, LO_TT_IMMEDIATE, cmd, "");
 }
 
+static int led_refresh(void *data) {
+	sosc_led_output(data);
+	return 0;
+}
+
+/* takes layers away from applications which have gone quiet. on windows
+   there are no layers, so there's nothing for it to do. */
+static int expire_layers(void *data) {
+	sosc_state_t *state = data;
+	int n;
+
+	if( !state->nclients )
+		return 0;
+
+	n = osc_client_expire(state, sosc_event_loop_now(),
+	                      state->config.dev.layer_timeout * 1000ULL);
+
+	if( n )
+		fprintf(stderr, "serialosc [%s]: %d application%s went quiet, "
+		        "dropped %s LED layer%s\n",
+		        monome_get_serial(state->monome), n, (n > 1) ? "s" : "",
+		        (n > 1) ? "their" : "its", (n > 1) ? "s" : "");
+
+	return 0;
+}
+
+/* on windows the OSC handlers, which start animations, run on the
+   lo_server's thread, so they can't safely add a timer to the main loop.
+   there the timer just runs for as long as the server does. */
+static int led_anim_tick(void *data) {
+	sosc_state_t *state = data;
+
+	if( sosc_led_anim_tick(&state->anims, &state->led, sosc_event_loop_now()) )
+		return 0;
+
+#ifndef WIN32
+	sosc_event_loop_remove(&state->loop, state->anim_watch);
+	state->anim_watch = -1;
+#endif
+
+	return 0;
+}
+
+void sosc_led_anim_wake(sosc_state_t *state) {
+	if( state->anim_watch >= 0 || !state->config.dev.led_anim_rate )
+		return;
+
+	state->anim_watch = sosc_event_loop_add_timer(
+		&state->loop, 1000 / state->config.dev.led_anim_rate,
+		led_anim_tick, state);
+
+	if( state->anim_watch < 0 ) {
+		fprintf(
+			stderr, "serialosc [%s]: couldn't start the LED animation "
+			"timer, animations are off\n",
+			monome_get_serial(state->monome));
+		state->config.dev.led_anim_rate = 0;
+	}
+}
+
+static void print_loop_stats(sosc_state_t *state) {
+	sosc_loop_stats_t *stats = &state->loop_stats;
+
+	fprintf(stderr, "serialosc [%s]: %lu loop iterations, "
+	        "%lu device events (budget hit %lu times), "
+	        "%lu osc messages (%lu on the fast path, budget hit %lu times)\n",
+	        monome_get_serial(state->monome), state->loop.iterations,
+	        stats->device_events, stats->device_budget_hits,
+	        stats->osc_messages, stats->osc_fast_path,
+	        stats->osc_budget_hits);
+}
+
+static void print_led_stats(sosc_state_t *state) {
+	sosc_led_stats_t *stats = &state->led.stats;
+
+	fprintf(stderr, "serialosc [%s]: %lu LED bytes requested, "
+	        "%lu sent in %lu commands over %lu flushes (%lu suppressed), "
+	        "%lu changes replaced and %lu dropped before sending, "
+	        "%lu flushes deferred\n",
+	        monome_get_serial(state->monome), stats->requested_bytes,
+	        stats->sent_bytes, stats->commands, stats->flushes,
+	        (stats->requested_bytes > stats->sent_bytes)
+	            ? stats->requested_bytes - stats->sent_bytes : 0,
+	        stats->replaced, stats->dropped, stats->deferred);
+}
+
 #ifndef WIN32
 /* not windows */
 static void send_simple_ipc(int fd, sosc_ipc_type_t type)
@@ -202,9 +312,13 @@ static void send_osc_port_change(int fd, uint16_t port)
 void sosc_server_run(monome_t *monome)
 {
 	char *svc_name;
+	int i;
 	sosc_state_t state = {
 		.monome = monome,
-		.ipc_fd = (!isatty(STDOUT_FILENO)) ? STDOUT_FILENO : -1
+		.ipc_fd = (!isatty(STDOUT_FILENO)) ? STDOUT_FILENO : -1,
+		.device_watch = -1,
+		.osc_watch = -1,
+		.anim_watch = -1
 	};
 
 	if( sosc_config_read(monome_get_serial(state.monome), &state.config) ) {
@@ -213,6 +327,13 @@ void sosc_server_run(monome_t *monome)
 			monome_get_serial(state.monome));
 	}
 
+	if( sosc_event_loop_init(&state.loop) ) {
+		fprintf(
+			stderr, "serialosc [%s]: couldn't start an event loop, aieee!\n",
+			monome_get_serial(state.monome));
+		goto err_loop_init;
+	}
+
 	if( !(state.server = lo_server_new(null_if_zero(state.config.server.port),
 									   lo_error)) )
 		goto err_server_new;
@@ -247,11 +368,31 @@ void sosc_server_run(monome_t *monome)
 #undef HANDLE
 
 	monome_set_rotation(state.monome, state.config.dev.rotation);
-	monome_led_all(state.monome, 0);
+
+	/* put back whatever was lit when the device last went away, so a
+	   brief disconnection doesn't leave it blank until the application
+	   notices and redraws */
+	sosc_led_init(&state.led, state.monome);
+
+	/* with nothing to put back, start dark as we always have. that's
+	   done on the device directly: an arc has no grid for the framebuffer
+	   to fill, and its rings aren't sent until something's drawn. */
+	if( sosc_config_read_leds(monome_get_serial(state.monome), &state.led) )
+		monome_led_all(state.monome, 0);
+	else
+		sosc_led_flush(&state.led, state.monome);
 
 	osc_register_sys_methods(&state);
 	osc_register_methods(&state);
 
+	osc_outbound_set_prefix(&state);
+	osc_rx_filter_init(&state);
+	if( osc_outbound_set_destination(&state) )
+		fprintf(
+			stderr, "serialosc [%s]: couldn't resolve %s, "
+			"sending through liblo\n",
+			monome_get_serial(state.monome), state.config.app.host);
+
 	if (state.ipc_fd < 0) {
 		fprintf(
 			stderr, "serialosc [%s]: connected, server running on port %d\n",
@@ -266,6 +407,29 @@ void sosc_server_run(monome_t *monome)
 	sosc_zeroconf_register(&state, svc_name);
 	free(svc_name);
 
+	if( state.config.dev.led_refresh_rate
+	    && sosc_event_loop_add_timer(
+			&state.loop, 1000 / state.config.dev.led_refresh_rate,
+			led_refresh, &state) < 0 ) {
+		fprintf(
+			stderr, "serialosc [%s]: couldn't start the LED refresh timer, "
+			"sending LED changes immediately\n",
+			monome_get_serial(state.monome));
+		state.config.dev.led_refresh_rate = 0;
+	}
+
+	if( state.config.dev.layer_timeout
+	    && sosc_event_loop_add_timer(&state.loop, 1000, expire_layers,
+	                                 &state) < 0 )
+		fprintf(
+			stderr, "serialosc [%s]: couldn't start the layer timer, "
+			"layers stay until they're released\n",
+			monome_get_serial(state.monome));
+
+#ifdef WIN32
+	sosc_led_anim_wake(&state);
+#endif
+
 	send_connection_status(&state, 1);
 	sosc_event_loop(&state);
 	send_connection_status(&state, 0);
@@ -278,17 +442,35 @@ void sosc_server_run(monome_t *monome)
 	} else
 		send_simple_ipc(state.ipc_fd, SOSC_DEVICE_DISCONNECTION);
 
+	print_loop_stats(&state);
+	print_led_stats(&state);
+	osc_rx_filter_print_stats(&state);
+
 	if( sosc_config_write(monome_get_serial(state.monome), &state) ) {
 		fprintf(
 			stderr, "serialosc [%s]: couldn't write config :(\n",
 			monome_get_serial(state.monome));
 	}
 
+	if( sosc_config_write_leds(monome_get_serial(state.monome), &state.led) ) {
+		fprintf(
+			stderr, "serialosc [%s]: couldn't save LED state\n",
+			monome_get_serial(state.monome));
+	}
+
+	osc_client_free_all(&state);
+	osc_outbound_free(&state);
+
 err_svc_name:
 	lo_address_free(state.outgoing);
 err_lo_addr:
 	lo_server_free(state.server);
 err_server_new:
+	sosc_event_loop_fini(&state.loop);
+err_loop_init:
 	s_free(state.config.app.osc_prefix);
 	s_free(state.config.app.host);
+
+	for( i = 0; i < state.config.server.nallow; i++ )
+		s_free(state.config.server.allow[i]);
 }
@@ -0,0 +1,319 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * checks the server-side LED animations: each kind draws the level it
+ * should at points through its period, only inside its region, and a
+ * fade is dropped once it has drawn its last level. regions and stop
+ * rectangles straight off the wire, out to the ends of the int range,
+ * are clipped to the grid (or turned down) rather than wrapping around.
+ * then times a tick with a full table of animations, both when every
+ * one of them changes level and when none do, so the cost of each
+ * running animation can be read off.
+ *
+ * exits nonzero if anything doesn't hold.
+ */
+
+/* for clock_gettime() under -std=c99 */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include "led.h"
+
+#define BENCH_TICKS 20000
+
+static sosc_led_t led;
+static sosc_led_anims_t anims;
+
+static int failures;
+
+#define FAIL(...) do { \
+	fprintf(stderr, __VA_ARGS__); \
+	failures++; \
+} while( 0 )
+
+static void reset(void) {
+	memset(&led, 0, sizeof(led));
+	led.cols = 16;
+	led.rows = 16;
+	led.layers[0].in_use = 1;
+
+	anims.count = 0;
+}
+
+static sosc_led_anim_t make(sosc_led_anim_type_t type, int x, int y,
+                            int w, int h, int from, int to,
+                            uint32_t period_ms) {
+	sosc_led_anim_t a;
+
+	memset(&a, 0, sizeof(a));
+	a.type = type;
+	a.x = x;
+	a.y = y;
+	a.w = w;
+	a.h = h;
+	a.from = from;
+	a.to = to;
+	a.period_ms = period_ms;
+
+	return a;
+}
+
+/**
+ * the checks
+ */
+
+/* every LED inside x, y, w, h is at level, and every one outside is at
+   outside */
+static void check_region(const char *name, int x, int y, int w, int h,
+                         int level, int outside) {
+	int i, j, in, want;
+
+	for( j = 0; j < led.rows; j++ )
+		for( i = 0; i < led.cols; i++ ) {
+			in = i >= x && i < x + w && j >= y && j < y + h;
+			want = in ? level : outside;
+
+			if( led.level[j][i] != want ) {
+				FAIL("%s: LED %d,%d is %d, want %d\n", name, i, j,
+				     led.level[j][i], want);
+				return;
+			}
+		}
+}
+
+static void check_kinds(void) {
+	sosc_led_anim_t a;
+
+	reset();
+	a = make(SOSC_LED_ANIM_FADE, 2, 3, 4, 5, 0, 15, 150);
+	led.layers[0].level[3][2] = 3;
+	led.level[3][2] = 3;
+
+	if( sosc_led_anim_start(&anims, &led, &a, 1000) )
+		FAIL("fade: wouldn't start\n");
+
+	/* a fade starts from whatever its first LED shows */
+	sosc_led_anim_tick(&anims, &led, 1000);
+	check_region("fade at 0ms", 2, 3, 4, 5, 3, 0);
+	sosc_led_anim_tick(&anims, &led, 1075);
+	check_region("fade at 75ms", 2, 3, 4, 5, 9, 0);
+
+	if( sosc_led_anim_tick(&anims, &led, 1150) != 0 )
+		FAIL("fade: still running once it's drawn its last level\n");
+	check_region("fade at 150ms", 2, 3, 4, 5, 15, 0);
+
+	reset();
+	a = make(SOSC_LED_ANIM_BLINK, 0, 0, 16, 1, 4, 12, 100);
+	sosc_led_anim_start(&anims, &led, &a, 0);
+
+	sosc_led_anim_tick(&anims, &led, 10);
+	check_region("blink, first half", 0, 0, 16, 1, 4, 0);
+	sosc_led_anim_tick(&anims, &led, 60);
+	check_region("blink, second half", 0, 0, 16, 1, 12, 0);
+
+	if( sosc_led_anim_tick(&anims, &led, 1000010) != 1 )
+		FAIL("blink: stopped by itself\n");
+	check_region("blink, much later", 0, 0, 16, 1, 4, 0);
+
+	reset();
+	a = make(SOSC_LED_ANIM_PULSE, 8, 8, 8, 8, 0, 14, 200);
+	sosc_led_anim_start(&anims, &led, &a, 0);
+
+	sosc_led_anim_tick(&anims, &led, 50);
+	check_region("pulse, on the way up", 8, 8, 8, 8, 7, 0);
+	sosc_led_anim_tick(&anims, &led, 100);
+	check_region("pulse, at the top", 8, 8, 8, 8, 14, 0);
+	sosc_led_anim_tick(&anims, &led, 150);
+	check_region("pulse, on the way down", 8, 8, 8, 8, 7, 0);
+
+	reset();
+	a = make(SOSC_LED_ANIM_RAMP, 0, 15, 1, 1, 0, 10, 100);
+	sosc_led_anim_start(&anims, &led, &a, 0);
+
+	sosc_led_anim_tick(&anims, &led, 90);
+	check_region("ramp, near the end", 0, 15, 1, 1, 9, 0);
+	sosc_led_anim_tick(&anims, &led, 100);
+	check_region("ramp, back at the start", 0, 15, 1, 1, 0, 0);
+}
+
+/* an animation started at x, y, w, h has to end up at want (or not start
+   at all, if want_w is 0) */
+static void check_start(int x, int y, int w, int h,
+                        int want_x, int want_y, int want_w, int want_h) {
+	sosc_led_anim_t a;
+	int ret;
+
+	reset();
+	a = make(SOSC_LED_ANIM_BLINK, x, y, w, h, 0, 15, 100);
+	ret = sosc_led_anim_start(&anims, &led, &a, 0);
+
+	if( !want_w ) {
+		if( !ret )
+			FAIL("%d %d %d %d: started, as %d %d %d %d\n", x, y, w, h,
+			     anims.anims[0].x, anims.anims[0].y,
+			     anims.anims[0].w, anims.anims[0].h);
+		return;
+	}
+
+	if( ret ) {
+		FAIL("%d %d %d %d: wouldn't start\n", x, y, w, h);
+		return;
+	}
+
+	if( anims.anims[0].x != want_x || anims.anims[0].y != want_y
+	    || anims.anims[0].w != want_w || anims.anims[0].h != want_h )
+		FAIL("%d %d %d %d: clipped to %d %d %d %d, want %d %d %d %d\n",
+		     x, y, w, h, anims.anims[0].x, anims.anims[0].y,
+		     anims.anims[0].w, anims.anims[0].h,
+		     want_x, want_y, want_w, want_h);
+}
+
+static void check_clipping(void) {
+	check_start(0, 0, 16, 16, 0, 0, 16, 16);
+	check_start(-5, 3, 10, 2, 0, 3, 5, 2);
+	check_start(10, 10, INT_MAX, INT_MAX, 10, 10, 6, 6);
+	check_start(INT_MIN, INT_MIN, INT_MAX, INT_MAX, 0, 0, 0, 0);
+	check_start(INT_MIN + 1, 0, INT_MAX, INT_MAX, 0, 0, 0, 0);
+	check_start(-1, -1, INT_MAX, INT_MAX, 0, 0, 16, 16);
+	check_start(INT_MAX, INT_MAX, INT_MAX, INT_MAX, 0, 0, 0, 0);
+	check_start(15, 15, INT_MAX, 1, 15, 15, 1, 1);
+	check_start(16, 0, 1, 1, 0, 0, 0, 0);
+	check_start(0, 0, 0, 5, 0, 0, 0, 0);
+	check_start(0, 0, -1, 5, 0, 0, 0, 0);
+	check_start(0, 0, INT_MIN, INT_MIN, 0, 0, 0, 0);
+}
+
+/* four quarters running, then a stop rectangle, leaving want of them */
+static void check_stop(int x, int y, int w, int h, int want) {
+	sosc_led_anim_t a;
+	int i;
+
+	reset();
+
+	for( i = 0; i < 4; i++ ) {
+		a = make(SOSC_LED_ANIM_BLINK, (i % 2) * 8, (i / 2) * 8, 8, 8,
+		         0, 15, 100);
+		sosc_led_anim_start(&anims, &led, &a, 0);
+	}
+
+	sosc_led_anim_stop(&anims, x, y, w, h);
+
+	if( anims.count != want )
+		FAIL("stopping %d %d %d %d left %d running, want %d\n",
+		     x, y, w, h, anims.count, want);
+}
+
+static void check_stopping(void) {
+	check_stop(0, 0, 1, 1, 3);
+	check_stop(7, 7, 2, 2, 0);
+	check_stop(8, 0, 8, 16, 2);
+	check_stop(16, 16, 4, 4, 4);
+	check_stop(INT_MIN, INT_MIN, INT_MAX, INT_MAX, 4);
+	check_stop(-1, -1, INT_MAX, INT_MAX, 0);
+	check_stop(INT_MAX, 0, INT_MAX, 1, 4);
+	check_stop(10, 10, INT_MAX, INT_MAX, 3);
+	check_stop(0, 0, 0, 16, 4);
+	check_stop(0, 0, INT_MIN, INT_MIN, 4);
+}
+
+static void check_covering(void) {
+	sosc_led_anim_t a;
+
+	reset();
+
+	a = make(SOSC_LED_ANIM_BLINK, 2, 2, 2, 2, 0, 15, 100);
+	sosc_led_anim_start(&anims, &led, &a, 0);
+	a = make(SOSC_LED_ANIM_BLINK, 12, 0, 8, 8, 0, 15, 100);
+	sosc_led_anim_start(&anims, &led, &a, 0);
+
+	/* covers the first completely, the second only once it's clipped */
+	a = make(SOSC_LED_ANIM_PULSE, 0, 0, INT_MAX, 8, 0, 15, 100);
+	sosc_led_anim_start(&anims, &led, &a, 0);
+
+	if( anims.count != 1 || anims.anims[0].type != SOSC_LED_ANIM_PULSE )
+		FAIL("covering: %d left running, want just the new one\n",
+		     anims.count);
+}
+
+/**
+ * benchmark
+ */
+
+static double now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* a full table of 2x2 ramps. with a period of 16ms and a tick every ms,
+   every one changes level every tick; with a long period, none do. */
+static void bench(uint32_t period_ms) {
+	sosc_led_anim_t a;
+	double start, ns;
+	int i;
+
+	reset();
+
+	for( i = 0; i < SOSC_LED_MAX_ANIMS; i++ ) {
+		a = make(SOSC_LED_ANIM_RAMP, (i % 8) * 2, (i / 8) * 2, 2, 2,
+		         0, 15, period_ms);
+		sosc_led_anim_start(&anims, &led, &a, 0);
+	}
+
+	if( anims.count != SOSC_LED_MAX_ANIMS ) {
+		FAIL("benchmark: only %d animations started\n", anims.count);
+		return;
+	}
+
+	start = now_ns();
+
+	for( i = 0; i < BENCH_TICKS; i++ )
+		sosc_led_anim_tick(&anims, &led, i);
+
+	ns = (now_ns() - start) / BENCH_TICKS;
+
+	printf("%d animations, %s: %6.0f ns per tick, %4.1f ns each\n",
+	       SOSC_LED_MAX_ANIMS,
+	       (period_ms < 100) ? "all changing" : "none changing",
+	       ns, ns / SOSC_LED_MAX_ANIMS);
+}
+
+int main(int argc, char **argv) {
+	sosc_led_kernels_init();
+
+	check_kinds();
+	check_clipping();
+	check_stopping();
+	check_covering();
+
+	bench(16);
+	bench(UINT32_MAX);
+
+	if( failures ) {
+		fprintf(stderr, "anim: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("anim: ok\n");
+	return 0;
+}
@@ -0,0 +1,393 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * checks local key echo: momentary lights a key's LED while it's held,
+ * toggle flips it on each press and ignores releases, presses off the
+ * grid draw nothing, and whatever the application draws afterwards
+ * wins. then times press-to-LED both ways, from the key event to the
+ * LED change being planned for the device: echoed locally, and through
+ * an application on a loopback socket that answers each grid/key with a
+ * grid/led/set.
+ *
+ * the application here answers as soon as it's woken and lives in this
+ * process, so the round trip is a lower bound. the serial write after
+ * planning is the same either way, and isn't timed.
+ *
+ * exits nonzero if anything doesn't hold.
+ */
+
+/* for clock_gettime() and strdup() under -std=c99 */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <lo/lo.h>
+
+#include "serialosc.h"
+#include "osc.h"
+#include "led.h"
+
+#define LEVEL 9
+#define BENCH_PRESSES 20000
+
+static sosc_state_t state;
+static sosc_led_cmd_t cmds[SOSC_LED_MAX_CMDS];
+
+/* the application's socket, and where it answers to */
+static int app;
+static struct sockaddr_in server_addr;
+
+static int failures;
+
+#define FAIL(...) do { \
+	fprintf(stderr, __VA_ARGS__); \
+	failures++; \
+} while( 0 )
+
+/**
+ * the platform's allocation wrappers
+ */
+
+char *s_asprintf(const char *fmt, ...) {
+	va_list args;
+	char *buf;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+
+	if( !(buf = s_malloc(len + 1)) )
+		return NULL;
+
+	va_start(args, fmt);
+	vsnprintf(buf, len + 1, fmt, args);
+	va_end(args);
+
+	return buf;
+}
+
+void *s_malloc(size_t size) {
+	return malloc(size);
+}
+
+void *s_calloc(size_t nmemb, size_t size) {
+	return calloc(nmemb, size);
+}
+
+void *s_strdup(const char *s) {
+	return strdup(s);
+}
+
+void s_free(void *ptr) {
+	free(ptr);
+}
+
+/* the animation timer is server.c's. nothing here starts an animation. */
+void sosc_led_anim_wake(sosc_state_t *state) {
+}
+
+/**
+ * the device server and the application
+ */
+
+static int open_app(char *port) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	if( (app = socket(AF_INET, SOCK_DGRAM, 0)) < 0 )
+		return 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if( bind(app, (struct sockaddr *) &addr, sizeof(addr))
+	    || getsockname(app, (struct sockaddr *) &addr, &len) )
+		return 1;
+
+	snprintf(port, 6, "%d", ntohs(addr.sin_port));
+	return 0;
+}
+
+static int init_state(void) {
+	char port[6];
+
+	sosc_led_kernels_init();
+
+	memset(&state, 0, sizeof(state));
+	state.config.app.osc_prefix = "/monome";
+	state.anim_watch = state.device_watch = state.osc_watch = -1;
+
+	state.led.cols = state.led.rows = 16;
+	state.led.layers[0].in_use = 1;
+	sosc_led_ring_init(&state.led);
+
+	if( open_app(port) || !(state.server = lo_server_new(NULL, NULL)) )
+		return 1;
+
+	state.outgoing = lo_address_new("127.0.0.1", port);
+	osc_outbound_set_prefix(&state);
+
+	if( osc_outbound_set_destination(&state) )
+		return 1;
+
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server_addr.sin_port = htons(lo_server_get_port(state.server));
+
+	return 0;
+}
+
+/* drops the key presses the echo checks forwarded */
+static void drain(void) {
+	uint8_t buf[256];
+
+	while( recv(app, buf, sizeof(buf), MSG_DONTWAIT) > 0 );
+}
+
+static void set_packet(uint8_t **data, size_t *len, int x, int y, int on) {
+	lo_message m = lo_message_new();
+
+	lo_message_add_int32(m, x);
+	lo_message_add_int32(m, y);
+	lo_message_add_int32(m, on);
+
+	*data = lo_message_serialise(m, "/monome/grid/led/set", NULL, len);
+	lo_message_free(m);
+}
+
+/**
+ * the checks
+ */
+
+static void press(int toggle, int x, int y, int down) {
+	sosc_led_echo(&state.led, toggle, LEVEL, x, y, down);
+}
+
+static void expect(const char *what, int x, int y, int level) {
+	if( state.led.level[y][x] != level )
+		FAIL("%s: LED %d,%d is %d, want %d\n", what, x, y,
+		     state.led.level[y][x], level);
+}
+
+static void check_momentary(void) {
+	sosc_led_fill(&state.led, 0);
+
+	press(0, 3, 4, 1);
+	expect("momentary, held", 3, 4, LEVEL);
+	press(0, 3, 4, 0);
+	expect("momentary, released", 3, 4, 0);
+
+	/* a key that's already lit goes dark on release all the same */
+	sosc_led_set(&state.led, 5, 5, 15);
+	press(0, 5, 5, 1);
+	press(0, 5, 5, 0);
+	expect("momentary, lit before", 5, 5, 0);
+}
+
+static void check_toggle(void) {
+	sosc_led_fill(&state.led, 0);
+
+	press(1, 15, 15, 1);
+	expect("toggle, first press", 15, 15, LEVEL);
+	press(1, 15, 15, 0);
+	expect("toggle, first release", 15, 15, LEVEL);
+	press(1, 15, 15, 1);
+	expect("toggle, second press", 15, 15, 0);
+	press(1, 15, 15, 0);
+	expect("toggle, second release", 15, 15, 0);
+
+	/* the application lit it at some other level: a press turns it off */
+	sosc_led_set(&state.led, 0, 0, 3);
+	press(1, 0, 0, 1);
+	expect("toggle, lit by the application", 0, 0, 0);
+}
+
+static void check_off_grid(void) {
+	static const int keys[][2] = {
+		{16, 0}, {0, 16}, {-1, 0}, {0, -1},
+		{INT_MAX, INT_MAX}, {INT_MIN, INT_MIN}
+	};
+
+	uint8_t before[SOSC_LED_MAX_ROWS][SOSC_LED_MAX_COLS];
+	int i, toggle;
+
+	memcpy(before, state.led.level, sizeof(before));
+
+	for( toggle = 0; toggle < 2; toggle++ )
+		for( i = 0; i < sizeof(keys) / sizeof(*keys); i++ ) {
+			press(toggle, keys[i][0], keys[i][1], 1);
+			press(toggle, keys[i][0], keys[i][1], 0);
+		}
+
+	if( memcmp(before, state.led.level, sizeof(before)) )
+		FAIL("a press off the grid drew something\n");
+}
+
+/* the application answers after the echo, and its answer is what shows */
+static void check_override(void) {
+	uint8_t *data;
+	size_t len;
+
+	sosc_led_fill(&state.led, 0);
+	press(1, 7, 2, 1);
+
+	set_packet(&data, &len, 7, 2, 1);
+	osc_dispatch_raw(&state, data, len);
+	free(data);
+
+	expect("application's answer after toggle echo", 7, 2,
+	       SOSC_LED_MAX_LEVEL);
+
+	press(0, 7, 3, 1);
+
+	set_packet(&data, &len, 7, 3, 0);
+	osc_dispatch_raw(&state, data, len);
+	free(data);
+
+	expect("application's answer after momentary echo", 7, 3, 0);
+}
+
+/**
+ * benchmark
+ */
+
+static double now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* what the device would be sent for this frame. leaves shown[][] as the
+   flush would, so the next press is a change again. */
+static int plan(void) {
+	int n, cost;
+
+	n = sosc_led_plan(&state.led, sosc_led_grid_quads(&state.led), cmds,
+	                  &cost);
+	memcpy(state.led.shown, state.led.level, sizeof(state.led.shown));
+
+	return n;
+}
+
+static void bench(void) {
+	uint8_t *answers[2], buf[256];
+	size_t answer_len[2];
+	double start, echo_ns, app_ns;
+	int32_t key[3] = {6, 6, 0};
+	int i, fd, missed;
+	ssize_t got;
+
+	sosc_led_fill(&state.led, 0);
+	memset(state.led.shown, 0, sizeof(state.led.shown));
+	drain();
+
+	/* echoed: the key still goes to the application, as handle_press
+	   sends it before drawing. taking it off the application's socket
+	   isn't part of the latency, so it's left out of the timing. */
+	missed = 0;
+	echo_ns = 0;
+
+	for( i = 0; i < BENCH_PRESSES; i++ ) {
+		key[2] = !(i & 1);
+		start = now_ns();
+
+		osc_outbound_send(&state, SOSC_OUTBOUND_GRID_KEY, key);
+		press(0, key[0], key[1], key[2]);
+		missed += !plan();
+
+		echo_ns += now_ns() - start;
+		recv(app, buf, sizeof(buf), 0);
+	}
+
+	echo_ns /= BENCH_PRESSES;
+
+	/* through the application */
+	set_packet(&answers[0], &answer_len[0], 6, 6, 0);
+	set_packet(&answers[1], &answer_len[1], 6, 6, 1);
+	fd = lo_server_get_socket_fd(state.server);
+	start = now_ns();
+
+	for( i = 0; i < BENCH_PRESSES; i++ ) {
+		key[2] = !(i & 1);
+		osc_outbound_send(&state, SOSC_OUTBOUND_GRID_KEY, key);
+
+		if( recv(app, buf, sizeof(buf), 0) <= 0
+		    || sendto(app, answers[key[2]], answer_len[key[2]], 0,
+		              (struct sockaddr *) &server_addr,
+		              sizeof(server_addr)) < 0 ) {
+			FAIL("benchmark: the application couldn't answer\n");
+			break;
+		}
+
+		if( (got = recv(fd, buf, sizeof(buf), 0)) <= 0 ) {
+			FAIL("benchmark: the answer didn't arrive\n");
+			break;
+		}
+
+		osc_dispatch_raw(&state, buf, got);
+		missed += !plan();
+	}
+
+	app_ns = (now_ns() - start) / BENCH_PRESSES;
+
+	if( missed )
+		FAIL("benchmark: %d presses changed no LED\n", missed);
+
+	printf("press to LED: echo %6.0f ns, through the application %6.0f ns\n",
+	       echo_ns, app_ns);
+
+	free(answers[0]);
+	free(answers[1]);
+}
+
+int main(int argc, char **argv) {
+	if( init_state() ) {
+		fprintf(stderr, "echo: couldn't set up the sockets\n");
+		return 1;
+	}
+
+	check_momentary();
+	check_toggle();
+	check_off_grid();
+	check_override();
+	drain();
+
+	bench();
+
+	if( failures ) {
+		fprintf(stderr, "echo: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("echo: ok\n");
+	return 0;
+}
@@ -0,0 +1,324 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * runs every event loop backend this build has through the same checks:
+ * fds and timers get their callbacks, a watch removed by an earlier
+ * callback in the same iteration doesn't, and input a callback leaves
+ * behind (as the device and OSC callbacks do when they run out of
+ * budget) is reported again once the callback re-arms its watch, without
+ * any new input arriving. then times a wakeup on each, by bouncing a
+ * byte between two pipes.
+ *
+ * a backend that can't start here (io_uring on a kernel without it) is
+ * skipped, as sosc_event_loop_init() would skip it.
+ *
+ * exits nonzero if anything doesn't hold.
+ */
+
+/* for clock_gettime() under -std=c99 */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/* which backends this build has */
+#include "config-autogen.h"
+#include "event_loop.h"
+
+#define LEFTOVER_BYTES 64
+#define LEFTOVER_BUDGET 4
+
+#define BENCH_WAKEUPS 100000
+
+/* stops a loop that's waiting for something which isn't coming */
+#define STALL_MS 500
+
+static const sosc_event_backend_t *backends[] = {
+#ifdef HAVE_IO_URING
+	&sosc_event_backend_io_uring,
+#endif
+
+#ifdef HAVE_EPOLL
+	&sosc_event_backend_epoll,
+#endif
+
+#ifdef HAVE_WORKING_POLL
+	&sosc_event_backend_poll,
+#else
+	&sosc_event_backend_select,
+#endif
+
+	NULL
+};
+
+typedef struct {
+	sosc_event_loop_t *loop;
+	int fds[2];
+	int watch;
+
+	int other_watch;
+	int calls;
+	int consumed;
+} pipe_t;
+
+static int failures;
+
+#define FAIL(...) do { \
+	fprintf(stderr, __VA_ARGS__); \
+	failures++; \
+} while( 0 )
+
+static int open_pipe(pipe_t *p, sosc_event_loop_t *loop) {
+	memset(p, 0, sizeof(*p));
+	p->loop = loop;
+	p->watch = p->other_watch = -1;
+
+	if( pipe(p->fds) )
+		return 1;
+
+	fcntl(p->fds[0], F_SETFL, O_NONBLOCK);
+	return 0;
+}
+
+static void close_pipe(pipe_t *p) {
+	close(p->fds[0]);
+	close(p->fds[1]);
+}
+
+static int fill(pipe_t *p, int n) {
+	char buf[LEFTOVER_BYTES];
+
+	memset(buf, 'x', sizeof(buf));
+	return write(p->fds[1], buf, n) != n;
+}
+
+static int stalled(void *data) {
+	return 2;
+}
+
+/**
+ * the checks
+ */
+
+/* like drain_device() and drain_osc(): takes a budget's worth, re-arms
+   if that wasn't everything */
+static int read_some(int fd, int events, void *data) {
+	char buf[LEFTOVER_BUDGET];
+	pipe_t *p = data;
+	ssize_t got;
+
+	p->calls++;
+
+	if( (got = read(fd, buf, sizeof(buf))) > 0 )
+		p->consumed += got;
+
+	if( p->consumed == LEFTOVER_BYTES )
+		return 1;
+
+	if( got == sizeof(buf) )
+		sosc_event_loop_rearm(p->loop, p->watch);
+
+	return 0;
+}
+
+static void check_leftovers(const sosc_event_backend_t *backend) {
+	const char *name = backend->name;
+	sosc_event_loop_t loop;
+	pipe_t p;
+	int ret;
+
+	if( sosc_event_loop_init_backend(&loop, backend) )
+		return;
+
+	if( open_pipe(&p, &loop) || fill(&p, LEFTOVER_BYTES) ) {
+		FAIL("%s: couldn't set up a pipe\n", name);
+		return;
+	}
+
+	p.watch = sosc_event_loop_add_fd(&loop, p.fds[0], SOSC_EVENT_READ,
+	                                 read_some, &p);
+	sosc_event_loop_add_timer(&loop, STALL_MS, stalled, NULL);
+
+	if( (ret = sosc_event_loop_run(&loop)) != 1 )
+		FAIL("%s: leftover input: read %d of %d bytes, then %s\n", name,
+		     p.consumed, LEFTOVER_BYTES,
+		     (ret == 2) ? "stalled" : "the loop failed");
+	else if( p.calls != LEFTOVER_BYTES / LEFTOVER_BUDGET )
+		FAIL("%s: leftover input took %d callbacks, want %d\n", name,
+		     p.calls, LEFTOVER_BYTES / LEFTOVER_BUDGET);
+
+	sosc_event_loop_fini(&loop);
+	close_pipe(&p);
+}
+
+/* whichever of the two goes first removes the other */
+static int remove_other(int fd, int events, void *data) {
+	pipe_t *p = data;
+
+	p->calls++;
+	sosc_event_loop_remove(p->loop, p->other_watch);
+	return 0;
+}
+
+static int stop(void *data) {
+	return 1;
+}
+
+static void check_removal(const sosc_event_backend_t *backend) {
+	const char *name = backend->name;
+	sosc_event_loop_t loop;
+	pipe_t a, b;
+
+	if( sosc_event_loop_init_backend(&loop, backend) )
+		return;
+
+	if( open_pipe(&a, &loop) || open_pipe(&b, &loop)
+	    || fill(&a, 1) || fill(&b, 1) ) {
+		FAIL("%s: couldn't set up the pipes\n", name);
+		return;
+	}
+
+	a.watch = sosc_event_loop_add_fd(&loop, a.fds[0], SOSC_EVENT_READ,
+	                                 remove_other, &a);
+	b.watch = sosc_event_loop_add_fd(&loop, b.fds[0], SOSC_EVENT_READ,
+	                                 remove_other, &b);
+	a.other_watch = b.watch;
+	b.other_watch = a.watch;
+
+	/* both are readable, so both turn up in the first iteration */
+	sosc_event_loop_on_iteration_end(&loop, stop, NULL);
+
+	if( sosc_event_loop_run(&loop) != 1 )
+		FAIL("%s: removal: the loop failed\n", name);
+	else if( a.calls + b.calls != 1 )
+		FAIL("%s: removed watch still got its callback (%d calls)\n",
+		     name, a.calls + b.calls);
+
+	sosc_event_loop_fini(&loop);
+	close_pipe(&a);
+	close_pipe(&b);
+}
+
+static int count_ticks(void *data) {
+	int *ticks = data;
+
+	return ++(*ticks) == 5;
+}
+
+static void check_timer(const sosc_event_backend_t *backend) {
+	const char *name = backend->name;
+	sosc_event_loop_t loop;
+	uint64_t start, took;
+	int ticks = 0;
+
+	if( sosc_event_loop_init_backend(&loop, backend) )
+		return;
+
+	sosc_event_loop_add_timer(&loop, 10, count_ticks, &ticks);
+	sosc_event_loop_add_timer(&loop, STALL_MS, stalled, NULL);
+
+	start = sosc_event_loop_now();
+
+	if( sosc_event_loop_run(&loop) != 1 )
+		FAIL("%s: timer: %d ticks before stalling\n", name, ticks);
+	else if( (took = sosc_event_loop_now() - start) < 45 )
+		FAIL("%s: 5 ticks of a 10ms timer took %d ms\n", name, (int) took);
+
+	sosc_event_loop_fini(&loop);
+}
+
+/**
+ * benchmark
+ */
+
+static double now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int wakeups;
+
+/* takes the byte off one pipe and puts it in the other */
+static int bounce(int fd, int events, void *data) {
+	pipe_t *to = data;
+	char c;
+
+	if( read(fd, &c, 1) != 1 || write(to->fds[1], &c, 1) != 1 )
+		return 2;
+
+	return ++wakeups == BENCH_WAKEUPS;
+}
+
+static void bench(const sosc_event_backend_t *backend) {
+	const char *name = backend->name;
+	sosc_event_loop_t loop;
+	double start, ns;
+	pipe_t a, b;
+
+	if( sosc_event_loop_init_backend(&loop, backend) ) {
+		printf("%-9s couldn't start here, skipped\n", name);
+		return;
+	}
+
+	if( open_pipe(&a, &loop) || open_pipe(&b, &loop) || fill(&a, 1) ) {
+		FAIL("%s: couldn't set up the pipes\n", name);
+		return;
+	}
+
+	sosc_event_loop_add_fd(&loop, a.fds[0], SOSC_EVENT_READ, bounce, &b);
+	sosc_event_loop_add_fd(&loop, b.fds[0], SOSC_EVENT_READ, bounce, &a);
+
+	wakeups = 0;
+	start = now_ns();
+
+	if( sosc_event_loop_run(&loop) != 1 )
+		FAIL("%s: benchmark: the loop failed\n", name);
+
+	ns = (now_ns() - start) / BENCH_WAKEUPS;
+	printf("%-9s %6.0f ns per wakeup\n", name, ns);
+
+	sosc_event_loop_fini(&loop);
+	close_pipe(&a);
+	close_pipe(&b);
+}
+
+int main(int argc, char **argv) {
+	int i;
+
+	for( i = 0; backends[i]; i++ ) {
+		check_leftovers(backends[i]);
+		check_removal(backends[i]);
+		check_timer(backends[i]);
+	}
+
+	for( i = 0; backends[i]; i++ )
+		bench(backends[i]);
+
+	if( failures ) {
+		fprintf(stderr, "event_loop: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("event_loop: ok\n");
+	return 0;
+}
@@ -0,0 +1,480 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * feeds the same random LED messages to two device servers, one through
+ * the in-place decoder (osc_dispatch_raw()) and one through liblo, and
+ * checks they end up drawing exactly the same thing. then checks the
+ * decoder turns down what it should leave to liblo (bundles, patterns,
+ * other prefixes, non-int arguments, short packets) without drawing
+ * anything, and times both ways of handling a message.
+ *
+ * the row and col methods take any typetags liblo can coerce to int32,
+ * and skip the coercing when they're all ints already. so the same
+ * rows and cols with float or mixed typetags have to draw what the
+ * ints did, and a full redraw by rows is timed all three ways: ints
+ * through the fast path, ints through liblo, and floats through liblo.
+ *
+ * exits nonzero if anything doesn't hold.
+ */
+
+/* for clock_gettime() and strdup() under -std=c99 */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include <lo/lo.h>
+
+#include "serialosc.h"
+#include "osc.h"
+#include "led.h"
+
+#define ROUNDS 2000
+#define BENCH_MESSAGES 200000
+#define BENCH_FRAMES 20000
+
+/* grid/led/level/map */
+#define MAX_ARGS 66
+
+static sosc_state_t raw, via_liblo;
+static int failures;
+
+#define FAIL(...) do { \
+	fprintf(stderr, __VA_ARGS__); \
+	failures++; \
+} while( 0 )
+
+/* xorshift, so every platform sends the same messages */
+static uint32_t rng_state = 2463534242u;
+
+static uint32_t rng(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+/**
+ * the platform's allocation wrappers
+ */
+
+char *s_asprintf(const char *fmt, ...) {
+	va_list args;
+	char *buf;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+
+	if( !(buf = s_malloc(len + 1)) )
+		return NULL;
+
+	va_start(args, fmt);
+	vsnprintf(buf, len + 1, fmt, args);
+	va_end(args);
+
+	return buf;
+}
+
+void *s_malloc(size_t size) {
+	return malloc(size);
+}
+
+void *s_calloc(size_t nmemb, size_t size) {
+	return calloc(nmemb, size);
+}
+
+void *s_strdup(const char *s) {
+	return strdup(s);
+}
+
+void s_free(void *ptr) {
+	free(ptr);
+}
+
+/* the animation timer is server.c's. nothing here starts an animation. */
+void sosc_led_anim_wake(sosc_state_t *state) {
+}
+
+/**
+ * messages
+ */
+
+/* the hot methods, with how many args they take. where that varies,
+   argc is the most and we send anywhere from min_argc up. */
+static const struct {
+	const char *path;
+	int min_argc;
+	int argc;
+} methods[] = {
+	{"grid/led/set",        3,  3},
+	{"grid/led/all",        1,  1},
+	{"grid/led/map",       10, 10},
+	{"grid/led/row",        3,  6},
+	{"grid/led/col",        3,  6},
+	{"grid/led/level/set",  3,  3},
+	{"grid/led/level/all",  1,  1},
+	{"grid/led/level/map", 66, 66},
+	{"grid/led/level/row", 10, 34},
+	{"grid/led/level/col", 10, 34},
+	{"ring/set",            3,  3},
+	{"ring/all",            2,  2},
+	{"ring/map",           65, 65},
+	{"ring/range",          4,  4},
+	{"ring/rotate",         2,  2}
+};
+
+#define NMETHODS (sizeof(methods) / sizeof(*methods))
+
+typedef struct {
+	uint8_t *data;
+	size_t len;
+} packet_t;
+
+static packet_t make_packet(const char *path, const char *types,
+                            const int32_t *argv) {
+	packet_t p;
+	lo_message m;
+	int i;
+
+	m = lo_message_new();
+
+	for( i = 0; types[i]; i++ )
+		if( types[i] == 'f' )
+			lo_message_add_float(m, argv[i]);
+		else
+			lo_message_add_int32(m, argv[i]);
+
+	p.data = lo_message_serialise(m, path, NULL, &p.len);
+	lo_message_free(m);
+
+	return p;
+}
+
+/* a random message for one of the hot methods. the values mostly make
+   sense, but not always: handlers have to cope with whatever they get,
+   and both paths have to cope with it the same way. */
+static packet_t random_message(int method) {
+	char path[64], types[MAX_ARGS + 1];
+	int32_t argv[MAX_ARGS];
+	int i, argc;
+
+	argc = methods[method].min_argc
+		+ rng() % (methods[method].argc - methods[method].min_argc + 1);
+
+	for( i = 0; i < argc; i++ ) {
+		argv[i] = (int32_t) (rng() % 24) - 4;
+		types[i] = 'i';
+	}
+
+	types[argc] = '\0';
+
+	snprintf(path, sizeof(path), "/monome/%s", methods[method].path);
+	return make_packet(path, types, argv);
+}
+
+/**
+ * the two device servers
+ */
+
+static void init_state(sosc_state_t *state) {
+	sosc_led_kernels_init();
+
+	memset(state, 0, sizeof(*state));
+	state->config.app.osc_prefix = "/monome";
+	state->anim_watch = state->device_watch = state->osc_watch = -1;
+
+	state->led.cols = state->led.rows = 16;
+	state->led.layers[0].in_use = 1;
+	sosc_led_ring_init(&state->led);
+}
+
+static int same_leds(const sosc_led_t *a, const sosc_led_t *b) {
+	return !memcmp(a->level, b->level, sizeof(a->level))
+		&& !memcmp(a->ring, b->ring, sizeof(a->ring));
+}
+
+static void check_equivalence(void) {
+	packet_t p;
+	int i, method;
+
+	for( i = 0; i < ROUNDS; i++ ) {
+		method = rng() % NMETHODS;
+		p = random_message(method);
+
+		if( osc_dispatch_raw(&raw, p.data, p.len) )
+			FAIL("/monome/%s: turned down by the fast path\n",
+			     methods[method].path);
+
+		lo_server_dispatch_data(via_liblo.server, p.data, p.len);
+
+		if( !same_leds(&raw.led, &via_liblo.led) ) {
+			FAIL("/monome/%s (%zu bytes): fast path drew something else\n",
+			     methods[method].path, p.len);
+			free(p.data);
+			return;
+		}
+
+		free(p.data);
+	}
+}
+
+static void check_refused(const char *why, const uint8_t *data, size_t len) {
+	static sosc_led_t before;
+
+	memcpy(&before, &raw.led, sizeof(before));
+
+	if( !osc_dispatch_raw(&raw, data, len) )
+		FAIL("fast path took %s\n", why);
+	else if( !same_leds(&raw.led, &before) )
+		FAIL("fast path turned down %s, but drew it anyway\n", why);
+}
+
+static void check_refusals(void) {
+	int32_t argv[] = {1, 2, 1, 0}, map[MAX_ARGS] = {0};
+	uint8_t bundle[64];
+	packet_t p;
+
+	raw.led.target = 0;
+	sosc_led_fill(&raw.led, 0);
+
+	p = make_packet("/monome/grid/led/set", "iii", argv);
+	check_refused("a packet missing its last arg", p.data, p.len - 4);
+	check_refused("a packet with an odd length", p.data, p.len - 1);
+	check_refused("an empty packet", p.data, 0);
+
+	/* the same message in a bundle */
+	memset(bundle, 0, sizeof(bundle));
+	memcpy(bundle, "#bundle", 8);
+	bundle[15] = 1;
+	bundle[19] = p.len;
+	memcpy(bundle + 20, p.data, p.len);
+	check_refused("a bundle", bundle, 20 + p.len);
+	free(p.data);
+
+	p = make_packet("/monome/grid/led/set", "iif", argv);
+	check_refused("a float arg", p.data, p.len);
+	free(p.data);
+
+	p = make_packet("/monome/grid/led/set", "ii", argv);
+	check_refused("too few args", p.data, p.len);
+	free(p.data);
+
+	p = make_packet("/monome/grid/led/set", "iiii", argv);
+	check_refused("too many args", p.data, p.len);
+	free(p.data);
+
+	p = make_packet("/other/grid/led/set", "iii", argv);
+	check_refused("another prefix", p.data, p.len);
+	free(p.data);
+
+	p = make_packet("/monomer/grid/led/set", "iii", argv);
+	check_refused("a longer prefix", p.data, p.len);
+	free(p.data);
+
+	p = make_packet("/monome/grid/led/*", "iii", argv);
+	check_refused("a pattern", p.data, p.len);
+	free(p.data);
+
+	p = make_packet("/monome/grid/led", "iii", argv);
+	check_refused("part of a path", p.data, p.len);
+	free(p.data);
+
+	p = make_packet("/sys/port", "i", argv);
+	check_refused("a /sys/ method", p.data, p.len);
+	free(p.data);
+
+	p = make_packet("/monome/grid/led/level/map", "ii", map);
+	check_refused("a level map without its levels", p.data, p.len);
+	free(p.data);
+}
+
+/* a row or col message for 16 LEDs, with typetags chosen by types:
+   'i' for all ints, 'f' for all floats, 'm' for a mix. */
+static packet_t line_message(const char *method, int level, int y,
+                             char types) {
+	char path[64], tags[MAX_ARGS + 1];
+	int32_t argv[MAX_ARGS];
+	int i, argc;
+
+	argc = level ? 18 : 4;
+	argv[0] = 0;
+	argv[1] = y;
+
+	for( i = 2; i < argc; i++ )
+		argv[i] = level ? (int32_t) (rng() % 20) - 2 : rng() % 256;
+
+	for( i = 0; i < argc; i++ )
+		tags[i] = (types == 'm') ? "if"[rng() % 2] : types;
+
+	tags[argc] = '\0';
+
+	snprintf(path, sizeof(path), "/monome/grid/led/%s%s",
+	         level ? "level/" : "", method);
+	return make_packet(path, tags, argv);
+}
+
+static void check_coercion(void) {
+	static const char *lines[] = {"row", "col"};
+	packet_t ints, other;
+	uint32_t seed;
+	int i, level;
+
+	memcpy(&via_liblo.led, &raw.led, sizeof(raw.led));
+
+	for( i = 0; i < ROUNDS; i++ ) {
+		level = rng() % 2;
+
+		/* the same values again, with other typetags */
+		seed = rng_state;
+		ints = line_message(lines[i % 2], level, i % 16, 'i');
+		rng_state = seed;
+		other = line_message(lines[i % 2], level, i % 16,
+		                     (i % 3) ? 'f' : 'm');
+
+		if( osc_dispatch_raw(&raw, ints.data, ints.len) )
+			FAIL("grid/led/%s%s: turned down by the fast path\n",
+			     level ? "level/" : "", lines[i % 2]);
+
+		lo_server_dispatch_data(via_liblo.server, other.data, other.len);
+
+		if( !same_leds(&raw.led, &via_liblo.led) ) {
+			FAIL("grid/led/%s%s: coerced args drew something else\n",
+			     level ? "level/" : "", lines[i % 2]);
+			i = ROUNDS;
+		}
+
+		free(ints.data);
+		free(other.data);
+	}
+}
+
+/**
+ * benchmark
+ */
+
+static double now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench_method(int method) {
+	double start, raw_ns, lo_ns;
+	packet_t p;
+	int i;
+
+	p = random_message(method);
+
+	start = now_ns();
+	for( i = 0; i < BENCH_MESSAGES; i++ )
+		osc_dispatch_raw(&raw, p.data, p.len);
+	raw_ns = (now_ns() - start) / BENCH_MESSAGES;
+
+	start = now_ns();
+	for( i = 0; i < BENCH_MESSAGES; i++ )
+		lo_server_dispatch_data(via_liblo.server, p.data, p.len);
+	lo_ns = (now_ns() - start) / BENCH_MESSAGES;
+
+	printf("/monome/%-20s fast path %5.0f ns, liblo %5.0f ns (%.1fx)\n",
+	       methods[method].path, raw_ns, lo_ns, lo_ns / raw_ns);
+
+	free(p.data);
+}
+
+/* a whole 16x16 grid redrawn a row at a time, which is what most
+   applications send every frame */
+static void bench_rows(void) {
+	packet_t ints[16], floats[16];
+	double start, raw_ns, int_ns, float_ns;
+	uint32_t seed;
+	int frame, y;
+
+	for( y = 0; y < 16; y++ ) {
+		seed = rng_state;
+		ints[y] = line_message("row", 1, y, 'i');
+		rng_state = seed;
+		floats[y] = line_message("row", 1, y, 'f');
+	}
+
+	start = now_ns();
+	for( frame = 0; frame < BENCH_FRAMES; frame++ )
+		for( y = 0; y < 16; y++ )
+			osc_dispatch_raw(&raw, ints[y].data, ints[y].len);
+	raw_ns = (now_ns() - start) / (BENCH_FRAMES * 16);
+
+	start = now_ns();
+	for( frame = 0; frame < BENCH_FRAMES; frame++ )
+		for( y = 0; y < 16; y++ )
+			lo_server_dispatch_data(via_liblo.server, ints[y].data,
+			                        ints[y].len);
+	int_ns = (now_ns() - start) / (BENCH_FRAMES * 16);
+
+	start = now_ns();
+	for( frame = 0; frame < BENCH_FRAMES; frame++ )
+		for( y = 0; y < 16; y++ )
+			lo_server_dispatch_data(via_liblo.server, floats[y].data,
+			                        floats[y].len);
+	float_ns = (now_ns() - start) / (BENCH_FRAMES * 16);
+
+	printf("grid/led/level/row, 16 levels: fast path %4.0f ns, "
+	       "liblo %4.0f ns, liblo coercing floats %4.0f ns\n",
+	       raw_ns, int_ns, float_ns);
+
+	for( y = 0; y < 16; y++ ) {
+		free(ints[y].data);
+		free(floats[y].data);
+	}
+}
+
+int main(int argc, char **argv) {
+	init_state(&raw);
+	init_state(&via_liblo);
+
+	if( !(via_liblo.server = lo_server_new(NULL, NULL)) ) {
+		fprintf(stderr, "fast_path: couldn't start a liblo server\n");
+		return 1;
+	}
+
+	osc_register_methods(&via_liblo);
+
+	check_equivalence();
+	check_coercion();
+	check_refusals();
+
+	bench_method(0);  /* grid/led/set */
+	bench_method(3);  /* grid/led/row */
+	bench_method(7);  /* grid/led/level/map */
+	bench_rows();
+
+	osc_unregister_methods(&via_liblo);
+	lo_server_free(via_liblo.server);
+
+	if( failures ) {
+		fprintf(stderr, "fast_path: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("fast_path: ok\n");
+	return 0;
+}
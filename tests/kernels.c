@@ -0,0 +1,279 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * checks every set of LED kernels this CPU can run against plain loops
+ * written out here, over random input of every length up to a few
+ * vectors past a whole grid (so every leftover tail gets a turn), at
+ * unaligned addresses, and with the int32s at the edges of their range.
+ * then times a full 16x16 redraw through each set: four level maps
+ * narrowed, the frame packed and unpacked, and diffed against the last.
+ *
+ * exits nonzero if anything doesn't hold.
+ */
+
+/* for clock_gettime() under -std=c99 */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include "led.h"
+
+#define MAX_LEN 300
+#define BENCH_FRAMES 200000
+
+static int failures;
+
+#define FAIL(...) do { \
+	fprintf(stderr, __VA_ARGS__); \
+	failures++; \
+} while( 0 )
+
+/* xorshift, so every platform tests the same input */
+static uint32_t rng_state = 2463534242u;
+
+static uint32_t rng(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+/* mostly levels and near misses, sometimes anything at all */
+static int32_t random_arg(void) {
+	static const int32_t edges[] = {
+		INT32_MIN, INT32_MIN + 1, -65536, -256, -16, -1, 0,
+		15, 16, 255, 256, 65535, 65536, INT32_MAX - 1, INT32_MAX
+	};
+
+	switch( rng() % 4 ) {
+	case 0:
+		return edges[rng() % (sizeof(edges) / sizeof(*edges))];
+	case 1:
+		return (int32_t) rng();
+	default:
+		return (int32_t) (rng() % 24) - 4;
+	}
+}
+
+/**
+ * the checks
+ */
+
+static void check_narrow(const sosc_led_kernels_t *k, size_t n, size_t off) {
+	static int32_t src[MAX_LEN + 4];
+	static uint8_t got[MAX_LEN + 16];
+	uint8_t want;
+	size_t i;
+
+	for( i = 0; i < n; i++ )
+		src[off + i] = random_arg();
+
+	memset(got, 0xAA, sizeof(got));
+	k->narrow(got + off, src + off, n);
+
+	for( i = 0; i < n; i++ ) {
+		want = (src[off + i] < 0) ? 0
+			: (src[off + i] > SOSC_LED_MAX_LEVEL) ? SOSC_LED_MAX_LEVEL
+			: src[off + i];
+
+		if( got[off + i] != want ) {
+			FAIL("%s: narrow(%zu): %d came out as %d\n", k->name, n,
+			     src[off + i], got[off + i]);
+			return;
+		}
+	}
+
+	if( got[off + n] != 0xAA || (off && got[off - 1] != 0xAA) )
+		FAIL("%s: narrow(%zu) wrote outside its buffer\n", k->name, n);
+}
+
+static void check_pack(const sosc_led_kernels_t *k, size_t n, size_t off) {
+	static uint8_t levels[MAX_LEN + 16], packed[MAX_LEN + 16],
+		unpacked[MAX_LEN + 16];
+	uint8_t want;
+	size_t i, bytes = (n + 1) / 2;
+
+	/* the high nibbles should be ignored */
+	for( i = 0; i < n; i++ )
+		levels[off + i] = rng();
+
+	memset(packed, 0xAA, sizeof(packed));
+	k->pack(packed + off, levels + off, n);
+
+	for( i = 0; i < bytes; i++ ) {
+		want = (levels[off + (i * 2)] & 0x0F) << 4;
+		if( (i * 2) + 1 < n )
+			want |= levels[off + (i * 2) + 1] & 0x0F;
+
+		if( packed[off + i] != want ) {
+			FAIL("%s: pack(%zu): byte %zu is %02x, want %02x\n", k->name,
+			     n, i, packed[off + i], want);
+			return;
+		}
+	}
+
+	if( packed[off + bytes] != 0xAA )
+		FAIL("%s: pack(%zu) wrote outside its buffer\n", k->name, n);
+
+	memset(unpacked, 0xAA, sizeof(unpacked));
+	k->unpack(unpacked + off, packed + off, n);
+
+	for( i = 0; i < n; i++ )
+		if( unpacked[off + i] != (levels[off + i] & 0x0F) ) {
+			FAIL("%s: unpack(%zu): level %zu is %d, want %d\n", k->name,
+			     n, i, unpacked[off + i], levels[off + i] & 0x0F);
+			return;
+		}
+
+	if( unpacked[off + n] != 0xAA )
+		FAIL("%s: unpack(%zu) wrote outside its buffer\n", k->name, n);
+}
+
+static void check_diff(const sosc_led_kernels_t *k, size_t n, size_t off) {
+	static uint8_t a[MAX_LEN + 16], b[MAX_LEN + 16];
+	uint64_t mask[(MAX_LEN / 64) + 2], want;
+	size_t i, words = (n + 63) / 64;
+	int density = 1 + (rng() % 8);
+
+	for( i = 0; i < n; i++ ) {
+		a[off + i] = rng() % 16;
+		b[off + i] = (rng() % density) ? a[off + i] : rng() % 16;
+	}
+
+	memset(mask, 0xAA, sizeof(mask));
+	k->diff(mask, a + off, b + off, n);
+
+	for( i = 0; i < words * 64; i++ ) {
+		want = (i < n) && a[off + i] != b[off + i];
+
+		if( ((mask[i / 64] >> (i % 64)) & 1) != want ) {
+			FAIL("%s: diff(%zu): bit %zu is wrong\n", k->name, n, i);
+			return;
+		}
+	}
+
+	if( mask[words] != 0xAAAAAAAAAAAAAAAAull )
+		FAIL("%s: diff(%zu) wrote past its mask\n", k->name, n);
+}
+
+static void check_diff_quad(const sosc_led_kernels_t *k, size_t stride) {
+	static uint8_t a[SOSC_LED_MAX_ROWS * 32], b[SOSC_LED_MAX_ROWS * 32];
+	uint64_t got, want;
+	size_t x, y, i;
+
+	for( i = 0; i < sizeof(a); i++ ) {
+		a[i] = rng() % 16;
+		b[i] = (rng() % 4) ? a[i] : rng() % 16;
+	}
+
+	/* a quad somewhere other than the top left, at an odd offset */
+	for( i = 1; i < stride - 8; i += 7 ) {
+		want = 0;
+
+		for( y = 0; y < 8; y++ )
+			for( x = 0; x < 8; x++ )
+				if( a[i + (y * stride) + x] != b[i + (y * stride) + x] )
+					want |= 1ull << ((y * 8) + x);
+
+		if( (got = k->diff_quad(a + i, b + i, stride)) != want ) {
+			FAIL("%s: diff_quad (stride %zu, at %zu): %016llx, want %016llx\n",
+			     k->name, stride, i, (unsigned long long) got,
+			     (unsigned long long) want);
+			return;
+		}
+	}
+}
+
+static void check(const sosc_led_kernels_t *k) {
+	size_t n, off;
+
+	for( n = 0; n <= MAX_LEN; n++ )
+		for( off = 0; off < 4; off++ ) {
+			check_narrow(k, n, off);
+			check_pack(k, n, off);
+			check_diff(k, n, off);
+		}
+
+	check_diff_quad(k, 16);
+	check_diff_quad(k, 32);
+}
+
+/**
+ * benchmark
+ */
+
+static double now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* so the compiler can't drop the work */
+static volatile uint64_t sink;
+
+static void bench(const sosc_led_kernels_t *k) {
+	static int32_t args[4][64];
+	static uint8_t frame[256], shown[256], packed[128];
+	uint64_t mask[4];
+	double start;
+	int i, quad;
+
+	for( i = 0; i < 256; i++ ) {
+		args[i / 64][i % 64] = random_arg();
+		shown[i] = rng() % 16;
+	}
+
+	start = now_ns();
+
+	for( i = 0; i < BENCH_FRAMES; i++ ) {
+		for( quad = 0; quad < 4; quad++ )
+			k->narrow(frame + (quad * 64), args[quad], 64);
+
+		k->pack(packed, frame, 256);
+		k->unpack(frame, packed, 256);
+		k->diff(mask, frame, shown, 256);
+
+		sink += mask[0] ^ mask[3];
+		shown[i & 255]++;
+	}
+
+	printf("%-7s %5.0f ns per 16x16 frame\n", k->name,
+	       (now_ns() - start) / BENCH_FRAMES);
+}
+
+int main(int argc, char **argv) {
+	const sosc_led_kernels_t **k;
+
+	for( k = sosc_led_kernels_supported(); *k; k++ )
+		check(*k);
+
+	for( k = sosc_led_kernels_supported(); *k; k++ )
+		bench(*k);
+
+	if( failures ) {
+		fprintf(stderr, "kernels: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("kernels: ok\n");
+	return 0;
+}
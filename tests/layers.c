@@ -0,0 +1,411 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * checks applications sharing a grid through LED layers: four of them,
+ * told apart by source address as the receive path tells them apart,
+ * each draw into their own layer and show only where they're on top;
+ * priority decides overlaps; a layer released, or taken away from an
+ * application that's gone quiet, shows the base layer again, and its
+ * application goes back to drawing there. then times a frame of four
+ * applications each redrawing their quarter of the grid, against one
+ * application redrawing all of it with no layers.
+ *
+ * exits nonzero if anything doesn't hold.
+ */
+
+/* for clock_gettime() and strdup() under -std=c99 */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <lo/lo.h>
+
+#include "serialosc.h"
+#include "osc.h"
+#include "led.h"
+
+#define NAPPS 4
+#define BENCH_FRAMES 20000
+
+static sosc_state_t state;
+
+/* the addresses the four applications send from, and the one everybody
+   else does */
+static struct sockaddr_in apps[NAPPS + 1];
+
+static int failures;
+
+#define FAIL(...) do { \
+	fprintf(stderr, __VA_ARGS__); \
+	failures++; \
+} while( 0 )
+
+/**
+ * the platform's allocation wrappers
+ */
+
+char *s_asprintf(const char *fmt, ...) {
+	va_list args;
+	char *buf;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+
+	if( !(buf = s_malloc(len + 1)) )
+		return NULL;
+
+	va_start(args, fmt);
+	vsnprintf(buf, len + 1, fmt, args);
+	va_end(args);
+
+	return buf;
+}
+
+void *s_malloc(size_t size) {
+	return malloc(size);
+}
+
+void *s_calloc(size_t nmemb, size_t size) {
+	return calloc(nmemb, size);
+}
+
+void *s_strdup(const char *s) {
+	return strdup(s);
+}
+
+void s_free(void *ptr) {
+	free(ptr);
+}
+
+/* the animation timer is server.c's. nothing here starts an animation. */
+void sosc_led_anim_wake(sosc_state_t *state) {
+}
+
+/**
+ * the device server, and datagrams from each application
+ */
+
+static void init_state(void) {
+	int i;
+
+	sosc_led_kernels_init();
+
+	memset(&state, 0, sizeof(state));
+	state.config.app.osc_prefix = "/monome";
+	state.anim_watch = state.device_watch = state.osc_watch = -1;
+
+	state.led.cols = state.led.rows = 16;
+	state.led.layers[0].in_use = 1;
+	sosc_led_ring_init(&state.led);
+
+	for( i = 0; i <= NAPPS; i++ ) {
+		apps[i].sin_family = AF_INET;
+		apps[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		apps[i].sin_port = htons(9000 + i);
+	}
+}
+
+/* as the receive path does it: who it's from, then which layer that
+   draws into */
+static void from(int app, uint64_t now) {
+	state.rx_src = (struct sockaddr *) &apps[app];
+	state.rx_src_len = sizeof(apps[app]);
+
+	state.led.target = state.nclients ? osc_client_layer(&state, now) : 0;
+}
+
+static void done(void) {
+	state.led.target = 0;
+	state.rx_src = NULL;
+}
+
+static int claim(int app, int x, int y, int w, int h, int priority,
+                 uint64_t now) {
+	int ret;
+
+	from(app, now);
+	ret = osc_client_claim(&state, x, y, w, h, priority, 10000 + app);
+	done();
+
+	return ret;
+}
+
+static uint8_t *level_all(size_t *len, int level) {
+	lo_message m = lo_message_new();
+	uint8_t *data;
+
+	lo_message_add_int32(m, level);
+	data = lo_message_serialise(m, "/monome/grid/led/level/all", NULL, len);
+	lo_message_free(m);
+
+	return data;
+}
+
+static void draw_all(int app, int level, uint64_t now) {
+	uint8_t *data;
+	size_t len;
+
+	data = level_all(&len, level);
+
+	from(app, now);
+	if( osc_dispatch_raw(&state, data, len) )
+		FAIL("app %d: level/all turned down by the fast path\n", app);
+	done();
+
+	free(data);
+}
+
+/**
+ * the checks
+ */
+
+/* the grid shows quarter q's owner's level in quarter q */
+static void expect_quarters(const char *what, const int *levels) {
+	int x, y, q;
+
+	for( y = 0; y < 16; y++ )
+		for( x = 0; x < 16; x++ ) {
+			q = ((y / 8) * 2) + (x / 8);
+
+			if( state.led.level[y][x] != levels[q] ) {
+				FAIL("%s: LED %d,%d is %d, want %d\n", what, x, y,
+				     state.led.level[y][x], levels[q]);
+				return;
+			}
+		}
+}
+
+static void check_sharing(void) {
+	int i, want[4] = {3, 4, 5, 6};
+
+	for( i = 0; i < NAPPS; i++ )
+		if( claim(i, (i % 2) * 8, (i / 2) * 8, 8, 8, 0, 0) )
+			FAIL("app %d: couldn't claim a layer\n", i);
+
+	if( state.nclients != NAPPS )
+		FAIL("%d clients, want %d\n", state.nclients, NAPPS);
+
+	if( !claim(NAPPS, 0, 0, 1, 1, 0, 0) )
+		FAIL("a fifth application got a layer\n");
+
+	/* each fills its whole layer, and shows only in its quarter */
+	draw_all(NAPPS, 1, 0);
+
+	for( i = 0; i < NAPPS; i++ )
+		draw_all(i, want[i], 0);
+
+	expect_quarters("four layers", want);
+
+	/* the top left one moves to cover everything, underneath the others
+	   to begin with, then over them */
+	claim(0, 0, 0, 16, 16, 0, 0);
+	draw_all(0, 9, 0);
+
+	want[0] = 9;
+	expect_quarters("a full-grid layer at the same priority", want);
+
+	claim(0, 0, 0, 16, 16, SOSC_LED_MAX_PRIORITY, 0);
+	draw_all(0, 9, 0);
+
+	want[1] = want[2] = want[3] = 9;
+	expect_quarters("a full-grid layer on top", want);
+
+	/* and gives it back, leaving the base layer in its quarter */
+	from(0, 0);
+	osc_client_release(&state);
+	done();
+
+	want[0] = 1;
+	want[1] = 4;
+	want[2] = 5;
+	want[3] = 6;
+	expect_quarters("a layer released", want);
+
+	if( state.nclients != NAPPS - 1 )
+		FAIL("%d clients after a release, want %d\n", state.nclients,
+		     NAPPS - 1);
+
+	/* what it draws now goes into the base layer */
+	draw_all(0, 2, 0);
+	want[0] = 2;
+	expect_quarters("drawing after a release", want);
+
+	osc_client_free_all(&state);
+}
+
+static void check_expiry(void) {
+	int i, want[4] = {1, 1, 1, 1};
+
+	sosc_led_fill(&state.led, 1);
+
+	for( i = 0; i < NAPPS; i++ ) {
+		claim(i, (i % 2) * 8, (i / 2) * 8, 8, 8, 0, 1000);
+		draw_all(i, 10 + i, 1000);
+	}
+
+	/* two keep talking, two go quiet */
+	draw_all(1, 11, 5000);
+	draw_all(3, 13, 9000);
+
+	if( osc_client_expire(&state, 9999, 10000) )
+		FAIL("expiry: a layer went before its time was up\n");
+
+	if( osc_client_expire(&state, 11000, 10000) != 2
+	    || state.nclients != 2 )
+		FAIL("expiry: %d clients left, want the 2 still talking\n",
+		     state.nclients);
+
+	want[1] = 11;
+	want[3] = 13;
+	expect_quarters("two layers expired", want);
+
+	/* an application which lost its layer draws into the base one */
+	draw_all(0, 7, 11000);
+	want[0] = want[2] = 7;
+	expect_quarters("drawing after losing a layer", want);
+
+	if( osc_client_expire(&state, 19000 + 1, 10000) != 2
+	    || state.nclients )
+		FAIL("expiry: %d clients left, want none\n", state.nclients);
+
+	osc_client_free_all(&state);
+}
+
+/**
+ * benchmark
+ */
+
+static double now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* grid/led/level/map for the quarter at x, y */
+static uint8_t *level_map(size_t *len, int x, int y, int level) {
+	lo_message m = lo_message_new();
+	uint8_t *data;
+	int i;
+
+	lo_message_add_int32(m, x);
+	lo_message_add_int32(m, y);
+
+	for( i = 0; i < 64; i++ )
+		lo_message_add_int32(m, (level + i) % 16);
+
+	data = lo_message_serialise(m, "/monome/grid/led/level/map", NULL, len);
+	lo_message_free(m);
+
+	return data;
+}
+
+/* a frame is four level maps, one per quarter. with layers, each is from
+   the application which owns that quarter; without, all four are from
+   the same one, drawing into the base layer. */
+static double frame_ns(int layered) {
+	uint8_t *maps[NAPPS];
+	size_t lens[NAPPS];
+	double start;
+	int frame, i;
+
+	if( layered )
+		for( i = 0; i < NAPPS; i++ )
+			claim(i, (i % 2) * 8, (i / 2) * 8, 8, 8, 0, 0);
+
+	for( i = 0; i < NAPPS; i++ )
+		maps[i] = level_map(&lens[i], (i % 2) * 8, (i / 2) * 8, i);
+
+	start = now_ns();
+
+	for( frame = 0; frame < BENCH_FRAMES; frame++ )
+		for( i = 0; i < NAPPS; i++ ) {
+			from(layered ? i : NAPPS, frame);
+			osc_dispatch_raw(&state, maps[i], lens[i]);
+			done();
+
+			/* so every map changes something */
+			maps[i][lens[i] - 1] ^= 1;
+		}
+
+	for( i = 0; i < NAPPS; i++ )
+		free(maps[i]);
+
+	osc_client_free_all(&state);
+	return (now_ns() - start) / BENCH_FRAMES;
+}
+
+/* what it costs to recomposite the grid when a layer comes or goes */
+static double claim_ns(void) {
+	double start;
+	int i;
+
+	start = now_ns();
+
+	for( i = 0; i < BENCH_FRAMES; i++ ) {
+		claim(i % NAPPS, (i % 2) * 8, 0, 8, 16, i % 3, 0);
+
+		from(i % NAPPS, 0);
+		osc_client_release(&state);
+		done();
+	}
+
+	return (now_ns() - start) / (BENCH_FRAMES * 2);
+}
+
+static void bench(void) {
+	double alone, shared;
+
+	/* the first run only warms things up */
+	frame_ns(0);
+
+	alone = frame_ns(0);
+	shared = frame_ns(1);
+
+	printf("a frame of four level maps: one application %5.0f ns, "
+	       "four with layers %5.0f ns\n", alone, shared);
+	printf("a layer claimed or released: %5.0f ns\n", claim_ns());
+}
+
+int main(int argc, char **argv) {
+	init_state();
+
+	check_sharing();
+	check_expiry();
+
+	bench();
+
+	if( failures ) {
+		fprintf(stderr, "layers: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("layers: ok\n");
+	return 0;
+}
@@ -0,0 +1,262 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * checks osc_mext_lookup() against osc/methods.def itself: every mext
+ * path and typetag string in there has to find its own entry through
+ * the generated hash, and near misses (parts of paths, /sys/ methods,
+ * typetags nobody registered) have to find nothing. then times a lookup
+ * against walking the same table comparing strings, which is what
+ * liblo's method list costs us.
+ *
+ * exits nonzero if anything doesn't hold.
+ */
+
+/* for clock_gettime() and strdup() under -std=c99 */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "serialosc.h"
+#include "osc.h"
+
+#define BENCH_ROUNDS 20000
+
+typedef struct {
+	const char *path;
+	const char *types;
+} method_t;
+
+static const method_t methods[] = {
+#define MEXT_METHOD(path, types, handler) {path, types},
+#define MEXT_METHOD_VARARGS(path, handler) {path, NULL},
+#define SYS_METHOD(path, types, handler)
+
+#include "../src/osc/methods.def"
+
+#undef SYS_METHOD
+#undef MEXT_METHOD_VARARGS
+#undef MEXT_METHOD
+};
+
+#define NMETHODS (sizeof(methods) / sizeof(*methods))
+
+static int failures;
+
+#define FAIL(...) do { \
+	fprintf(stderr, __VA_ARGS__); \
+	failures++; \
+} while( 0 )
+
+/**
+ * what osc/mext_methods.c needs from the rest of serialosc
+ */
+
+char *s_asprintf(const char *fmt, ...) {
+	va_list args;
+	char *buf;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+
+	if( !(buf = s_malloc(len + 1)) )
+		return NULL;
+
+	va_start(args, fmt);
+	vsnprintf(buf, len + 1, fmt, args);
+	va_end(args);
+
+	return buf;
+}
+
+void *s_malloc(size_t size) {
+	return malloc(size);
+}
+
+void *s_calloc(size_t nmemb, size_t size) {
+	return calloc(nmemb, size);
+}
+
+void *s_strdup(const char *s) {
+	return strdup(s);
+}
+
+void s_free(void *ptr) {
+	free(ptr);
+}
+
+void sosc_led_anim_wake(sosc_state_t *state) {
+}
+
+/**
+ * the checks
+ */
+
+static int same_types(const char *a, const char *b) {
+	if( !a || !b )
+		return a == b;
+	return !strcmp(a, b);
+}
+
+/* the first entry for a path which takes these typetags, as liblo would
+   pick it */
+static const method_t *expected(const char *path, const char *types) {
+	int i;
+
+	for( i = 0; i < NMETHODS; i++ )
+		if( !strcmp(methods[i].path, path)
+		    && (!methods[i].types || !strcmp(methods[i].types, types)) )
+			return &methods[i];
+
+	return NULL;
+}
+
+static void check_lookup(const char *path, const char *types) {
+	const osc_method_t *got;
+	const method_t *want;
+
+	got = osc_mext_lookup(path, types, strlen(types));
+	want = expected(path, types);
+
+	if( !want && got )
+		FAIL("%s ,%s: found %s ,%s, want nothing\n", path, types,
+		     got->path, got->types ? got->types : "(any)");
+	else if( want && !got )
+		FAIL("%s ,%s: found nothing\n", path, types);
+	else if( want && (strcmp(got->path, want->path)
+	                  || !same_types(got->types, want->types)
+	                  || !got->handler) )
+		FAIL("%s ,%s: found %s ,%s\n", path, types,
+		     got->path, got->types ? got->types : "(any)");
+}
+
+static void check_table(void) {
+	int i;
+
+	for( i = 0; i < NMETHODS; i++ ) {
+		/* what each entry was registered with, and for varargs
+		   methods, something nobody would register */
+		check_lookup(methods[i].path,
+		             methods[i].types ? methods[i].types : "ifsb");
+
+		/* and a typetag string which is one arg too long */
+		if( methods[i].types ) {
+			char types[80];
+
+			snprintf(types, sizeof(types), "%si", methods[i].types);
+			check_lookup(methods[i].path, types);
+		}
+	}
+}
+
+static void check_misses(void) {
+	static const char *paths[] = {
+		"", "grid", "grid/", "grid/led", "grid/led/", "grid/led/set/",
+		"grid/led/sets", "grid/led/se", "Grid/led/set", "/grid/led/set",
+		"sys/port", "sys/info/id", "ring", "ring/setx", "tilt/set/",
+		"grid/led/level", "grid/led/level/set/x"
+	};
+
+	int i;
+
+	for( i = 0; i < sizeof(paths) / sizeof(*paths); i++ ) {
+		check_lookup(paths[i], "iii");
+		check_lookup(paths[i], "");
+	}
+}
+
+/**
+ * benchmark
+ */
+
+static double now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* how liblo finds a method: every registered full path and typetag
+   string, in order, until one matches */
+static const method_t *linear_lookup(char (*full)[64], const char *path,
+                                     const char *types) {
+	int i;
+
+	for( i = 0; i < NMETHODS; i++ )
+		if( !strcmp(full[i], path)
+		    && (!methods[i].types || !strcmp(methods[i].types, types)) )
+			return &methods[i];
+
+	return NULL;
+}
+
+static void bench(void) {
+	static char full[NMETHODS][64], with_prefix[NMETHODS][64];
+	static const char *types[NMETHODS];
+	double start, hash_ns, linear_ns;
+	unsigned long found;
+	int i, round;
+
+	for( i = 0; i < NMETHODS; i++ ) {
+		snprintf(full[i], sizeof(full[i]), "/monome/%s", methods[i].path);
+		strcpy(with_prefix[i], full[i]);
+		types[i] = methods[i].types ? methods[i].types : "iiiiii";
+	}
+
+	found = 0;
+	start = now_ns();
+
+	for( round = 0; round < BENCH_ROUNDS; round++ )
+		for( i = 0; i < NMETHODS; i++ )
+			found += !!osc_mext_lookup(with_prefix[i] + 8, types[i],
+			                           strlen(types[i]));
+
+	hash_ns = (now_ns() - start) / (BENCH_ROUNDS * NMETHODS);
+	start = now_ns();
+
+	for( round = 0; round < BENCH_ROUNDS; round++ )
+		for( i = 0; i < NMETHODS; i++ )
+			found -= !!linear_lookup(full, with_prefix[i], types[i]);
+
+	linear_ns = (now_ns() - start) / (BENCH_ROUNDS * NMETHODS);
+
+	if( found )
+		FAIL("the hash and the linear walk found different things\n");
+
+	printf("%d methods: hashed lookup %4.0f ns, linear walk %4.0f ns\n",
+	       (int) NMETHODS, hash_ns, linear_ns);
+}
+
+int main(int argc, char **argv) {
+	check_table();
+	check_misses();
+	bench();
+
+	if( failures ) {
+		fprintf(stderr, "method_hash: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("method_hash: ok\n");
+	return 0;
+}
@@ -0,0 +1,298 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * checks the prebuilt outbound packets against what liblo would have
+ * sent, over a real socket, and that sending a device event allocates
+ * nothing. then times both ways of sending a key press: the prebuilt
+ * packet, and osc_path() plus a fresh lo_message as it used to be.
+ *
+ * the allocation count comes from the s_*() wrappers, which this test
+ * provides itself. liblo's own allocations don't go through them, so
+ * for the old path the count is a lower bound.
+ *
+ * exits nonzero if anything doesn't hold.
+ */
+
+/* for clock_gettime() and strdup() under -std=c99 */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <lo/lo.h>
+
+#include "serialosc.h"
+#include "osc.h"
+
+#define BENCH_EVENTS 100000
+
+static sosc_state_t state;
+static int listener;
+
+static unsigned long allocations;
+static int failures;
+
+#define FAIL(...) do { \
+	fprintf(stderr, __VA_ARGS__); \
+	failures++; \
+} while( 0 )
+
+/**
+ * the platform's allocation wrappers, counting
+ */
+
+char *s_asprintf(const char *fmt, ...) {
+	va_list args;
+	char *buf;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+
+	if( !(buf = s_malloc(len + 1)) )
+		return NULL;
+
+	va_start(args, fmt);
+	vsnprintf(buf, len + 1, fmt, args);
+	va_end(args);
+
+	return buf;
+}
+
+void *s_malloc(size_t size) {
+	allocations++;
+	return malloc(size);
+}
+
+void *s_calloc(size_t nmemb, size_t size) {
+	allocations++;
+	return calloc(nmemb, size);
+}
+
+void *s_strdup(const char *s) {
+	allocations++;
+	return strdup(s);
+}
+
+void s_free(void *ptr) {
+	free(ptr);
+}
+
+/**
+ * the other end
+ */
+
+static int open_listener(char *port) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	if( (listener = socket(AF_INET, SOCK_DGRAM, 0)) < 0 )
+		return 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if( bind(listener, (struct sockaddr *) &addr, sizeof(addr))
+	    || getsockname(listener, (struct sockaddr *) &addr, &len) )
+		return 1;
+
+	snprintf(port, 6, "%d", ntohs(addr.sin_port));
+	return 0;
+}
+
+/* drops whatever's queued up, so the benchmarks don't fill the socket */
+static void drain(void) {
+	uint8_t buf[256];
+
+	while( recv(listener, buf, sizeof(buf), MSG_DONTWAIT) > 0 );
+}
+
+static void check_packet(const char *path, sosc_outbound_msg_type_t type,
+                         const int32_t *argv, int argc) {
+	uint8_t got[256];
+	size_t want_len;
+	lo_message m;
+	void *want;
+	ssize_t len;
+	int i;
+
+	drain();
+	osc_outbound_send(&state, type, argv);
+
+	if( (len = recv(listener, got, sizeof(got), 0)) < 0 ) {
+		FAIL("%s: nothing arrived\n", path);
+		return;
+	}
+
+	m = lo_message_new();
+	for( i = 0; i < argc; i++ )
+		lo_message_add_int32(m, argv[i]);
+
+	want = lo_message_serialise(m, path, NULL, &want_len);
+
+	if( (size_t) len != want_len || memcmp(got, want, want_len) )
+		FAIL("%s: packet differs from liblo's (%zd bytes, want %zu)\n",
+		     path, len, want_len);
+
+	free(want);
+	lo_message_free(m);
+}
+
+static void check_packets(void) {
+	int32_t key[] = {3, 7, 1}, pressure[] = {15, 0, 255}, delta[] = {2, -5},
+		enc_key[] = {1, 0}, tilt[] = {0, -12, 40, 127};
+
+	check_packet("/monome/grid/key",      SOSC_OUTBOUND_GRID_KEY,      key, 3);
+	check_packet("/monome/grid/pressure", SOSC_OUTBOUND_GRID_PRESSURE,
+	             pressure, 3);
+	check_packet("/monome/enc/delta",     SOSC_OUTBOUND_ENC_DELTA,     delta, 2);
+	check_packet("/monome/enc/key",       SOSC_OUTBOUND_ENC_KEY,       enc_key, 2);
+	check_packet("/monome/tilt",          SOSC_OUTBOUND_TILT,          tilt, 4);
+
+	/* a new prefix, which /sys/prefix rebuilds the packets for. the
+	   path's length changes how much padding there is. */
+	state.config.app.osc_prefix = "/a";
+	osc_outbound_set_prefix(&state);
+	check_packet("/a/grid/key", SOSC_OUTBOUND_GRID_KEY, key, 3);
+
+	state.config.app.osc_prefix = "/monome";
+	osc_outbound_set_prefix(&state);
+}
+
+/**
+ * benchmarks
+ */
+
+static double now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* the key press path as it was: osc_path(), then a fresh lo_message */
+static void send_the_old_way(const int32_t *argv) {
+	lo_message m;
+	char *path;
+	int i;
+
+	path = osc_path("grid/key", state.config.app.osc_prefix);
+
+	m = lo_message_new();
+	for( i = 0; i < 3; i++ )
+		lo_message_add_int32(m, argv[i]);
+
+	lo_send_message_from(state.outgoing, state.server, path, m);
+
+	lo_message_free(m);
+	s_free(path);
+}
+
+static void bench(void) {
+	unsigned long allocs, new_allocs;
+	double start, old_ns, new_ns;
+	int32_t argv[3];
+	int i;
+
+	allocs = allocations;
+	start = now_ns();
+
+	for( i = 0; i < BENCH_EVENTS; i++ ) {
+		argv[0] = i & 15;
+		argv[1] = (i >> 4) & 15;
+		argv[2] = i & 1;
+
+		osc_outbound_send(&state, SOSC_OUTBOUND_GRID_KEY, argv);
+
+		if( !(i & 63) )
+			drain();
+	}
+
+	new_ns = (now_ns() - start) / BENCH_EVENTS;
+	new_allocs = allocations - allocs;
+
+	if( new_allocs )
+		FAIL("prebuilt packets: %lu allocations for %d events\n",
+		     new_allocs, BENCH_EVENTS);
+
+	allocs = allocations;
+	start = now_ns();
+
+	for( i = 0; i < BENCH_EVENTS; i++ ) {
+		argv[0] = i & 15;
+		argv[1] = (i >> 4) & 15;
+		argv[2] = i & 1;
+
+		send_the_old_way(argv);
+
+		if( !(i & 63) )
+			drain();
+	}
+
+	old_ns = (now_ns() - start) / BENCH_EVENTS;
+
+	printf("key press, prebuilt packet:    %6.0f ns, %.0f allocations\n",
+	       new_ns, (double) new_allocs / BENCH_EVENTS);
+	printf("key press, osc_path + liblo:   %6.0f ns, %.0f allocations "
+	       "(plus liblo's own)\n",
+	       old_ns, (double) (allocations - allocs) / BENCH_EVENTS);
+}
+
+int main(int argc, char **argv) {
+	char port[6];
+
+	if( open_listener(port)
+	    || !(state.server = lo_server_new(NULL, NULL))
+	    || !(state.outgoing = lo_address_new("127.0.0.1", port)) ) {
+		fprintf(stderr, "outbound: couldn't set up the sockets\n");
+		return 1;
+	}
+
+	state.config.app.osc_prefix = "/monome";
+	osc_outbound_set_prefix(&state);
+
+	if( osc_outbound_set_destination(&state) ) {
+		fprintf(stderr, "outbound: couldn't resolve 127.0.0.1\n");
+		return 1;
+	}
+
+	check_packets();
+	bench();
+
+	osc_outbound_free(&state);
+	lo_address_free(state.outgoing);
+	lo_server_free(state.server);
+
+	if( failures ) {
+		fprintf(stderr, "outbound: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("outbound: ok\n");
+	return 0;
+}
@@ -0,0 +1,249 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * checks the LED update planner against random and hand-picked frames.
+ * for every frame, playing the plan back onto a copy of what the device
+ * showed has to give exactly the frame we asked for, the cost the
+ * planner reports has to be what its commands really cost, and a whole
+ * quad mustn't cost more than the level map that would redraw it.
+ *
+ * exits nonzero if anything doesn't hold.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "led.h"
+
+static sosc_led_t led;
+static sosc_led_cmd_t cmds[SOSC_LED_MAX_CMDS];
+static uint8_t device[SOSC_LED_MAX_ROWS][SOSC_LED_MAX_COLS];
+
+static int failures;
+
+#define FAIL(...) do { \
+	fprintf(stderr, __VA_ARGS__); \
+	failures++; \
+} while( 0 )
+
+/* xorshift, so every platform plans the same frames */
+static uint32_t rng_state = 2463534242u;
+
+static uint32_t rng(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static int is_onoff(int level) {
+	return !level || level == SOSC_LED_MAX_LEVEL;
+}
+
+static int span_onoff(int x, int y, int dx, int dy, int n) {
+	for( ; n > 0; n--, x += dx, y += dy )
+		if( !is_onoff(led.level[y][x]) )
+			return 0;
+
+	return 1;
+}
+
+/* sends the LEDs in a line from level[][] to the device, returning the
+   cost of the command that would have done it */
+static int play_line(int x, int y, int dx, int dy, int n) {
+	int onoff = span_onoff(x, y, dx, dy, n);
+
+	for( ; n > 0; n--, x += dx, y += dy )
+		device[y][x] = led.level[y][x];
+
+	return onoff ? SOSC_LED_COST_ROW : SOSC_LED_COST_LEVEL_ROW;
+}
+
+static int play(const sosc_led_cmd_t *cmd) {
+	int x, y, onoff;
+
+	switch( cmd->type ) {
+	case SOSC_LED_CMD_SET:
+		device[cmd->y][cmd->x] = led.level[cmd->y][cmd->x];
+		return is_onoff(led.level[cmd->y][cmd->x])
+			? SOSC_LED_COST_SET : SOSC_LED_COST_LEVEL_SET;
+
+	case SOSC_LED_CMD_ALL:
+		memset(device, cmd->level, sizeof(device));
+		return is_onoff(cmd->level)
+			? SOSC_LED_COST_ALL : SOSC_LED_COST_LEVEL_ALL;
+
+	case SOSC_LED_CMD_MAP:
+		for( y = 0, onoff = 1; y < 8; y++ ) {
+			onoff &= span_onoff(cmd->x, cmd->y + y, 1, 0, 8);
+
+			for( x = 0; x < 8; x++ )
+				device[cmd->y + y][cmd->x + x] =
+					led.level[cmd->y + y][cmd->x + x];
+		}
+
+		return onoff ? SOSC_LED_COST_MAP : SOSC_LED_COST_LEVEL_MAP;
+
+	case SOSC_LED_CMD_ROW:
+		return play_line(cmd->x, cmd->y, 1, 0, cmd->n);
+
+	case SOSC_LED_CMD_COL:
+		return play_line(cmd->x, cmd->y, 0, 1, cmd->n);
+	}
+
+	return -1;
+}
+
+static void check(const char *name, int expect_n, int expect_cost) {
+	int i, n, x, y, cost, played, quads, full;
+	uint16_t dirty;
+
+	dirty = sosc_led_grid_quads(&led);
+	n = sosc_led_plan(&led, dirty, cmds, &cost);
+
+	memcpy(device, led.shown, sizeof(device));
+
+	for( i = played = 0; i < n; i++ )
+		played += play(&cmds[i]);
+
+	for( y = 0; y < led.rows; y++ )
+		for( x = 0; x < led.cols; x++ )
+			if( device[y][x] != led.level[y][x] ) {
+				FAIL("%s: LED %d,%d is %d after the plan, wanted %d\n",
+				     name, x, y, device[y][x], led.level[y][x]);
+				return;
+			}
+
+	if( played != cost )
+		FAIL("%s: plan says it costs %d, its commands cost %d\n",
+		     name, cost, played);
+
+	/* every quad is 8x8 when the grid is a multiple of 8 */
+	full = !(led.cols % 8) && !(led.rows % 8);
+	quads = ((led.cols + 7) / 8) * ((led.rows + 7) / 8);
+
+	if( full && cost > quads * SOSC_LED_COST_LEVEL_MAP )
+		FAIL("%s: cost %d is more than a level map per quad\n", name, cost);
+
+	if( expect_n >= 0 && n != expect_n )
+		FAIL("%s: %d commands, expected %d\n", name, n, expect_n);
+
+	if( expect_cost >= 0 && cost != expect_cost )
+		FAIL("%s: cost %d, expected %d\n", name, cost, expect_cost);
+}
+
+static void reset(int cols, int rows, int shown) {
+	memset(&led, 0, sizeof(led));
+	led.cols = cols;
+	led.rows = rows;
+
+	memset(led.shown, shown, sizeof(led.shown));
+}
+
+/* a frame where roughly one LED in every density changes, to levels
+   drawn from the first nlevels (so 2 is on/off only) */
+static void random_frame(int density, int nlevels) {
+	int x, y, level;
+
+	for( y = 0; y < led.rows; y++ )
+		for( x = 0; x < led.cols; x++ ) {
+			led.shown[y][x] = rng() % (SOSC_LED_MAX_LEVEL + 1);
+			led.level[y][x] = led.shown[y][x];
+
+			if( rng() % density )
+				continue;
+
+			level = rng() % nlevels;
+			led.level[y][x] = (nlevels == 2) ? level * SOSC_LED_MAX_LEVEL
+			                                 : level;
+		}
+}
+
+static void random_frames(void) {
+	static const int sizes[][2] = {
+		{8, 8}, {16, 8}, {8, 16}, {16, 16}, {12, 10}, {32, 16}};
+	static const int densities[] = {1, 2, 5, 17, 64};
+	char name[64];
+	int s, d, i, onoff;
+
+	for( s = 0; s < sizeof(sizes) / sizeof(*sizes); s++ )
+		for( d = 0; d < sizeof(densities) / sizeof(*densities); d++ )
+			for( onoff = 0; onoff < 2; onoff++ )
+				for( i = 0; i < 50; i++ ) {
+					reset(sizes[s][0], sizes[s][1], 0);
+					random_frame(densities[d],
+					             onoff ? 2 : SOSC_LED_MAX_LEVEL + 1);
+
+					snprintf(name, sizeof(name), "%dx%d, 1 in %d%s #%d",
+					         sizes[s][0], sizes[s][1], densities[d],
+					         onoff ? " on/off" : "", i);
+					check(name, -1, -1);
+				}
+}
+
+static void known_frames(void) {
+	int x;
+
+	reset(16, 16, 0);
+	check("nothing changed", 0, 0);
+
+	reset(16, 16, 0);
+	led.level[3][5] = SOSC_LED_MAX_LEVEL;
+	check("one LED on", 1, SOSC_LED_COST_SET);
+
+	reset(16, 16, 0);
+	led.level[3][5] = 7;
+	check("one LED to a level", 1, SOSC_LED_COST_LEVEL_SET);
+
+	reset(16, 16, SOSC_LED_UNKNOWN);
+	check("clearing an unknown grid", 1, SOSC_LED_COST_ALL);
+
+	reset(16, 16, 0);
+	memset(led.level, 9, sizeof(led.level));
+	check("whole grid to one level", 1, SOSC_LED_COST_LEVEL_ALL);
+
+	reset(16, 16, 0);
+	for( x = 0; x < 8; x++ )
+		led.level[2][x] = SOSC_LED_MAX_LEVEL;
+	check("one row of a quad", 1, SOSC_LED_COST_ROW);
+
+	reset(16, 16, 0);
+	for( x = 0; x < 8; x++ )
+		led.level[x][10] = 4;
+	check("one column of a quad", 1, SOSC_LED_COST_LEVEL_ROW);
+
+	reset(8, 8, SOSC_LED_UNKNOWN);
+	for( x = 0; x < 64; x++ )
+		led.level[x / 8][x % 8] = x % 16;
+	check("every LED of a quad different", 1, SOSC_LED_COST_LEVEL_MAP);
+}
+
+int main(int argc, char **argv) {
+	sosc_led_kernels_init();
+
+	known_frames();
+	random_frames();
+
+	if( failures ) {
+		fprintf(stderr, "planner: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("planner: ok\n");
+	return 0;
+}
@@ -0,0 +1,431 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * checks the filter in front of the OSC parser: each host gets as many
+ * LED and sys messages as its rates allow, and gets more back as time
+ * passes; hosts past the number of entries share one budget; a bundle
+ * costs a token for every message inside it, nested bundles included,
+ * and goes through whole or not at all; and hosts that aren't on the
+ * allowlist are refused without taking an allowed host's entry. then
+ * times a message, a bundle and a refusal.
+ *
+ * exits nonzero if anything doesn't hold.
+ */
+
+/* for clock_gettime() and strdup() under -std=c99 */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <lo/lo.h>
+
+#include "serialosc.h"
+#include "osc.h"
+
+#define LED_RATE 40
+#define SYS_RATE 20
+#define BENCH_PACKETS 200000
+
+static sosc_state_t state;
+
+static int failures;
+
+#define FAIL(...) do { \
+	fprintf(stderr, __VA_ARGS__); \
+	failures++; \
+} while( 0 )
+
+/**
+ * the platform's allocation wrappers
+ */
+
+char *s_asprintf(const char *fmt, ...) {
+	va_list args;
+	char *buf;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+
+	if( !(buf = s_malloc(len + 1)) )
+		return NULL;
+
+	va_start(args, fmt);
+	vsnprintf(buf, len + 1, fmt, args);
+	va_end(args);
+
+	return buf;
+}
+
+void *s_malloc(size_t size) {
+	return malloc(size);
+}
+
+void *s_calloc(size_t nmemb, size_t size) {
+	return calloc(nmemb, size);
+}
+
+void *s_strdup(const char *s) {
+	return strdup(s);
+}
+
+void s_free(void *ptr) {
+	free(ptr);
+}
+
+/* the animation timer is server.c's. nothing here starts an animation. */
+void sosc_led_anim_wake(sosc_state_t *state) {
+}
+
+/**
+ * packets, and the hosts they come from
+ */
+
+typedef struct {
+	uint8_t data[1024];
+	size_t len;
+} packet_t;
+
+static void message(packet_t *p, const char *path) {
+	lo_message m = lo_message_new();
+	uint8_t *data;
+	size_t len;
+
+	lo_message_add_int32(m, 1);
+	data = lo_message_serialise(m, path, NULL, &len);
+	lo_message_free(m);
+
+	memcpy(p->data, data, len);
+	p->len = len;
+	free(data);
+}
+
+static void bundle(packet_t *p) {
+	memcpy(p->data, "#bundle", 8);
+	memset(p->data + 8, 0, 8);
+	p->len = 16;
+}
+
+static void add(packet_t *b, const packet_t *element) {
+	uint32_t size = htonl(element->len);
+
+	memcpy(b->data + b->len, &size, sizeof(size));
+	memcpy(b->data + b->len + 4, element->data, element->len);
+	b->len += 4 + element->len;
+}
+
+static void add_message(packet_t *b, const char *path) {
+	packet_t m;
+
+	message(&m, path);
+	add(b, &m);
+}
+
+/* 10.0.n.1, or 127.0.0.1 for n < 0 */
+static struct sockaddr *host(int n) {
+	static struct sockaddr_in addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = n < 0
+		? htonl(INADDR_LOOPBACK) : htonl(0x0a000001 | (n << 8));
+	addr.sin_port = htons(9000);
+
+	return (struct sockaddr *) &addr;
+}
+
+static int let_through(int n, const packet_t *p, uint64_t now) {
+	return !osc_rx_filter(&state, host(n), p->data, p->len, now);
+}
+
+/* how many of count sends of p from host n get through */
+static int sends(int n, const packet_t *p, int count, uint64_t now) {
+	int i, through;
+
+	for( i = through = 0; i < count; i++ )
+		through += let_through(n, p, now);
+
+	return through;
+}
+
+static void init_filter(int led_rate, int sys_rate, const char *allow) {
+	memset(&state, 0, sizeof(state));
+
+	state.config.server.led_rate = led_rate;
+	state.config.server.sys_rate = sys_rate;
+
+	if( allow ) {
+		state.config.server.allow[0] = (char *) allow;
+		state.config.server.nallow = 1;
+	}
+
+	osc_rx_filter_init(&state);
+}
+
+/**
+ * the checks
+ */
+
+static void check_rates(void) {
+	packet_t led, sys;
+	int n;
+
+	init_filter(LED_RATE, SYS_RATE, NULL);
+	message(&led, "/monome/grid/led/set");
+	message(&sys, "/sys/info");
+
+	if( (n = sends(0, &led, LED_RATE * 2, 1000)) != LED_RATE )
+		FAIL("rates: %d LED messages through in one go, want %d\n", n,
+		     LED_RATE);
+
+	/* the classes don't draw on each other */
+	if( (n = sends(0, &sys, SYS_RATE * 2, 1000)) != SYS_RATE )
+		FAIL("rates: %d sys messages through after the LED ones, want %d\n",
+		     n, SYS_RATE);
+
+	/* nor do the hosts */
+	if( (n = sends(1, &led, LED_RATE * 2, 1000)) != LED_RATE )
+		FAIL("rates: another host got %d LED messages through, want %d\n",
+		     n, LED_RATE);
+
+	/* a quarter of a second later, a quarter of a second's worth */
+	if( (n = sends(0, &led, LED_RATE, 1250)) != LED_RATE / 4 )
+		FAIL("rates: %d LED messages through after 250 ms, want %d\n", n,
+		     LED_RATE / 4);
+
+	/* and never more than a second's */
+	if( (n = sends(0, &led, LED_RATE * 2, 100000)) != LED_RATE )
+		FAIL("rates: %d LED messages through after a long wait, want %d\n",
+		     n, LED_RATE);
+}
+
+/* once every entry is taken, newcomers share one budget between them,
+   however many of them there are */
+static void check_newcomers(void) {
+	packet_t led;
+	int i, through;
+
+	init_filter(LED_RATE, SYS_RATE, NULL);
+	message(&led, "/monome/grid/led/set");
+
+	for( i = 0; i < SOSC_RX_MAX_SOURCES; i++ )
+		let_through(i, &led, 1000);
+
+	for( i = through = 0; i < 1000; i++ )
+		through += let_through(SOSC_RX_MAX_SOURCES + i, &led, 1000);
+
+	if( through != LED_RATE )
+		FAIL("newcomers: %d LED messages through from 1000 new hosts, "
+		     "want %d\n", through, LED_RATE);
+}
+
+static void check_bundles(void) {
+	packet_t led, sys, inner, outer, empty, broken;
+	int n;
+
+	init_filter(LED_RATE, SYS_RATE, NULL);
+	message(&led, "/monome/grid/led/set");
+	message(&sys, "/sys/info");
+
+	/* 3 LED messages, then a bundle of a sys and another LED one */
+	bundle(&inner);
+	add_message(&inner, "/sys/port");
+	add_message(&inner, "/monome/grid/led/all");
+
+	bundle(&outer);
+	add_message(&outer, "/monome/grid/led/set");
+	add_message(&outer, "/monome/grid/led/row");
+	add_message(&outer, "/monome/grid/led/col");
+	add(&outer, &inner);
+
+	/* LED_RATE / 4 of them use up all the LED tokens, and half the sys */
+	if( (n = sends(0, &outer, LED_RATE, 1000)) != LED_RATE / 4 )
+		FAIL("bundles: %d through, want %d\n", n, LED_RATE / 4);
+
+	if( (n = sends(0, &sys, SYS_RATE, 1000)) != SYS_RATE / 2 )
+		FAIL("bundles: %d sys messages through after them, want %d\n", n,
+		     SYS_RATE / 2);
+
+	/* a bundle of nothing but sys messages is charged as sys, even with
+	   LED tokens to spare */
+	init_filter(LED_RATE, SYS_RATE, NULL);
+
+	bundle(&inner);
+	add_message(&inner, "/sys/info");
+	add_message(&inner, "/sys/info");
+
+	if( (n = sends(0, &inner, SYS_RATE, 1000)) != SYS_RATE / 2 )
+		FAIL("bundles: %d sys bundles through, want %d\n", n, SYS_RATE / 2);
+
+	if( (n = sends(0, &led, LED_RATE, 1000)) != LED_RATE )
+		FAIL("bundles: sys bundles used up LED tokens\n");
+
+	/* a bundle too big for the budget never goes through, and costs
+	   nothing when it doesn't */
+	init_filter(LED_RATE, SYS_RATE, NULL);
+
+	bundle(&outer);
+	for( n = 0; n < SYS_RATE + 1; n++ )
+		add_message(&outer, "/sys/info");
+	add_message(&outer, "/monome/grid/led/set");
+
+	if( let_through(0, &outer, 1000) )
+		FAIL("bundles: more sys messages than a second's worth went "
+		     "through\n");
+
+	if( (n = sends(0, &led, LED_RATE, 1000)) != LED_RATE )
+		FAIL("bundles: a dropped bundle took %d LED tokens\n",
+		     LED_RATE - n);
+
+	/* empty, or cut short: still a packet to parse, so still a token */
+	init_filter(LED_RATE, SYS_RATE, NULL);
+
+	bundle(&empty);
+
+	bundle(&broken);
+	add_message(&broken, "/sys/info");
+	broken.len -= 4;
+
+	if( (n = sends(0, &empty, LED_RATE / 2, 1000)
+	         + sends(0, &broken, LED_RATE, 1000)) != LED_RATE )
+		FAIL("bundles: %d empty and broken ones through, want %d\n", n,
+		     LED_RATE);
+}
+
+static void check_allowlist(void) {
+	sosc_rx_filter_t *f = &state.rx_filter;
+	packet_t led;
+	int i, n, entries;
+
+	init_filter(LED_RATE, SYS_RATE, "127.0.0.1");
+	message(&led, "/monome/grid/led/set");
+
+	if( !f->active || f->nallow != 1 ) {
+		FAIL("allowlist: 127.0.0.1 didn't make it onto the list\n");
+		return;
+	}
+
+	let_through(-1, &led, 1000);
+
+	/* far more strangers than there are entries */
+	if( (n = sends(0, &led, 1, 1000)) )
+		FAIL("allowlist: a stranger got through\n");
+
+	for( i = 0; i < SOSC_RX_MAX_SOURCES * 4; i++ )
+		n += let_through(i, &led, 2000 + i);
+
+	if( n )
+		FAIL("allowlist: %d strangers got through\n", n);
+
+	if( f->refused != SOSC_RX_MAX_SOURCES * 4 + 1 )
+		FAIL("allowlist: %lu refusals counted, want %d\n", f->refused,
+		     SOSC_RX_MAX_SOURCES * 4 + 1);
+
+	for( i = entries = 0; i < SOSC_RX_MAX_SOURCES; i++ )
+		entries += f->sources[i].in_use;
+
+	if( entries != 1 || f->sources[0].shared )
+		FAIL("allowlist: %d entries in use after the strangers, want just "
+		     "the allowed host's own\n", entries);
+
+	/* which still has its own budget, less the one it's used */
+	if( (n = sends(-1, &led, LED_RATE * 2, 1000)) != LED_RATE - 1 )
+		FAIL("allowlist: the allowed host got %d through, want %d\n", n,
+		     LED_RATE - 1);
+}
+
+/**
+ * benchmark
+ */
+
+static double now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* from one of sources hosts, with time moving on fast enough that
+   nothing's dropped */
+static double packet_ns(const packet_t *p, int sources) {
+	double start;
+	int i;
+
+	start = now_ns();
+
+	for( i = 0; i < BENCH_PACKETS; i++ )
+		let_through(i % sources, p, 1000 + i);
+
+	return (now_ns() - start) / BENCH_PACKETS;
+}
+
+static void bench(void) {
+	double one, many, bundled, refused;
+	packet_t led, b;
+	int i;
+
+	message(&led, "/monome/grid/led/set");
+
+	bundle(&b);
+	for( i = 0; i < 8; i++ )
+		add_message(&b, "/monome/grid/led/set");
+
+	init_filter(1000000, 1000000, NULL);
+
+	/* the first run only warms things up */
+	packet_ns(&led, 1);
+
+	one = packet_ns(&led, 1);
+	many = packet_ns(&led, SOSC_RX_MAX_SOURCES);
+	bundled = packet_ns(&b, 1);
+
+	init_filter(1000000, 1000000, "127.0.0.1");
+	refused = packet_ns(&led, SOSC_RX_MAX_SOURCES);
+
+	printf("filtering a message: one host %5.1f ns, %d hosts %5.1f ns\n",
+	       one, SOSC_RX_MAX_SOURCES, many);
+	printf("filtering a bundle of 8 messages: %5.1f ns\n", bundled);
+	printf("refusing a host not on the allowlist: %5.1f ns\n", refused);
+}
+
+int main(int argc, char **argv) {
+	check_rates();
+	check_newcomers();
+	check_bundles();
+	check_allowlist();
+
+	bench();
+
+	if( failures ) {
+		fprintf(stderr, "rx_filter: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("rx_filter: ok\n");
+	return 0;
+}
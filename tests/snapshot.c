@@ -0,0 +1,272 @@
+/**
+ * Copyright (c) 2013 William Light <wrl@illest.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * checks the LED snapshot format. a small frame has to come out byte for
+ * byte as written down here, since snapshots outlive the serialosc that
+ * saved them. random frames on every shape of device (grids with and
+ * without colour, arcs with some rings dark) have to come back exactly
+ * as they were saved, and fit in SOSC_LED_SNAPSHOT_MAX. snapshots from
+ * another size of grid, another version, too long ago or the future,
+ * or cut short or padded out, have to be turned down without drawing
+ * anything.
+ *
+ * exits nonzero if anything doesn't hold.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "led.h"
+
+#define NOW     1700000000
+#define MAX_AGE 30
+
+static sosc_led_t saved, restored;
+static uint8_t buf[SOSC_LED_SNAPSHOT_MAX + 64];
+
+static int failures;
+
+#define FAIL(...) do { \
+	fprintf(stderr, __VA_ARGS__); \
+	failures++; \
+} while( 0 )
+
+/* xorshift, so every platform saves the same frames */
+static uint32_t rng_state = 2463534242u;
+
+static uint32_t rng(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static void reset(sosc_led_t *led, int cols, int rows) {
+	memset(led, 0, sizeof(*led));
+	led->cols = cols;
+	led->rows = rows;
+	led->layers[0].in_use = 1;
+	sosc_led_ring_init(led);
+}
+
+static int same(const sosc_led_t *a, const sosc_led_t *b) {
+	int y;
+
+	for( y = 0; y < a->rows; y++ )
+		if( memcmp(a->level[y], b->level[y], a->cols)
+		    || (a->color_used
+		        && memcmp(a->color[y], b->color[y],
+		                  a->cols * sizeof(a->color[y][0]))) )
+			return 0;
+
+	return a->color_used == b->color_used
+		&& !memcmp(a->ring, b->ring, sizeof(a->ring));
+}
+
+/**
+ * the checks
+ */
+
+static void check_known(void) {
+	static const uint8_t want[] = {
+		's', 'l', 'e', 'd', 2, 4, 2, 0, 0x02,
+		0, 0, 0, 0, 0x65, 0x53, 0xf1, 0x00,
+
+		/* the grid */
+		0x01, 0x23, 0x45, 0x67,
+
+		/* ring 1 */
+		0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef,
+		0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef,
+		0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef,
+		0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef
+	};
+
+	uint8_t levels[SOSC_LED_RING_SIZE];
+	size_t len, i;
+
+	reset(&saved, 4, 2);
+
+	for( i = 0; i < SOSC_LED_RING_SIZE; i++ )
+		levels[i] = i % 16;
+
+	sosc_led_rect(&saved, 0, 0, 4, 2, levels);
+	sosc_led_ring_map(&saved, 1, levels);
+
+	len = sosc_led_snapshot(&saved, buf, NOW);
+
+	if( len != sizeof(want) ) {
+		FAIL("known frame: %zu bytes, want %zu\n", len, sizeof(want));
+		return;
+	}
+
+	for( i = 0; i < len; i++ )
+		if( buf[i] != want[i] ) {
+			FAIL("known frame: byte %zu is %02x, want %02x\n", i, buf[i],
+			     want[i]);
+			return;
+		}
+}
+
+/* a random frame on a cols * rows device, with colour if color is set,
+   and each ring lit with a chance of 1 in ring_odds (0 for never) */
+static void random_frame(int cols, int rows, int color, int ring_odds) {
+	static uint8_t levels[SOSC_LED_MAX_ROWS * SOSC_LED_MAX_COLS],
+		rgb[SOSC_LED_MAX_ROWS * SOSC_LED_MAX_COLS * 3];
+	int i, n;
+
+	reset(&saved, cols, rows);
+
+	for( i = 0; i < cols * rows; i++ )
+		levels[i] = rng() % 16;
+
+	if( cols && rows )
+		sosc_led_rect(&saved, 0, 0, cols, rows, levels);
+
+	if( color ) {
+		for( i = 0; i < cols * rows * 3; i++ )
+			rgb[i] = rng();
+
+		sosc_led_color_rect(&saved, 0, 0, cols, rows, rgb);
+	}
+
+	for( n = 0; n < SOSC_LED_MAX_RINGS; n++ ) {
+		if( !ring_odds || rng() % ring_odds )
+			continue;
+
+		for( i = 0; i < SOSC_LED_RING_SIZE; i++ )
+			levels[i] = rng() % 16;
+
+		sosc_led_ring_map(&saved, n, levels);
+	}
+}
+
+static void check_round_trips(void) {
+	static const int shapes[][2] = {
+		{8, 8}, {16, 8}, {8, 16}, {16, 16}, {32, 16}, {32, 32}, {5, 3}, {0, 0}
+	};
+
+	int s, color, i;
+	size_t len;
+
+	for( s = 0; s < sizeof(shapes) / sizeof(*shapes); s++ )
+		for( color = 0; color < 2; color++ )
+			for( i = 0; i < 20; i++ ) {
+				random_frame(shapes[s][0], shapes[s][1], color,
+				             shapes[s][0] ? 0 : 2);
+
+				len = sosc_led_snapshot(&saved, buf, NOW - (i % MAX_AGE));
+
+				if( len > SOSC_LED_SNAPSHOT_MAX )
+					FAIL("%dx%d: %zu bytes is more than the most there "
+					     "can be\n", shapes[s][0], shapes[s][1], len);
+
+				reset(&restored, shapes[s][0], shapes[s][1]);
+
+				if( sosc_led_restore(&restored, buf, len, NOW, MAX_AGE) )
+					FAIL("%dx%d%s #%d: turned down\n", shapes[s][0],
+					     shapes[s][1], color ? " colour" : "", i);
+				else if( !same(&saved, &restored) )
+					FAIL("%dx%d%s #%d: came back different\n",
+					     shapes[s][0], shapes[s][1],
+					     color ? " colour" : "", i);
+			}
+
+	/* everything there can be in a snapshot, all at once */
+	random_frame(SOSC_LED_MAX_COLS, SOSC_LED_MAX_ROWS, 1, 1);
+
+	if( (len = sosc_led_snapshot(&saved, buf, NOW)) != SOSC_LED_SNAPSHOT_MAX )
+		FAIL("a full snapshot is %zu bytes, want %d\n", len,
+		     SOSC_LED_SNAPSHOT_MAX);
+}
+
+/* a snapshot that has to be turned down, leaving the framebuffer as it
+   was */
+static void check_refused(const char *why, int cols, int rows,
+                          const uint8_t *data, size_t len, uint64_t now) {
+	static sosc_led_t before;
+	int n;
+
+	reset(&restored, cols, rows);
+	sosc_led_fill(&restored, 3);
+
+	for( n = 0; n < SOSC_LED_MAX_RINGS; n++ )
+		sosc_led_ring_fill(&restored, n, 3);
+
+	before = restored;
+
+	if( !sosc_led_restore(&restored, data, len, now, MAX_AGE) )
+		FAIL("%s: restored\n", why);
+	else if( memcmp(&before, &restored, sizeof(before)) )
+		FAIL("%s: drew something all the same\n", why);
+}
+
+static void check_refusals(void) {
+	uint8_t copy[sizeof(buf)];
+	size_t len;
+
+	random_frame(16, 16, 1, 2);
+	sosc_led_ring_set(&saved, 0, 0, 15);
+	len = sosc_led_snapshot(&saved, buf, NOW);
+
+	check_refused("another size of grid", 16, 8, buf, len, NOW);
+	check_refused("an arc", 0, 0, buf, len, NOW);
+	check_refused("too long ago", 16, 16, buf, len, NOW + MAX_AGE + 1);
+	check_refused("from the future", 16, 16, buf, len, NOW - 1);
+	check_refused("cut short", 16, 16, buf, len - 1, NOW);
+	check_refused("just the header", 16, 16, buf, 17, NOW);
+	check_refused("not even the header", 16, 16, buf, 16, NOW);
+	check_refused("empty", 16, 16, buf, 0, NOW);
+
+	memcpy(copy, buf, len);
+	copy[len] = 0;
+	check_refused("padded out", 16, 16, copy, len + 1, NOW);
+
+	memcpy(copy, buf, len);
+	copy[0] = 'S';
+	check_refused("another magic number", 16, 16, copy, len, NOW);
+
+	memcpy(copy, buf, len);
+	copy[4] = 1;
+	check_refused("version 1", 16, 16, copy, len, NOW);
+
+	/* flags and mask which don't match what follows */
+	memcpy(copy, buf, len);
+	copy[7] = 0;
+	check_refused("colour left out of the flags", 16, 16, copy, len, NOW);
+
+	memcpy(copy, buf, len);
+	copy[8] ^= 0x80;
+	check_refused("a ring more or less in the mask", 16, 16, copy, len, NOW);
+}
+
+int main(int argc, char **argv) {
+	sosc_led_kernels_init();
+
+	check_known();
+	check_round_trips();
+	check_refusals();
+
+	if( failures ) {
+		fprintf(stderr, "snapshot: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("snapshot: ok\n");
+	return 0;
+}